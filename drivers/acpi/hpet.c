@@ -10,21 +10,122 @@
  */
 
 #include "acpi.h"
+#include "apic.h"
 #include "hhdm.h"
 #include "idt.h"
+#include "irq.h"
 #include "printk.h"
+#include "smp.h"
 #include "stdint.h"
+#include "timer.h"
+
+#define HPET_SHIFT        22         // Fixed-point shift of the counter to nanosecond multiplier
+#define HPET_MAX_EVENT_NS 1000000000 // Longest one-shot delay
 
 hpet_info_t    *hpet_addr;
-static uint32_t hpet_period = 0;
+static uint32_t hpet_period     = 0;  // Counter period in femtoseconds
+static uint64_t hpet_mult       = 0;  // Nanoseconds per counter tick, scaled by 2^HPET_SHIFT
+static int      hpet_comparator = -1; // Comparator used as event source
+static int      hpet_cmp_32bit  = 0;  // The comparator only matches the low 32 bits
 
-void timer_handle(interrupt_frame_t *frame);
+/* Read the HPET main counter */
+uint64_t hpet_read_counter(void)
+{
+    if (!hpet_addr) return 0;
+    return hpet_addr->main_counter_value;
+}
+
+/* Returns the HPET counter period in femtoseconds */
+uint32_t hpet_get_period(void)
+{
+    return hpet_period;
+}
 
-/* Returns the nanosecond value of the current time */
-uint64_t nano_time(void)
+/* Returns the nanosecond value of the HPET main counter */
+uint64_t hpet_nano_time(void)
 {
     if (!hpet_addr) return 0;
-    return (hpet_addr->main_counter_value) * hpet_period;
+    return (uint64_t)(((unsigned __int128)hpet_addr->main_counter_value * hpet_mult) >> HPET_SHIFT);
+}
+
+/* Set up an HPET comparator as a one-shot event source, returns the comparator or -1 */
+int hpet_clockevent_init(uint8_t vector, uint32_t apic_id)
+{
+    if (!hpet_addr) return -1;
+
+    uint32_t count  = ((hpet_addr->general_capabilities >> 8) & 0x1f) + 1;
+    int      fsb    = -1;
+    int      ioapic = -1;
+    uint32_t pin    = 0;
+
+    /* Prefer FSB delivery, it needs no I/O APIC pin and goes straight to the local APIC */
+    for (uint32_t i = 0; i < count; i++) {
+        uint64_t cap = hpet_addr->timers[i].configuration_and_capability;
+        if (cap & HPET_TN_FSB_CAP) {
+            fsb = (int)i;
+            break;
+        }
+        uint32_t routes = cap >> 32;
+        if (ioapic < 0 && routes) {
+            /* Keep away from the ISA interrupt range if possible */
+            ioapic = (int)i;
+            pin    = __builtin_ctz((routes & ~0xffffU) ? (routes & ~0xffffU) : routes);
+        }
+    }
+
+    int index = fsb >= 0 ? fsb : ioapic;
+    if (index < 0) {
+        plogk("hpet: No comparator can deliver interrupts.\n");
+        return -1;
+    }
+
+    volatile hpet_timer_t *timer  = &hpet_addr->timers[index];
+    uint64_t               config = timer->configuration_and_capability;
+
+    config &= ~(uint64_t)(HPET_TN_INT_TYPE | HPET_TN_PERIODIC | HPET_TN_32MODE | HPET_TN_ROUTE_MASK | HPET_TN_FSB_EN);
+    if (fsb >= 0) {
+        timer->fsb_interrupt_route = ((uint64_t)(HPET_MSI_ADDRESS | (apic_id << 12)) << 32) | vector;
+        config |= HPET_TN_FSB_EN;
+    } else {
+        ioapic_route_gsi(pin, vector, 0, get_current_cpu_id());
+        config |= (uint64_t)pin << HPET_TN_ROUTE_SHIFT;
+    }
+    timer->comparator_value             = ~(uint64_t)0;
+    timer->configuration_and_capability = config | HPET_TN_INT_ENB;
+
+    hpet_comparator = index;
+    hpet_cmp_32bit  = !(config & HPET_TN_SIZE_CAP);
+
+    if (fsb >= 0)
+        plogk("hpet: Comparator %d in one-shot FSB mode, vector %u -> APIC %u\n", index, vector, apic_id);
+    else
+        plogk("hpet: Comparator %d in one-shot mode, I/O APIC pin %u -> vector %u\n", index, pin, vector);
+    return index;
+}
+
+/* Arm the HPET comparator to fire after the specified nanoseconds, returns -1 if the deadline already passed */
+int hpet_set_next_event(uint64_t delta_ns)
+{
+    if (hpet_comparator < 0) return -1;
+    if (delta_ns > HPET_MAX_EVENT_NS) delta_ns = HPET_MAX_EVENT_NS;
+
+    volatile hpet_timer_t *timer  = &hpet_addr->timers[hpet_comparator];
+    uint64_t               ticks  = delta_ns * 1000000 / hpet_period;
+    uint64_t               target = hpet_addr->main_counter_value + (ticks ? ticks : 1);
+
+    timer->comparator_value = target;
+
+    /* The comparator only matches on equality, a deadline that slipped by would never fire */
+    uint64_t now = hpet_addr->main_counter_value;
+    if (hpet_cmp_32bit ? (int32_t)((uint32_t)now - (uint32_t)target) >= 0 : (int64_t)(now - target) >= 0) return -1;
+    return 0;
+}
+
+/* Disable the HPET comparator interrupt */
+void hpet_clockevent_stop(void)
+{
+    if (hpet_comparator < 0) return;
+    hpet_addr->timers[hpet_comparator].configuration_and_capability &= ~(uint64_t)HPET_TN_INT_ENB;
 }
 
 /* Initialize high-precision event timer */
@@ -33,15 +134,15 @@ void hpet_init(hpet_t *hpet)
     hpet_addr = phys_to_virt(hpet->base_address.address);
     plogk("hpet: HPET base mapped to virtual address %p\n", hpet_addr);
 
-    uint32_t counter_clock_period = hpet_addr->general_capabilities >> 32;
-    hpet_period                   = counter_clock_period / 1000000;
+    hpet_period                   = hpet_addr->general_capabilities >> 32;
+    hpet_mult                     = ((uint64_t)hpet_period << HPET_SHIFT) / 1000000;
     hpet_addr->main_counter_value = 0;
 
     plogk("hpet: HPET main counter is initialized to 0\n");
-    plogk("hpet: HPET counter clock period = %u (ns)\n", counter_clock_period);
-    plogk("hpet: HPET timer period = %u (us)\n", hpet_period);
+    plogk("hpet: HPET counter clock period = %u (fs)\n", hpet_period);
+    plogk("hpet: HPET frequency = %llu (Hz)\n", 1000000000000000ULL / hpet_period);
 
     hpet_addr->general_configuration |= 1;
-    register_interrupt_handler(IRQ_0, (void *)timer_handle, 0, 0x8e);
+    irq_register(IRQ_0, timer_handle, 0, "timer");
     plogk("hpet: HPET general configuration register set to 0x%08llx\n", hpet_addr->general_configuration);
 }
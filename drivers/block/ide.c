@@ -13,11 +13,13 @@
 #include "apic.h"
 #include "common.h"
 #include "interrupt.h"
+#include "irq.h"
 #include "pci.h"
 #include "printk.h"
 #include "stddef.h"
 #include "stdint.h"
 #include "timer.h"
+#include "trace.h"
 
 /* Request for operation IDE Controller */
 pci_finding_request_t ide_pci_request = {
@@ -44,15 +46,13 @@ static int package[2];
 static volatile uint8_t ide_irq_invoked = 0;
 
 /* IDE interrupt handling function */
-INTERRUPT_BEGIN static void ide_irq(interrupt_frame_t *frame)
+static irq_return_t ide_irq(uint8_t vector, void *data)
 {
-    (void)frame;
-    disable_intr();
+    (void)vector;
+    (void)data;
     ide_irq_invoked = 1;
-    send_eoi();
-    enable_intr();
+    return IRQ_HANDLED;
 }
-INTERRUPT_END
 
 /* Waiting for IDE interrupt to be triggered */
 static void ide_wait_irq(void)
@@ -230,8 +230,8 @@ void init_ide(void)
          */
     }
     bar_reg.parent = ide_pci_request.response->device;
-    register_interrupt_handler(IRQ_14, (void *)ide_irq, 0, 0x8e);
-    register_interrupt_handler(IRQ_15, (void *)ide_irq, 0, 0x8e);
+    irq_register(IRQ_14, ide_irq, 0, "ide0");
+    irq_register(IRQ_15, ide_irq, 0, "ide1");
 
     for (uint32_t idx = 0; idx < 6; idx++) {
         bar_reg.offset = ECAM_OTHERS + idx * 4;
@@ -330,6 +330,7 @@ uint8_t ide_ata_access(uint8_t direction, uint8_t drive, uint32_t lba, uint8_t n
     uint16_t cyl, i;
     uint8_t  head, sect, err;
 
+    trace_ide_command(drive, lba, numsects);
     ide_write(channel, ATA_REG_CONTROL, channels[channel].nIEN = (ide_irq_invoked = 0x0) + 0x02);
     if (lba >= 0x10000000) {
         lba_mode  = 2;
@@ -15,10 +15,16 @@
 #include "common.h"
 #include "debug.h"
 #include "hhdm.h"
+#include "idt.h"
+#include "irq.h"
+#include "klog.h"
+#include "page.h"
 #include "printk.h"
+#include "smp.h"
 #include "stddef.h"
 #include "stdint.h"
 #include "stdlib.h"
+#include "trace.h"
 
 mcfg_info_t mcfg_info;
 
@@ -196,10 +202,10 @@ void mcfg_init(mcfg_t *mcfg)
         for (size_t i = 0; i < mcfg_info.count; i++) {
             /* Convert to the virtual address */
             inner->entries[i].base_addr = (uint64_t)phys_to_virt(inner->entries[i].base_addr);
-            plogk("mcfg: mcfg->entries[%lu] base: %p\n", i, inner->entries[i].base_addr);
-            plogk("mcfg: mcfg->entries[%lu] segment: %hu\n", i, inner->entries[i].segment);
-            plogk("mcfg: mcfg->entries[%lu] start bus: %hhu\n", i, inner->entries[i].start_bus);
-            plogk("mcfg: mcfg->entries[%lu] end bus: %hhu\n", i, inner->entries[i].end_bus);
+            klog_debug("mcfg: mcfg->entries[%lu] base: %p\n", i, inner->entries[i].base_addr);
+            klog_debug("mcfg: mcfg->entries[%lu] segment: %hu\n", i, inner->entries[i].segment);
+            klog_debug("mcfg: mcfg->entries[%lu] start bus: %hhu\n", i, inner->entries[i].start_bus);
+            klog_debug("mcfg: mcfg->entries[%lu] end bus: %hhu\n", i, inner->entries[i].end_bus);
         }
         mcfg_info.mcfg    = inner;
         mcfg_info.enabled = 1;
@@ -349,6 +355,11 @@ static void pci_mcfg_write(pci_device_reg_t reg, uint32_t value)
             ptr = ecam.ops2_ecam;
             break;
         default :
+            /* Only the header is cached, capabilities are reached through ECAM directly */
+            if (area >= ECAM_CAPS) {
+                ptr = mcfg_ecam_addr(reg.parent->entry, reg);
+                break;
+            }
             ptr = ecam.others[(area - ECAM_OTHERS) / 4];
             break;
     }
@@ -390,6 +401,11 @@ static uint32_t pci_mcfg_read(pci_device_reg_t reg)
             ptr = ecam.ops2_ecam;
             break;
         default :
+            /* Only the header is cached, capabilities are reached through ECAM directly */
+            if (area >= ECAM_CAPS) {
+                ptr = mcfg_ecam_addr(reg.parent->entry, reg);
+                break;
+            }
             if (ecam.others == 0) {
                 panic("PCI: ECAM area is not initialized properly.");
                 return 0; // Unreachable, but to avoid compiler warning
@@ -400,16 +416,26 @@ static uint32_t pci_mcfg_read(pci_device_reg_t reg)
     return *ptr >> (8 * offset);
 }
 
+/* Bus, slot and function of a register as one trace field */
+static inline uint32_t pci_trace_id(pci_device_reg_t reg)
+{
+    if (!reg.parent || !reg.parent->device) return 0;
+    return reg.parent->device->bus << 8 | reg.parent->device->slot << 3 | reg.parent->device->func;
+}
+
 /* Reading values ​​from PCI device registers */
 uint32_t read_pci(pci_device_reg_t reg)
 {
-    return pci_ops.read(reg);
+    uint32_t value = pci_ops.read(reg);
+    trace_pci_read(pci_trace_id(reg), reg.offset, value);
+    return value;
 }
 
 /* Write values ​​to PCI device registers */
 void write_pci(pci_device_reg_t reg, uint32_t value)
 {
-    return pci_ops.write(reg, value);
+    trace_pci_write(pci_trace_id(reg), reg.offset, value);
+    pci_ops.write(reg, value);
 }
 
 /* Read the value from the PCI device command status register */
@@ -532,6 +558,202 @@ uint32_t pci_get_irq(pci_device_cache_t *device)
     return read_pci(reg);
 }
 
+/* Find a capability in the capability list, returns its offset or 0 */
+uint32_t pci_find_capability(pci_device_cache_t *device, uint8_t cap_id)
+{
+    pci_device_reg_t reg = {device, PCI_CONF_COMMAND};
+    if (!((read_pci(reg) >> 16) & PCI_STATUS_CAP_LIST)) return 0;
+
+    reg.offset      = PCI_CONF_CAP_PTR;
+    uint32_t offset = read_pci(reg) & 0xfc;
+
+    /* A capability is at least 4 bytes, so a well-formed list has at most 48 entries */
+    for (int ttl = 48; offset >= ECAM_CAPS && ttl; ttl--) {
+        reg.offset      = offset;
+        uint32_t header = read_pci(reg);
+        if ((header & 0xff) == cap_id) return offset;
+        offset = (header >> 8) & 0xfc;
+    }
+    return 0;
+}
+
+/* Read the message control word of a capability */
+static uint16_t pci_cap_read_ctrl(pci_device_cache_t *device, uint32_t cap)
+{
+    pci_device_reg_t reg = {device, cap};
+    return read_pci(reg) >> 16;
+}
+
+/* Write the message control word of a capability (the config space is written by dwords) */
+static void pci_cap_write_ctrl(pci_device_cache_t *device, uint32_t cap, uint16_t ctrl)
+{
+    pci_device_reg_t reg   = {device, cap};
+    uint32_t         value = read_pci(reg);
+    write_pci(reg, (value & 0xffff) | ((uint32_t)ctrl << 16));
+}
+
+/* Enable or disable the legacy INTx interrupt of a device */
+static void pci_set_intx(pci_device_cache_t *device, int enable)
+{
+    uint32_t command = pci_read_command_status(device) & 0xffff; // Do not write back the status bits
+    if (enable)
+        command &= ~PCI_COMMAND_INTX_DISABLE;
+    else
+        command |= PCI_COMMAND_INTX_DISABLE;
+    pci_write_command_status(device, command);
+}
+
+/* Message address that delivers to the local APIC of a CPU */
+static uint32_t pci_msi_address(uint32_t cpu)
+{
+    return PCI_MSI_ADDRESS_BASE | ((get_cpu_lapic_id(cpu) & 0xff) << 12);
+}
+
+/* Allocate a vector and install its handler, returns the vector or -1 */
+static int pci_msi_alloc_vector(irq_handler_t handler, void *data)
+{
+    int vector = idt_alloc_vector();
+    if (vector < 0) {
+        plogk("pci: No free interrupt vector for MSI.\n");
+        return -1;
+    }
+    if (irq_register(vector, handler, data, "msi") < 0) {
+        idt_free_vectors(vector, 1);
+        return -1;
+    }
+    return vector;
+}
+
+/* Enable MSI with a single message targeting the specified CPU, returns the vector or -1 */
+int pci_msi_enable(pci_device_cache_t *device, uint32_t cpu, irq_handler_t handler, void *data)
+{
+    uint32_t cap = pci_find_capability(device, PCI_CAP_ID_MSI);
+    if (!cap) return -1;
+
+    int vector = pci_msi_alloc_vector(handler, data);
+    if (vector < 0) return -1;
+
+    uint16_t         ctrl = pci_cap_read_ctrl(device, cap);
+    pci_device_reg_t reg  = {device, cap + 4};
+    write_pci(reg, pci_msi_address(cpu));
+
+    if (ctrl & PCI_MSI_CTRL_64BIT) {
+        reg.offset = cap + 8;
+        write_pci(reg, 0); // Upper address
+        reg.offset = cap + 12;
+    } else {
+        reg.offset = cap + 8;
+    }
+    write_pci(reg, (uint32_t)vector); // Fixed delivery, edge triggered
+
+    pci_cap_write_ctrl(device, cap, (ctrl & ~PCI_MSI_CTRL_MME) | PCI_MSI_CTRL_ENABLE);
+    pci_set_intx(device, 0);
+    return vector;
+}
+
+/* Disable MSI and release its vector */
+void pci_msi_disable(pci_device_cache_t *device)
+{
+    uint32_t cap = pci_find_capability(device, PCI_CAP_ID_MSI);
+    if (!cap) return;
+
+    uint16_t ctrl = pci_cap_read_ctrl(device, cap);
+    if (!(ctrl & PCI_MSI_CTRL_ENABLE)) return;
+    pci_cap_write_ctrl(device, cap, ctrl & ~PCI_MSI_CTRL_ENABLE);
+
+    pci_device_reg_t reg = {device, cap + ((ctrl & PCI_MSI_CTRL_64BIT) ? 12 : 8)};
+    irq_release_vector(read_pci(reg) & 0xff);
+    pci_set_intx(device, 1);
+}
+
+/* Get the MSI-X table of a device */
+static volatile uint32_t *pci_msix_table(pci_device_cache_t *device, uint32_t cap)
+{
+    pci_device_reg_t        reg   = {device, cap + 4};
+    uint32_t                table = read_pci(reg);
+    base_address_register_t bar   = get_base_address_register(device, table & 0x7);
+    uint64_t                size  = ((pci_cap_read_ctrl(device, cap) & PCI_MSIX_CTRL_SIZE) + 1) * PCI_MSIX_ENTRY_SIZE;
+
+    /* An unassigned BAR reads as zero, the address is still an HHDM pointer */
+    if (bar.type != mem_mapping || !virt_to_phys((uint64_t)bar.address)) return 0;
+
+    /* The table is reached through the HHDM, which may not cover high BARs */
+    uint64_t start = (uint64_t)bar.address + (table & ~0x7U);
+    if (!page_is_mapped(get_kernel_pagedir(), start) || !page_is_mapped(get_kernel_pagedir(), start + size - 1)) {
+        plogk("pci: MSI-X table at %p is not mapped.\n", virt_to_phys(start));
+        return 0;
+    }
+    pointer_cast_t cast;
+    cast.val = start;
+    return cast.ptr;
+}
+
+/* Enable MSI-X with all entries masked, returns the table size or -1 */
+int pci_msix_enable(pci_device_cache_t *device)
+{
+    uint32_t cap = pci_find_capability(device, PCI_CAP_ID_MSIX);
+    if (!cap) return -1;
+
+    uint16_t           ctrl  = pci_cap_read_ctrl(device, cap);
+    uint32_t           size  = (ctrl & PCI_MSIX_CTRL_SIZE) + 1;
+    volatile uint32_t *table = pci_msix_table(device, cap);
+    if (!table) return -1;
+
+    /* Keep the whole function masked while the entries are masked one by one */
+    pci_cap_write_ctrl(device, cap, ctrl | PCI_MSIX_CTRL_ENABLE | PCI_MSIX_CTRL_MASK);
+    for (uint32_t i = 0; i < size; i++) table[i * PCI_MSIX_ENTRY_SIZE / 4 + 3] |= PCI_MSIX_ENTRY_MASK;
+    pci_cap_write_ctrl(device, cap, (ctrl | PCI_MSIX_CTRL_ENABLE) & ~PCI_MSIX_CTRL_MASK);
+
+    pci_set_intx(device, 0);
+    return (int)size;
+}
+
+/* Route an MSI-X entry to the specified CPU, returns the vector or -1 */
+int pci_msix_set_vector(pci_device_cache_t *device, uint32_t entry, uint32_t cpu, irq_handler_t handler, void *data)
+{
+    uint32_t cap = pci_find_capability(device, PCI_CAP_ID_MSIX);
+    if (!cap || entry > (uint32_t)(pci_cap_read_ctrl(device, cap) & PCI_MSIX_CTRL_SIZE)) return -1;
+
+    volatile uint32_t *table = pci_msix_table(device, cap);
+    if (!table) return -1;
+
+    int vector = pci_msi_alloc_vector(handler, data);
+    if (vector < 0) return -1;
+
+    volatile uint32_t *slot = table + entry * PCI_MSIX_ENTRY_SIZE / 4;
+    slot[3] |= PCI_MSIX_ENTRY_MASK;
+    slot[0] = pci_msi_address(cpu);
+    slot[1] = 0;
+    slot[2] = (uint32_t)vector;
+    slot[3] &= ~PCI_MSIX_ENTRY_MASK;
+    return vector;
+}
+
+/* Mask an MSI-X entry and release its vector */
+void pci_msix_free_vector(pci_device_cache_t *device, uint32_t entry)
+{
+    uint32_t cap = pci_find_capability(device, PCI_CAP_ID_MSIX);
+    if (!cap || entry > (uint32_t)(pci_cap_read_ctrl(device, cap) & PCI_MSIX_CTRL_SIZE)) return;
+
+    volatile uint32_t *table = pci_msix_table(device, cap);
+    if (!table) return;
+
+    volatile uint32_t *slot = table + entry * PCI_MSIX_ENTRY_SIZE / 4;
+    if (slot[3] & PCI_MSIX_ENTRY_MASK) return;
+    slot[3] |= PCI_MSIX_ENTRY_MASK;
+    irq_release_vector(slot[2] & 0xff);
+}
+
+/* Disable MSI-X */
+void pci_msix_disable(pci_device_cache_t *device)
+{
+    uint32_t cap = pci_find_capability(device, PCI_CAP_ID_MSIX);
+    if (!cap) return;
+
+    pci_cap_write_ctrl(device, cap, pci_cap_read_ctrl(device, cap) & ~PCI_MSIX_CTRL_ENABLE);
+    pci_set_intx(device, 1);
+}
+
 /* Configuring PCI Devices */
 void pci_config(pci_device_cache_t *cache, uint32_t addr)
 {
@@ -9,7 +9,9 @@
  *
  */
 
+#include "cmdline.h"
 #include "limine.h"
+#include "string.h"
 #include "uinxed.h"
 
 /* Get the kernel command line */
@@ -17,3 +19,30 @@ const char *get_cmdline(void)
 {
     return kernel_file_request.response->kernel_file->cmdline;
 }
+
+/* Find a "name=value" argument, returns the length of the value or -1 if absent */
+int cmdline_get_arg(const char *name, const char **value)
+{
+    const char *cmdline = get_cmdline();
+    size_t      len     = strlen(name);
+
+    while (cmdline && *cmdline) {
+        while (*cmdline == ' ') cmdline++;
+        const char *token = cmdline;
+        while (*cmdline && *cmdline != ' ') cmdline++;
+
+        if ((size_t)(cmdline - token) > len && !strncmp(token, name, len) && token[len] == '=') {
+            *value = token + len + 1;
+            return (int)(cmdline - *value);
+        }
+    }
+    return -1;
+}
+
+/* Check whether a "name=value" argument is present with the specified value */
+int cmdline_arg_is(const char *name, const char *value)
+{
+    const char *arg;
+    int         len = cmdline_get_arg(name, &arg);
+    return len >= 0 && (size_t)len == strlen(value) && !strncmp(arg, value, len);
+}
@@ -34,6 +34,7 @@ spinlock_t tty_flush_spinlock = {
 writer tty_writer = {
     .data    = 0,
     .handler = tty_writer_handler,
+    .span    = tty_writer_span,
 };
 
 /* Parsing command line arguments */
@@ -61,6 +62,14 @@ uint8_t tty_writer_handler(writer *writer, char c)
     return 1; // Always success? :(
 }
 
+/* Directs slice write operations to terminal output */
+size_t tty_writer_span(writer *writer, const char *str, size_t len)
+{
+    (void)writer;
+    tty_print_span(str, len);
+    return len;
+}
+
 /* Parse boot_tty string to tty_device_t */
 tty_device_t parse_boot_tty_str(char *boot_tty_str)
 {
@@ -221,7 +230,7 @@ void tty_buff_flush(void)
                         continue;
                         break;
                 }
-                while (*tty_buff_ptr != '\0') write_serial(serial_port, *tty_buff_ptr++);
+                write_serial_span(serial_port, (const char *)tty_buff_ptr, strlen((const char *)tty_buff_ptr));
                 break;
             default :
                 /* Unreachable */
@@ -247,18 +256,44 @@ static void tty_buff_add(const char ch)
     *tty_buff_ptr = '\0';
 }
 
+/* Add a slice to the teletype buffer, flushing at every newline like tty_buff_add() */
+static void tty_buff_add_span(const char *str, size_t len)
+{
+    while (len) {
+        size_t room  = TTY_BUF_SIZE - 1 - (tty_buff_ptr - tty_buff);
+        size_t chunk = 0;
+        int    flush = 0;
+
+        while (chunk < len && chunk < room && str[chunk] != '\n' && str[chunk] != '\0') chunk++;
+        if (chunk < len && chunk < room && str[chunk] == '\n') chunk++, flush = 1;
+        if (chunk == room) flush = 1;
+
+        memcpy((char *)tty_buff_ptr, str, chunk);
+        tty_buff_ptr += chunk;
+        *tty_buff_ptr = '\0';
+        if (flush) tty_buff_flush();
+
+        /* NULs are dropped like in tty_buff_add() */
+        if (chunk < len && !flush && str[chunk] == '\0') chunk++;
+        str += chunk;
+        len -= chunk;
+    }
+}
+
 /* Print characters to tty */
 void tty_print_ch(const char ch)
 {
     tty_buff_add(ch);
 }
 
+/* Print a slice to tty */
+void tty_print_span(const char *str, size_t len)
+{
+    tty_buff_add_span(str, len);
+}
+
 /* Print string to tty */
 void tty_print_str(const char *str)
 {
-    const char *str_clone = str;
-    while (*str_clone != '\0') {
-        tty_buff_add(*str_clone);
-        str_clone++;
-    }
+    tty_buff_add_span(str, strlen(str));
 }
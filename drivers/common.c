@@ -152,6 +152,14 @@ void wrmsr(uint32_t msr, uint64_t value)
     __asm__ volatile("wrmsr" ::"c"(msr), "a"(rax), "d"(rdx));
 }
 
+/* Read the time stamp counter */
+uint64_t rdtsc(void)
+{
+    uint32_t rax, rdx;
+    __asm__ volatile("rdtsc" : "=a"(rax), "=d"(rdx));
+    return ((uint64_t)rdx << 32) | rax;
+}
+
 /* Loading data atomically */
 uint64_t load(uint64_t *addr)
 {
@@ -9,21 +9,39 @@
  *
  */
 
+#define KLOG_PREFIX "apic: "
+
 #include "apic.h"
 #include "acpi.h"
+#include "clocksource.h"
 #include "common.h"
 #include "hhdm.h"
 #include "idt.h"
+#include "klog.h"
 #include "limine.h"
 #include "printk.h"
+#include "smp.h"
 #include "stddef.h"
 #include "stdint.h"
+#include "timer.h"
+#include "trace.h"
 #include "uinxed.h"
 
 int x2apic_mode;
 
 pointer_cast_t lapic_ptr;
-pointer_cast_t ioapic_ptr;
+
+static uint32_t lapic_timer_initial = 0; // Calibrated initial count of one tick
+
+static madt_t  *madt_table = 0;
+static ioapic_t ioapics[IOAPIC_MAX_COUNT];
+static uint32_t ioapic_count = 0;
+
+/* ISA IRQ to global system interrupt overrides, identity by default */
+static struct {
+        uint32_t gsi;
+        uint16_t flags;
+} isa_overrides[ISA_IRQ_COUNT];
 
 /* Turn off PIC */
 void disable_pic(void)
@@ -32,32 +50,114 @@ void disable_pic(void)
     outb(0xa1, 0xff);
 }
 
+/* Find the I/O APIC handling a global system interrupt */
+ioapic_t *ioapic_find(uint32_t gsi)
+{
+    for (uint32_t i = 0; i < ioapic_count; i++)
+        if (gsi >= ioapics[i].gsi_base && gsi < ioapics[i].gsi_base + ioapics[i].gsi_count) return &ioapics[i];
+    return 0;
+}
+
 /* Write I/O APIC register */
-void ioapic_write(uint32_t reg, uint32_t value)
+void ioapic_write(ioapic_t *ioapic, uint32_t reg, uint32_t value)
 {
-    mmio_write32(ioapic_ptr.ptr, reg);
+    mmio_write32(ioapic->base.ptr, reg);
     pointer_cast_t reg_ptr;
-    reg_ptr.val = ioapic_ptr.val + 0x10;
+    reg_ptr.val = ioapic->base.val + 0x10;
     mmio_write32(reg_ptr.ptr, value);
 }
 
 /* Read I/O APIC registers */
-uint32_t ioapic_read(uint32_t reg)
+uint32_t ioapic_read(ioapic_t *ioapic, uint32_t reg)
 {
-    mmio_write32(ioapic_ptr.ptr, reg);
+    mmio_write32(ioapic->base.ptr, reg);
     pointer_cast_t reg_ptr;
-    reg_ptr.val = ioapic_ptr.val + 0x10;
+    reg_ptr.val = ioapic->base.val + 0x10;
     return mmio_read32(reg_ptr.ptr);
 }
 
+/* Translate an ISA IRQ to its global system interrupt and MPS INTI flags */
+uint32_t ioapic_irq_to_gsi(uint32_t irq, uint16_t *flags)
+{
+    if (irq >= ISA_IRQ_COUNT) {
+        if (flags) *flags = 0;
+        return irq;
+    }
+    if (flags) *flags = isa_overrides[irq].flags;
+    return isa_overrides[irq].gsi;
+}
+
+/* Build the low dword of a redirection entry from MPS INTI flags */
+static uint32_t ioapic_redirect_flags(uint16_t flags)
+{
+    uint32_t redirect = 0;
+    if ((flags & MPS_INTI_POLARITY_MASK) == MPS_INTI_ACTIVE_LOW) redirect |= APIC_LVT_ACTIVE_LOW;
+    if ((flags & MPS_INTI_TRIGGER_MASK) == MPS_INTI_LEVEL) redirect |= APIC_LVT_LEVEL;
+    return redirect;
+}
+
+/* Route a global system interrupt to a vector on the specified CPU, returns 0 on success */
+int ioapic_route_gsi(uint32_t gsi, uint8_t vector, uint16_t flags, uint32_t cpu)
+{
+    ioapic_t *ioapic = ioapic_find(gsi);
+    if (!ioapic) {
+        klog_warn("No IOAPIC handles GSI %u\n", gsi);
+        return -1;
+    }
+
+    uint32_t ioredtbl = IOAPIC_REG_REDTBL + (gsi - ioapic->gsi_base) * 2;
+    ioapic_write(ioapic, ioredtbl, APIC_LVT_MASKED);
+    ioapic_write(ioapic, ioredtbl + 1, get_cpu_lapic_id(cpu) << 24);
+    ioapic_write(ioapic, ioredtbl, vector | ioapic_redirect_flags(flags));
+    return 0;
+}
+
 /* Configuring I/O APIC interrupt routing */
 void ioapic_add(ioapic_routing_t *routing)
 {
-    uint32_t ioredtbl = (uint32_t)(0x10 + (uint32_t)(routing->irq * 2));
-    uint64_t redirect = routing->vector;
-    redirect |= lapic_id() << 56;
-    ioapic_write(ioredtbl, (uint32_t)redirect);
-    ioapic_write(ioredtbl + 1, (uint32_t)(redirect >> 32));
+    uint16_t flags;
+    uint32_t gsi = ioapic_irq_to_gsi(routing->irq, &flags);
+    ioapic_route_gsi(gsi, routing->vector, flags, get_current_cpu_id());
+}
+
+/* Change the CPU receiving a global system interrupt, returns 0 on success */
+int ioapic_set_gsi_affinity(uint32_t gsi, uint32_t cpu)
+{
+    ioapic_t *ioapic = ioapic_find(gsi);
+    if (!ioapic || cpu >= (get_cpu_count() ? get_cpu_count() : 1)) return -1;
+
+    /* The destination lives in the high dword, the entry stays live while it changes */
+    uint32_t ioredtbl = IOAPIC_REG_REDTBL + (gsi - ioapic->gsi_base) * 2;
+    ioapic_write(ioapic, ioredtbl + 1, get_cpu_lapic_id(cpu) << 24);
+    return 0;
+}
+
+/* Change the CPU receiving an ISA IRQ, returns 0 on success */
+int ioapic_set_affinity(uint32_t irq, uint32_t cpu)
+{
+    return ioapic_set_gsi_affinity(ioapic_irq_to_gsi(irq, 0), cpu);
+}
+
+/* Spread the routed ISA IRQs across all CPUs */
+void ioapic_spread_irqs(void)
+{
+    uint32_t cpu_count = get_cpu_count();
+    uint32_t next      = 1; // The BSP keeps the timer, start from the first AP
+    if (cpu_count < 2) return;
+
+    /* IRQ 0 is the system timer and stays on the BSP */
+    for (uint32_t irq = 1; irq < ISA_IRQ_COUNT; irq++) {
+        uint32_t  gsi    = ioapic_irq_to_gsi(irq, 0);
+        ioapic_t *ioapic = ioapic_find(gsi);
+        if (!ioapic) continue;
+
+        uint32_t redirect = ioapic_read(ioapic, IOAPIC_REG_REDTBL + (gsi - ioapic->gsi_base) * 2);
+        if ((redirect & APIC_LVT_MASKED) || (redirect & 0x700) || !(redirect & 0xff)) continue; // Unused, NMI or not fixed
+
+        uint32_t cpu = next;
+        next         = (next + 1) % cpu_count;
+        if (ioapic_set_gsi_affinity(gsi, cpu) == 0) klog_debug("IRQ %02u (GSI %u) -> CPU %u\n", irq, gsi, cpu);
+    }
 }
 
 /* Write local APIC register */
@@ -90,6 +190,54 @@ uint64_t lapic_id(void)
     return lapic_read(LAPIC_REG_ID) >> 24;
 }
 
+/* Measure the local APIC timer against the clock source, returns the initial count of one tick */
+static uint32_t lapic_timer_calibrate(void)
+{
+    lapic_write(LAPIC_REG_TIMER_INITCNT, ~((uint32_t)0));
+
+    uint64_t start = nano_time();
+    uint32_t count = lapic_read(LAPIC_REG_TIMER_CURCNT);
+    uint64_t now;
+
+    do now = nano_time();
+    while (now - start < LAPIC_CALIBRATE_NS);
+
+    uint64_t elapsed = (uint64_t)(count - lapic_read(LAPIC_REG_TIMER_CURCNT));
+    uint64_t initial = elapsed * TIMER_TICK_NS / (now - start);
+
+    plogk("apic: Local APIC timer %llu kHz, %llu counts per tick\n", elapsed * 1000000 / (now - start), initial);
+    return (uint32_t)initial;
+}
+
+/* Program the LINT pins the MADT marks as NMI sources for the current CPU */
+static void lapic_nmi_init(void)
+{
+    if (!madt_table) return;
+
+    uint8_t *entries_base = (uint8_t *)&madt_table->entries;
+    size_t   length       = madt_table->header.length - sizeof(madt_t);
+    uint32_t uid          = 0xffffffff;
+    uint32_t apic_id      = lapic_id();
+
+    /* Find the ACPI processor UID of this CPU */
+    for (size_t current = 0; current < length; current += ((madt_header_t *)(entries_base + current))->length) {
+        madt_header_t *header = (madt_header_t *)(entries_base + current);
+        if (header->entry_type == MADT_APIC_LOCAL_CPU && ((madt_local_apic_t *)header)->local_apic_id == apic_id)
+            uid = ((madt_local_apic_t *)header)->acpi_processor_uid;
+        if (header->entry_type == MADT_APIC_LOCAL_X2_CPU && ((madt_local_x2_cpu_t *)header)->local_x2_apic_id == apic_id)
+            uid = ((madt_local_x2_cpu_t *)header)->acpi_processor_uid;
+    }
+
+    for (size_t current = 0; current < length; current += ((madt_header_t *)(entries_base + current))->length) {
+        madt_header_t *header = (madt_header_t *)(entries_base + current);
+        if (header->entry_type != MADT_APIC_LOCAL_NMI) continue;
+
+        madt_local_nmi_t *nmi = (madt_local_nmi_t *)header;
+        if (nmi->acpi_processor_uid != 0xff && nmi->acpi_processor_uid != uid) continue;
+        lapic_write(nmi->lint ? LAPIC_REG_LINT1 : LAPIC_REG_LINT0, APIC_LVT_NMI | ioapic_redirect_flags(nmi->flags));
+    }
+}
+
 /* Initialize local APIC */
 void local_apic_init(void)
 {
@@ -97,24 +245,25 @@ void local_apic_init(void)
     plogk("apic: Local APIC: %s\n", x2apic_mode ? "x2APIC" : "xAPIC");
 
     lapic_write(LAPIC_REG_SPURIOUS, 0xff | 1 << 8);
+    lapic_nmi_init();
     lapic_write(LAPIC_REG_TIMER, IRQ_0);
     lapic_write(LAPIC_REG_TIMER_DIV, 11);
-    lapic_write(LAPIC_REG_TIMER_INITCNT, ~((uint32_t)0));
-
-    for (uint64_t start = nano_time(); nano_time() - start < 1000000;);
 
-    uint64_t lapic_timer              = (~(uint32_t)0) - lapic_read(LAPIC_REG_TIMER_CURCNT);
-    uint64_t calibrated_timer_initial = (uint64_t)((uint64_t)(lapic_timer * 1000) / 250);
+    /* All local APIC timers run from the same clock, calibrate once on the BSP */
+    if (!lapic_timer_initial) lapic_timer_initial = lapic_timer_calibrate();
 
     lapic_write(LAPIC_REG_TIMER, lapic_read(LAPIC_REG_TIMER) | 1 << 17);
-    lapic_write(LAPIC_REG_TIMER_INITCNT, calibrated_timer_initial);
+    lapic_write(LAPIC_REG_TIMER_INITCNT, lapic_timer_initial);
 }
 
 /* Initialize I/O APIC */
 void io_apic_init(void)
 {
+    /*
+     * ISA IRQ 0 stays masked: with the override it is the PIT on GSI 2, and its vector is the local APIC
+     * timer's, so a PIT the firmware left running would speed up the tick. The LAPIC and HPET provide it.
+     */
     ioapic_routing_t *ioapic_router[] = {
-        &(ioapic_routing_t) {IRQ_0,  0 }, // Timer IRQ_0 = 32
         &(ioapic_routing_t) {IRQ_1,  1 }, // Keyboard IRQ_1 = 33
         &(ioapic_routing_t) {IRQ_12, 12}, // Mouse IRQ_12 = 44
         &(ioapic_routing_t) {IRQ_14, 14}, // IDE0 IRQ_14 = 46
@@ -126,7 +275,7 @@ void io_apic_init(void)
 
     while (*routing != 0) {
         ioapic_add(*routing);
-        plogk("apic: IOAPIC has set up routing from Vector %03d --> IRQ %03d\n", (*routing)->vector, (*routing)->irq);
+        klog_debug("IOAPIC has set up routing from Vector %03d --> IRQ %03d\n", (*routing)->vector, (*routing)->irq);
         routing++;
     }
 }
@@ -147,6 +296,7 @@ void lapic_timer_stop(void)
 /* Send interrupt handling instruction */
 void send_ipi(uint32_t apic_id, uint32_t command)
 {
+    trace_ipi_send(apic_id, command);
     if (x2apic_mode) {
         wrmsr(0x800 + (APIC_ICR_LOW >> 4), ((uint64_t)(apic_id & 0b1111) << 32) | command);
     } else {
@@ -159,6 +309,12 @@ void send_ipi(uint32_t apic_id, uint32_t command)
 /* Initialize APIC */
 void apic_init(madt_t *madt)
 {
+    madt_table = madt;
+    for (uint32_t i = 0; i < ISA_IRQ_COUNT; i++) {
+        isa_overrides[i].gsi   = i;
+        isa_overrides[i].flags = 0;
+    }
+
     lapic_ptr.ptr = phys_to_virt(madt->local_apic_address);
     plogk("apic: Local APIC base %p\n", lapic_ptr.ptr);
 
@@ -170,13 +326,25 @@ void apic_init(madt_t *madt)
         switch (header->entry_type) {
             case MADT_APIC_LOCAL_CPU : {
                 madt_local_apic_t *cpu = (madt_local_apic_t *)(entries_base + current);
-                plogk("apic: Local APIC id %03u, ACPI processor uid %03u, Flags %x\n", cpu->local_apic_id, cpu->acpi_processor_uid, cpu->flags);
+                klog_debug("Local APIC id %03u, ACPI processor uid %03u, Flags %x\n", cpu->local_apic_id, cpu->acpi_processor_uid, cpu->flags);
                 break;
             }
             case MADT_APIC_IO : {
-                madt_io_apic_t *ioapic = (madt_io_apic_t *)(entries_base + current);
-                ioapic_ptr.ptr         = phys_to_virt(ioapic->address);
-                plogk("apic: IOAPIC found at %p\n", ioapic_ptr.ptr);
+                madt_io_apic_t *entry = (madt_io_apic_t *)(entries_base + current);
+                if (ioapic_count >= IOAPIC_MAX_COUNT) {
+                    klog_warn("Too many IOAPICs, IOAPIC %u ignored.\n", entry->apic_id);
+                    break;
+                }
+                ioapic_t *ioapic = &ioapics[ioapic_count++];
+                ioapic->base.ptr = phys_to_virt(entry->address);
+                ioapic->id       = entry->apic_id;
+                ioapic->gsi_base = entry->gsib;
+
+                /* Mask every input until a driver routes it */
+                ioapic->gsi_count = ((ioapic_read(ioapic, IOAPIC_REG_VERSION) >> 16) & 0xff) + 1;
+                for (uint32_t i = 0; i < ioapic->gsi_count; i++) ioapic_write(ioapic, IOAPIC_REG_REDTBL + i * 2, APIC_LVT_MASKED);
+                plogk("apic: IOAPIC %u found at %p, GSI %u-%u\n", ioapic->id, ioapic->base.ptr, ioapic->gsi_base,
+                      ioapic->gsi_base + ioapic->gsi_count - 1);
                 break;
             }
             case MADT_APIC_LOCAL_ADDR : {
@@ -187,18 +355,44 @@ void apic_init(madt_t *madt)
             }
             case MADT_APIC_LOCAL_X2_CPU : {
                 madt_local_x2_cpu_t *x2cpu = (madt_local_x2_cpu_t *)(entries_base + current);
-                plogk("apic: Local X2 APIC id %03u, ACPI processor uid %03u, Flags %x\n", x2cpu->local_x2_apic_id, x2cpu->acpi_processor_uid,
-                      x2cpu->flags);
+                klog_debug("Local X2 APIC id %03u, ACPI processor uid %03u, Flags %x\n", x2cpu->local_x2_apic_id, x2cpu->acpi_processor_uid,
+                           x2cpu->flags);
+                break;
+            }
+            case MADT_APIC_IO_INT : {
+                madt_io_int_t *override = (madt_io_int_t *)(entries_base + current);
+                if (override->bus != 0 || override->source >= ISA_IRQ_COUNT) break; // Only ISA is defined
+                isa_overrides[override->source].gsi   = override->gsi;
+                isa_overrides[override->source].flags = override->flags;
+                klog_debug("IRQ %02u overridden to GSI %u, Flags %x\n", override->source, override->gsi, override->flags);
                 break;
             }
-            case MADT_APIC_IO_INT : // TODO: Implement IO/APIC interrupt source override
-            case MADT_APIC_IO_NMI : // TODO: Implement IO/APIC Non-maskable interrupt source
+            case MADT_APIC_IO_NMI :
+            case MADT_APIC_LOCAL_NMI :
+                /* Applied after all IOAPICs are known / per CPU in local_apic_init */
+                break;
             default :
                 /* Unhandled MADT entry type (Maybe it's reserved) */
                 break;
         }
         current += header->length;
     }
+    /* Wire the IOAPIC NMI sources now that every IOAPIC is known */
+    current = 0;
+    while (current < madt->header.length - sizeof(madt_t)) {
+        madt_header_t *header = (madt_header_t *)(entries_base + current);
+        if (header->entry_type == MADT_APIC_IO_NMI) {
+            madt_io_nmi_t *nmi    = (madt_io_nmi_t *)header;
+            ioapic_t      *ioapic = ioapic_find(nmi->gsi);
+            if (ioapic) {
+                uint32_t ioredtbl = IOAPIC_REG_REDTBL + (nmi->gsi - ioapic->gsi_base) * 2;
+                ioapic_write(ioapic, ioredtbl + 1, lapic_id() << 24);
+                ioapic_write(ioapic, ioredtbl, APIC_LVT_NMI | ioapic_redirect_flags(nmi->flags));
+                klog_debug("GSI %u is an NMI source\n", nmi->gsi);
+            }
+        }
+        current += header->length;
+    }
     disable_pic();
     local_apic_init();
     io_apic_init();
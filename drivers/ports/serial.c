@@ -14,6 +14,25 @@
 #include "printk.h"
 #include "stdint.h"
 
+static uint8_t serial_fifo[4]; // The transmit FIFO of COM1 to COM4 is known to be enabled
+
+/* Get the FIFO state slot of a serial port */
+static uint8_t *serial_fifo_of(uint16_t port)
+{
+    switch (port) {
+        case SERIAL_PORT_1 :
+            return &serial_fifo[0];
+        case SERIAL_PORT_2 :
+            return &serial_fifo[1];
+        case SERIAL_PORT_3 :
+            return &serial_fifo[2];
+        case SERIAL_PORT_4 :
+            return &serial_fifo[3];
+        default :
+            return 0;
+    }
+}
+
 /* Serial port LCR data configuration */
 static uint8_t serial_calculate_lcr(void)
 {
@@ -102,6 +121,10 @@ static void init_serial_port(uint16_t port)
         return;
     }
     outb(port + SERIAL_REG_MCR, 0x0f); // Quit loopback mode
+
+    /* An 8250 or 16450 has no FIFO and keeps these bits clear */
+    uint8_t *fifo = serial_fifo_of(port);
+    if (fifo) *fifo = (inb(port + SERIAL_REG_IIR) & SERIAL_IIR_FIFO) == SERIAL_IIR_FIFO;
     plogk("serial: Local port: %s, Baud rate: %d, Status: 0x%02x\n", PORT_TO_COM(port), SERIAL_BAUD_RATE, inb(port + SERIAL_REG_LSR));
 }
 
@@ -146,6 +169,24 @@ void write_serial(uint16_t port, uint8_t data)
     outb(port + SERIAL_REG_DATA, data);
 }
 
+/* Write a slice to the serial port, filling the transmit FIFO each time it runs empty */
+void write_serial_span(uint16_t port, const char *str, size_t len)
+{
+    /* Until init_serial() found the FIFO enabled, the holding register takes a single byte */
+    uint8_t *fifo = serial_fifo_of(port);
+    if (!fifo || !*fifo) {
+        for (size_t i = 0; i < len; i++) write_serial(port, str[i]);
+        return;
+    }
+    while (len) {
+        size_t burst = len < SERIAL_FIFO_SIZE ? len : SERIAL_FIFO_SIZE;
+        while (!is_transmit_empty(port));
+        for (size_t i = 0; i < burst; i++) outb(port + SERIAL_REG_DATA, str[i]);
+        str += burst;
+        len -= burst;
+    }
+}
+
 /* Get the status value of the specified serial port */
 uint8_t get_serial_status(uint16_t port)
 {
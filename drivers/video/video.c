@@ -10,12 +10,18 @@
  */
 
 #include "video.h"
+#include "alloc.h"
+#include "blit.h"
 #include "common.h"
-#include "cpuid.h"
 #include "gfx_proc.h"
+#include "hhdm.h"
 #include "limine.h"
+#include "page.h"
+#include "smp.h"
+#include "spin_lock.h"
 #include "stddef.h"
 #include "stdint.h"
+#include "timer.h"
 #include "uinxed.h"
 
 extern uint8_t ascii_font[]; // Fonts
@@ -23,7 +29,24 @@ extern uint8_t ascii_font[]; // Fonts
 uint64_t  width;  // Screen width
 uint64_t  height; // Screen height
 uint64_t  stride; // Frame buffer line spacing
-uint32_t *buffer; // Video Memory (We think BPP is 32. If BPP is other value, you have to change it)
+uint32_t *buffer; // Drawing target, the back buffer if it could be allocated (We think BPP is 32. If BPP is other value, you have to change it)
+
+static uint32_t      *front;                                   // Video memory (the Limine framebuffer)
+static blit_surface_t back_surface;                            // The drawing target
+static blit_surface_t front_surface;                           // The video memory
+static uint32_t       dirty_x0, dirty_y0, dirty_x1, dirty_y1; // Area of the back buffer not flushed yet, empty if x0 >= x1
+
+static video_glyph_t *glyph_cache; // Rendered glyphs, direct mapped by character and colors
+
+/* The text grid is the source of truth of the console, the rows form a ring starting at grid_top */
+static video_cell_t *grid;                 // Cells of the console, row by row
+static video_cell_t *shown;                // Cells drawn in the back buffer, in screen order
+static uint32_t      grid_top;             // Ring index of the top screen row
+static uint32_t      grid_row0, grid_row1; // Screen rows changed since the last flush, empty if row0 >= row1
+static spinlock_t    video_lock;           // Serializes the console and the deferred flush
+static volatile int  video_deferred;       // Strings are flushed by the timer
+static volatile int  video_pending;        // Something waits for the deferred flush
+static timer_t       video_timer;
 
 uint32_t x, y;              // The current absolute cursor position
 uint32_t cx, cy;            // The character position of the current cursor
@@ -75,38 +98,218 @@ void video_init(void)
 {
     if (!framebuffer_request.response || framebuffer_request.response->framebuffer_count < 1) krn_halt();
     struct limine_framebuffer *framebuffer = framebuffer_request.response->framebuffers[0];
-    buffer                                 = framebuffer->address;
+    front                                  = framebuffer->address;
     width                                  = framebuffer->width;
     height                                 = framebuffer->height;
     stride                                 = framebuffer->pitch / (framebuffer->bpp / 8);
 
+    blit_init();
+
+    /* Bulk stores to a write-combining mapping go out as whole bursts */
+    void *wc = page_map_io((uint64_t)virt_to_phys((uint64_t)front), framebuffer->pitch * height, PTE_MEMTYPE_WC);
+    if (wc) front = (uint32_t *)wc;
+
+    /* Reading video memory is very slow, draw in system RAM and copy the changes out */
+    buffer = (uint32_t *)malloc(stride * height * sizeof(uint32_t));
+    if (!buffer) buffer = front;
+    back_surface  = (blit_surface_t) {buffer, width, height, stride};
+    front_surface = (blit_surface_t) {front, width, height, stride};
+
+    /* Without the cache characters are rendered bit by bit */
+    glyph_cache = (video_glyph_t *)malloc(sizeof(video_glyph_t) * VIDEO_GLYPH_CACHE);
+    if (glyph_cache) {
+        for (uint32_t i = 0; i < VIDEO_GLYPH_CACHE; i++) glyph_cache[i].ch = 0xffff;
+    }
+
     x = cx = y = cy = 0;
     c_width         = width / 9;
     c_height        = height / 16;
 
+    /* Without the grid the console draws and scrolls the pixels directly */
+    grid  = (video_cell_t *)malloc(sizeof(video_cell_t) * c_width * c_height);
+    shown = (video_cell_t *)malloc(sizeof(video_cell_t) * c_width * c_height);
+    if (!grid || !shown) {
+        free(grid);
+        free(shown);
+        grid = shown = 0;
+    }
+
     fore_color = color_to_fb_color((color_t) {0xaa, 0xaa, 0xaa});
     back_color = color_to_fb_color((color_t) {0x00, 0x00, 0x00});
     video_clear();
 }
 
+/* Mark an area of the back buffer as changed, the end is exclusive */
+void video_mark_dirty(uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1)
+{
+    if (x1 > width) x1 = width;
+    if (y1 > height) y1 = height;
+    if (x0 >= x1 || y0 >= y1) return;
+
+    if (dirty_x0 >= dirty_x1) {
+        dirty_x0 = x0;
+        dirty_y0 = y0;
+        dirty_x1 = x1;
+        dirty_y1 = y1;
+        return;
+    }
+    if (x0 < dirty_x0) dirty_x0 = x0;
+    if (y0 < dirty_y0) dirty_y0 = y0;
+    if (x1 > dirty_x1) dirty_x1 = x1;
+    if (y1 > dirty_y1) dirty_y1 = y1;
+}
+
+/* Get a row of the text grid by screen row */
+static video_cell_t *video_grid_row(uint32_t row)
+{
+    return grid + ((grid_top + row) % c_height) * c_width;
+}
+
+/* Mark screen rows of the text grid as changed, the end is exclusive */
+static void video_grid_touch(uint32_t row0, uint32_t row1)
+{
+    if (grid_row0 >= grid_row1) {
+        grid_row0 = row0;
+        grid_row1 = row1;
+        return;
+    }
+    if (row0 < grid_row0) grid_row0 = row0;
+    if (row1 > grid_row1) grid_row1 = row1;
+}
+
+/* Get a character rendered with its colors, rendering it on a cache miss */
+static const video_glyph_t *video_glyph(uint8_t c, uint32_t color, uint32_t background)
+{
+    uint32_t       hash  = (color * 0x9e3779b1U) ^ (background * 0x85ebca6bU);
+    video_glyph_t *glyph = &glyph_cache[(c ^ (hash >> 16) ^ hash) & (VIDEO_GLYPH_CACHE - 1)];
+
+    if (glyph->ch == c && glyph->fore_color == color && glyph->back_color == background) return glyph;
+
+    const uint8_t *font = ascii_font + (size_t)c * VIDEO_FONT_HEIGHT;
+    for (int i = 0; i < VIDEO_FONT_HEIGHT; i++) {
+        for (int j = 0; j < VIDEO_FONT_WIDTH; j++) glyph->pixels[i][j] = (font[i] & (0x80 >> j)) ? color : background;
+    }
+    glyph->ch         = c;
+    glyph->fore_color = color;
+    glyph->back_color = background;
+    return glyph;
+}
+
+/* Draw a character with its colors at the specified coordinates of the back buffer (video_lock held) */
+static void video_draw_cell_locked(uint8_t c, uint32_t x, uint32_t y, uint32_t color, uint32_t background)
+{
+    if (glyph_cache) {
+        const video_glyph_t *glyph = video_glyph(c, color, background);
+        blit_surface_t       cell  = {(uint32_t *)glyph->pixels[0], VIDEO_FONT_WIDTH, VIDEO_FONT_HEIGHT, VIDEO_FONT_WIDTH};
+        blit_copy(&back_surface, x, y, &cell, (blit_rect_t) {0, 0, VIDEO_FONT_WIDTH, VIDEO_FONT_HEIGHT});
+    } else {
+        uint8_t *font = ascii_font;
+        font += (size_t)c * 16;
+        for (int i = 0; i < 16; i++) {
+            uint32_t *line = buffer + (y + i) * stride + x;
+            for (int j = 0; j < 9; j++) line[j] = (font[i] & (0x80 >> j)) ? color : background;
+        }
+    }
+    video_mark_dirty(x, y, x + VIDEO_FONT_WIDTH, y + VIDEO_FONT_HEIGHT);
+}
+
+/* Fill a matrix of the back buffer (video_lock held) */
+static void video_draw_rect_locked(position_t p0, position_t p1, uint32_t color)
+{
+    blit_fill(&back_surface, (blit_rect_t) {(int32_t)p0.x, (int32_t)p0.y, p1.x - p0.x + 1, p1.y - p0.y + 1}, color);
+    video_mark_dirty(p0.x, p0.y, p1.x + 1, p1.y + 1);
+}
+
+/* Draw the cells that differ from the back buffer */
+static void video_grid_redraw(void)
+{
+    for (uint32_t row = grid_row0; row < grid_row1; row++) {
+        video_cell_t *cells = video_grid_row(row);
+        video_cell_t *seen  = shown + row * c_width;
+
+        for (uint32_t col = 0; col < c_width; col++) {
+            if (cells[col].ch == seen[col].ch && cells[col].fore_color == seen[col].fore_color &&
+                cells[col].back_color == seen[col].back_color)
+                continue;
+            video_draw_cell_locked(cells[col].ch, col * VIDEO_FONT_WIDTH, row * VIDEO_FONT_HEIGHT, cells[col].fore_color,
+                                   cells[col].back_color);
+            seen[col] = cells[col];
+        }
+    }
+    grid_row0 = grid_row1 = 0;
+}
+
+/* Redraw the grid and copy the changed area of the back buffer to video memory (video_lock held) */
+static void video_flush_locked(void)
+{
+    if (grid) video_grid_redraw();
+    video_pending = 0;
+    if (dirty_x0 >= dirty_x1) return;
+    if (buffer != front) {
+        blit_rect_t area = {(int32_t)dirty_x0, (int32_t)dirty_y0, dirty_x1 - dirty_x0, dirty_y1 - dirty_y0};
+        blit_copy(&front_surface, area.x, area.y, &back_surface, area);
+    }
+    dirty_x0 = dirty_x1 = 0;
+}
+
+/* Redraw the changed cells of the text grid and copy the changed area of the back buffer to video memory */
+void video_flush(void)
+{
+    spin_lock(&video_lock);
+    video_flush_locked();
+    spin_unlock(&video_lock);
+}
+
+/* Flush what the console left pending and re-arm */
+static void video_timer_expired(timer_t *timer)
+{
+    if (video_pending) video_flush();
+    timer_add(timer, VIDEO_FLUSH_MS);
+}
+
+/* Flush the console from a periodic timer instead of after every string */
+void video_flush_init(void)
+{
+    /* Without a CPU to run the timer the console keeps flushing after every string */
+    timer_setup(&video_timer, video_timer_expired, 0);
+    if (timer_add_on(TIMER_BACKGROUND_CPU, &video_timer, VIDEO_FLUSH_MS) == 0) video_deferred = 1;
+}
+
+/* Take the console over and flush after every string again (called on panic, when the timer CPU may be gone) */
+void video_panic(void)
+{
+    /* The lock holder may be stuck on another CPU, or be the context that faulted inside a blit */
+    video_deferred = 0;
+    spin_lock_reset(&video_lock);
+    video_flush();
+}
+
 /* Clear screen */
 void video_clear(void)
 {
-    back_color = color_to_fb_color((color_t) {0x00, 0x00, 0x00});
-    for (uint32_t i = 0; i < (stride * height); i++) buffer[i] = back_color;
-    x  = 2;
-    y  = 0;
-    cx = cy = 0;
+    video_clear_color(color_to_fb_color((color_t) {0x00, 0x00, 0x00}));
 }
 
 /* Clear screen with color */
 void video_clear_color(uint32_t color)
 {
+    spin_lock(&video_lock);
     back_color = color;
-    for (uint32_t i = 0; i < (stride * height); i++) buffer[i] = back_color;
+    blit_fill(&back_surface, (blit_rect_t) {0, 0, width, height}, back_color);
     x  = 2;
     y  = 0;
     cx = cy = 0;
+
+    /* The grid and the back buffer both hold blank cells now */
+    if (grid) {
+        video_cell_t blank = {.fore_color = fore_color, .back_color = back_color, .ch = ' '};
+        for (uint32_t i = 0; i < c_width * c_height; i++) grid[i] = shown[i] = blank;
+        grid_top  = 0;
+        grid_row0 = grid_row1 = 0;
+    }
+    video_mark_dirty(0, 0, width, height);
+    video_flush_locked();
+    spin_unlock(&video_lock);
 }
 
 /* Scroll the screen to the specified coordinates */
@@ -116,8 +319,8 @@ void video_move_to(uint32_t c_x, uint32_t c_y)
     cy = c_y;
 }
 
-/* Screen scrolling operation */
-void video_scroll(void)
+/* Screen scrolling operation (video_lock held) */
+static void video_scroll_locked(void)
 {
     if ((uint32_t)cx >= c_width) {
         cx = 1;
@@ -126,52 +329,35 @@ void video_scroll(void)
         cx++;
     }
 
-    if ((uint32_t)cy >= c_height) {
-        uint8_t       *dest  = (uint8_t *)buffer;
-        const uint8_t *src   = (const uint8_t *)(buffer + stride * 16);
-        size_t         count = stride * (height - 16) * sizeof(uint32_t);
-
-#if CPU_FEATURE_SSE
-        if (cpu_support_sse()) {
-            size_t blocks = count / 64;
-            size_t remain = count % 64;
-
-            __asm__ volatile("1:\n\t"
-                             "movdqu (%[src]), %%xmm0\n\t"
-                             "movdqu 16(%[src]), %%xmm1\n\t"
-                             "movdqu 32(%[src]), %%xmm2\n\t"
-                             "movdqu 48(%[src]), %%xmm3\n\t"
-                             "movdqu %%xmm0, (%[dest])\n\t"
-                             "movdqu %%xmm1, 16(%[dest])\n\t"
-                             "movdqu %%xmm2, 32(%[dest])\n\t"
-                             "movdqu %%xmm3, 48(%[dest])\n\t"
-                             "add $64, %[src]\n\t"
-                             "add $64, %[dest]\n\t"
-                             "dec %[blocks]\n\t"
-                             "jnz 1b\n\t"
-                             : [src] "+r"(src), [dest] "+r"(dest), [blocks] "+r"(blocks)
-                             :
-                             : "xmm0", "xmm1", "xmm2", "xmm3", "memory");
-
-            for (size_t i = 0; i < remain; i++) *dest++ = *src++;
-        } else {
-            count /= 8;
-            __asm__ volatile("rep movsq" : "+D"(dest), "+S"(src), "+c"(count)::"memory");
-        }
-#else
-        count /= 8;
-        __asm__ volatile("rep movsq" : "+D"(dest), "+S"(src), "+c"(count)::"memory");
-#endif
-
-        video_draw_rect((position_t) {0, height - 16}, (position_t) {stride, height}, back_color);
+    if ((uint32_t)cy >= c_height && grid) {
+        /* Scrolling bumps the ring, the next flush redraws what moved */
+        video_cell_t *row   = video_grid_row(0);
+        video_cell_t  blank = {.fore_color = fore_color, .back_color = back_color, .ch = ' '};
+        for (uint32_t col = 0; col < c_width; col++) row[col] = blank;
+        grid_top = (grid_top + 1) % c_height;
+        video_grid_touch(0, c_height);
+        cy = c_height - 1;
+    } else if ((uint32_t)cy >= c_height) {
+        blit_copy(&back_surface, 0, 0, &back_surface, (blit_rect_t) {0, VIDEO_FONT_HEIGHT, width, height - VIDEO_FONT_HEIGHT});
+        video_draw_rect_locked((position_t) {0, height - 16}, (position_t) {stride, height}, back_color);
+        video_mark_dirty(0, 0, width, height);
         cy = c_height - 1;
     }
 }
 
+/* Screen scrolling operation */
+void video_scroll(void)
+{
+    spin_lock(&video_lock);
+    video_scroll_locked();
+    spin_unlock(&video_lock);
+}
+
 /* Draw a pixel at the specified coordinates on the screen */
 void video_draw_pixel(uint32_t x, uint32_t y, uint32_t color)
 {
     (buffer)[y * stride + x] = color;
+    video_mark_dirty(x, y, x + 1, y + 1);
 }
 
 /* Get a pixel at the specified coordinates on the screen */
@@ -192,43 +378,52 @@ void video_invoke_area(position_t p0, position_t p1, void (*callback)(position_t
 /* Draw a matrix at the specified coordinates on the screen */
 void video_draw_rect(position_t p0, position_t p1, uint32_t color)
 {
-    uint32_t x0 = p0.x;
-    uint32_t y0 = p0.y;
-    uint32_t x1 = p1.x;
-    uint32_t y1 = p1.y;
-    for (y = y0; y <= y1; y++) {
-        /* Draw horizontal line */
-#if defined(__x86_64__) || defined(__i386__)
-        uint32_t *line  = buffer + y * stride + x0;
-        size_t    count = x1 - x0 + 1;
-        __asm__ volatile("rep stosl" : "+D"(line), "+c"(count) : "a"(color) : "memory");
-#else
-        for (uint32_t x = x0; x <= x1; x++) video_draw_pixel(x, y, color);
-#endif
-    }
+    spin_lock(&video_lock);
+    video_draw_rect_locked(p0, p1, color);
+    spin_unlock(&video_lock);
+}
+
+/* Transfer an area of a surface to (x, y) of the back buffer, video_flush() makes it visible */
+void video_blit(int32_t x, int32_t y, const blit_surface_t *src, blit_rect_t rect, blit_mode_t mode, uint32_t key)
+{
+    spin_lock(&video_lock);
+    blit(&back_surface, x, y, src, rect, mode, key);
+    video_mark_dirty(x < 0 ? 0 : x, y < 0 ? 0 : y, x + (int64_t)rect.width < 0 ? 0 : x + rect.width,
+                     y + (int64_t)rect.height < 0 ? 0 : y + rect.height);
+    spin_unlock(&video_lock);
+}
+
+/* Draw a character with its colors at the specified coordinates on the screen */
+void video_draw_cell(uint8_t c, uint32_t x, uint32_t y, uint32_t color, uint32_t background)
+{
+    spin_lock(&video_lock);
+    video_draw_cell_locked(c, x, y, color, background);
+    spin_unlock(&video_lock);
 }
 
 /* Draw a character at the specified coordinates on the screen */
 void video_draw_char(const char c, uint32_t x, uint32_t y, uint32_t color)
 {
-    uint8_t *font = ascii_font;
-    font += (size_t)c * 16;
-    for (int i = 0; i < 16; i++) {
-        for (int j = 0; j < 9; j++) {
-            if (font[i] & (0x80 >> j)) {
-                video_draw_pixel(x + j, y + i, color);
-            } else {
-                video_draw_pixel(x + j, y + i, back_color);
-            }
-        }
+    video_draw_cell((uint8_t)c, x, y, color, back_color);
+}
+
+/* Put a character in the cell under the cursor */
+static void video_set_cell(const char c, uint32_t color)
+{
+    if (!grid) {
+        video_draw_cell_locked((uint8_t)c, (cx - 1) * 9, cy * 16, color, back_color);
+        return;
     }
+    video_cell_t *cell = &video_grid_row(cy)[cx - 1];
+    cell->ch           = (uint8_t)c;
+    cell->fore_color   = color;
+    cell->back_color   = back_color;
+    video_grid_touch(cy, cy + 1);
 }
 
-/* Print a character at the specified coordinates on the screen */
-void video_put_char(const char c, uint32_t color)
+/* Print a character to the back buffer, video_flush() makes it visible */
+static void video_emit_char(const char c, uint32_t color)
 {
-    uint32_t x;
-    uint32_t y;
     if (c == '\n') {
         cy++;
         cx = 0;
@@ -243,10 +438,8 @@ void video_put_char(const char c, uint32_t color)
     } else if (c == '\t') {
         for (int i = 0; i < 8; i++) {
             /* Expand by video_put_char(' ', color) */
-            video_scroll();
-            x = (cx - 1) * 9;
-            y = cy * 16;
-            video_draw_char(c, x, y, color);
+            video_scroll_locked();
+            video_set_cell(c, color);
         }
         return;
     } else if (c == '\b' && cx > 0) { // Do not fill, just move cursor
@@ -259,20 +452,42 @@ void video_put_char(const char c, uint32_t color)
         }
         return;
     }
-    video_scroll();
-    x = (cx - 1) * 9;
-    y = cy * 16;
-    video_draw_char(c, x, y, color);
+    video_scroll_locked();
+    video_set_cell(c, color);
+}
+
+/* Make console output visible now, or leave it to the flush timer */
+static void video_emit_done(void)
+{
+    if (video_deferred)
+        video_pending = 1;
+    else
+        video_flush_locked();
+}
+
+/* Print a character at the specified coordinates on the screen */
+void video_put_char(const char c, uint32_t color)
+{
+    spin_lock(&video_lock);
+    video_emit_char(c, color);
+    video_emit_done();
+    spin_unlock(&video_lock);
 }
 
 /* Print a string at the specified coordinates on the screen */
 void video_put_string(const char *str)
 {
-    for (; *str; ++str) video_put_char(*str, fore_color);
+    spin_lock(&video_lock);
+    for (; *str; ++str) video_emit_char(*str, fore_color);
+    video_emit_done();
+    spin_unlock(&video_lock);
 }
 
 /* Print a string with color at the specified coordinates on the screen */
 void video_put_string_color(const char *str, uint32_t color)
 {
-    for (; *str; ++str) video_put_char(*str, color);
+    spin_lock(&video_lock);
+    for (; *str; ++str) video_emit_char(*str, color);
+    video_emit_done();
+    spin_unlock(&video_lock);
 }
@@ -71,6 +71,17 @@ typedef struct {
         uint8_t           page_oem_flags;
 } __attribute__((packed)) hpet_t;
 
+#define HPET_TN_INT_TYPE    (1 << 1)  // Level triggered interrupt
+#define HPET_TN_INT_ENB     (1 << 2)  // Interrupt enable
+#define HPET_TN_PERIODIC    (1 << 3)  // Periodic mode
+#define HPET_TN_SIZE_CAP    (1 << 5)  // 64-bit comparator
+#define HPET_TN_32MODE      (1 << 8)  // Force 32-bit mode
+#define HPET_TN_ROUTE_SHIFT 9         // I/O APIC routing field
+#define HPET_TN_ROUTE_MASK  (0x1f << 9)
+#define HPET_TN_FSB_EN      (1 << 14) // FSB (MSI) interrupt delivery
+#define HPET_TN_FSB_CAP     (1 << 15) // FSB (MSI) interrupt delivery capable
+#define HPET_MSI_ADDRESS    0xfee00000
+
 typedef struct {
         uint64_t configuration_and_capability;
         uint64_t comparator_value;
@@ -183,8 +194,23 @@ void *find_table(const char *name);
 /* Initialize ACPI */
 void acpi_init(void);
 
-/* Returns the nanosecond value of the current time */
-uint64_t nano_time(void);
+/* Read the HPET main counter */
+uint64_t hpet_read_counter(void);
+
+/* Returns the HPET counter period in femtoseconds */
+uint32_t hpet_get_period(void);
+
+/* Returns the nanosecond value of the HPET main counter */
+uint64_t hpet_nano_time(void);
+
+/* Set up an HPET comparator as a one-shot event source, returns the comparator or -1 */
+int hpet_clockevent_init(uint8_t vector, uint32_t apic_id);
+
+/* Arm the HPET comparator to fire after the specified nanoseconds, returns -1 if the deadline already passed */
+int hpet_set_next_event(uint64_t delta_ns);
+
+/* Disable the HPET comparator interrupt */
+void hpet_clockevent_stop(void);
 
 /* Initialize high-precision event timer */
 void hpet_init(hpet_t *hpet);
@@ -29,6 +29,27 @@
 #define LAPIC_REG_TIMER         0x320
 #define LAPIC_REG_SPURIOUS      0xf0
 #define LAPIC_REG_TIMER_DIV     0x3e0
+#define LAPIC_REG_LVT_PMC       0x340
+#define LAPIC_REG_LINT0         0x350
+#define LAPIC_REG_LINT1         0x360
+
+#define LAPIC_CALIBRATE_NS 10000000 // Length of the local APIC timer calibration window
+
+#define APIC_LVT_NMI        (4 << 8)  // NMI delivery mode
+#define APIC_LVT_ACTIVE_LOW (1 << 13) // Active low polarity
+#define APIC_LVT_LEVEL      (1 << 15) // Level triggered
+#define APIC_LVT_MASKED     (1 << 16) // Masked
+
+#define IOAPIC_MAX_COUNT   8    // Most I/O APICs tracked
+#define IOAPIC_REG_VERSION 0x01 // Version and maximum redirection entry
+#define IOAPIC_REG_REDTBL  0x10 // First redirection table register
+#define ISA_IRQ_COUNT      16
+
+/* MPS INTI flags of MADT overrides and NMI sources */
+#define MPS_INTI_POLARITY_MASK 0x3
+#define MPS_INTI_ACTIVE_LOW    0x3
+#define MPS_INTI_TRIGGER_MASK  0xc
+#define MPS_INTI_LEVEL         0xc
 
 #define APIC_ICR_LOW  0x300
 #define APIC_ICR_HIGH 0x310
@@ -92,23 +113,69 @@ typedef struct {
         uint32_t      acpi_processor_uid;
 } __attribute__((packed)) madt_local_x2_cpu_t;
 
+typedef struct {
+        madt_header_t header;
+        uint8_t       bus;
+        uint8_t       source; // ISA IRQ
+        uint32_t      gsi;
+        uint16_t      flags;
+} __attribute__((packed)) madt_io_int_t;
+
+typedef struct {
+        madt_header_t header;
+        uint16_t      flags;
+        uint32_t      gsi;
+} __attribute__((packed)) madt_io_nmi_t;
+
+typedef struct {
+        madt_header_t header;
+        uint8_t       acpi_processor_uid; // 0xff means all processors
+        uint16_t      flags;
+        uint8_t       lint;
+} __attribute__((packed)) madt_local_nmi_t;
+
 typedef struct {
         uint8_t  vector;
         uint32_t irq;
 } ioapic_routing_t;
 
+typedef struct {
+        pointer_cast_t base;
+        uint32_t       id;
+        uint32_t       gsi_base;  // First global system interrupt handled
+        uint32_t       gsi_count; // Number of redirection entries
+} ioapic_t;
+
 /* Turn off PIC */
 void disable_pic(void);
 
+/* Find the I/O APIC handling a global system interrupt */
+ioapic_t *ioapic_find(uint32_t gsi);
+
 /* Write I/O APIC register */
-void ioapic_write(uint32_t reg, uint32_t value);
+void ioapic_write(ioapic_t *ioapic, uint32_t reg, uint32_t value);
 
 /* Read I/O APIC registers */
-uint32_t ioapic_read(uint32_t reg);
+uint32_t ioapic_read(ioapic_t *ioapic, uint32_t reg);
+
+/* Translate an ISA IRQ to its global system interrupt and MPS INTI flags */
+uint32_t ioapic_irq_to_gsi(uint32_t irq, uint16_t *flags);
+
+/* Route a global system interrupt to a vector on the specified CPU, returns 0 on success */
+int ioapic_route_gsi(uint32_t gsi, uint8_t vector, uint16_t flags, uint32_t cpu);
 
 /* Configuring I/O APIC interrupt routing */
 void ioapic_add(ioapic_routing_t *routing);
 
+/* Change the CPU receiving a global system interrupt, returns 0 on success */
+int ioapic_set_gsi_affinity(uint32_t gsi, uint32_t cpu);
+
+/* Change the CPU receiving an ISA IRQ, returns 0 on success */
+int ioapic_set_affinity(uint32_t irq, uint32_t cpu);
+
+/* Spread the routed ISA IRQs across all CPUs */
+void ioapic_spread_irqs(void);
+
 /* Write local APIC register */
 void lapic_write(uint32_t reg, uint32_t value);
 
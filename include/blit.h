@@ -0,0 +1,63 @@
+/*
+ *
+ *      blit.h
+ *      2D blitter header file
+ *
+ *      2026/10/18 By MicroFish
+ *      Based on GPL-3.0 open source agreement
+ *      Copyright © 2020 ViudiraTech, based on the GPLv3 agreement.
+ *
+ */
+
+#ifndef INCLUDE_BLIT_H_
+#define INCLUDE_BLIT_H_
+
+#include "stdint.h"
+
+#define BLIT_STREAM_BYTES (256 * 1024) // Operations writing at least this much bypass the cache
+
+/*
+ * The AVX2 kernels use the upper halves of the YMM registers, which the interrupt entry does not save.
+ * Callers must keep interrupts off around a blit (video_lock does), or an interrupt that blits itself
+ * corrupts the interrupted one.
+ */
+
+/* A 32-bit pixel surface */
+typedef struct {
+        uint32_t *pixels; // First pixel of the top row
+        uint32_t  width;  // Pixels per row
+        uint32_t  height; // Rows
+        uint32_t  stride; // Pixels from one row to the next
+} blit_surface_t;
+
+/* An area of a surface, it may reach outside of the surface and is clipped */
+typedef struct {
+        int32_t  x, y;
+        uint32_t width, height;
+} blit_rect_t;
+
+typedef enum {
+    BLIT_COPY   = 0, // Replace the destination
+    BLIT_MASKED = 1, // Skip the source pixels equal to the color key
+    BLIT_BLEND  = 2, // Blend by the alpha of the source pixels (top byte)
+} blit_mode_t;
+
+/* Select the widest kernels the CPU supports */
+void blit_init(void);
+
+/* Fill an area with a color */
+void blit_fill(blit_surface_t *dst, blit_rect_t rect, uint32_t color);
+
+/* Copy an area of a surface to (x, y) of another one, the two may be the same surface */
+void blit_copy(blit_surface_t *dst, int32_t x, int32_t y, const blit_surface_t *src, blit_rect_t rect);
+
+/* Copy an area except the pixels equal to the color key */
+void blit_masked(blit_surface_t *dst, int32_t x, int32_t y, const blit_surface_t *src, blit_rect_t rect, uint32_t key);
+
+/* Blend an area over the destination by the alpha in the top byte of the source pixels */
+void blit_blend(blit_surface_t *dst, int32_t x, int32_t y, const blit_surface_t *src, blit_rect_t rect);
+
+/* Transfer an area with a mode, the key is used by BLIT_MASKED only */
+void blit(blit_surface_t *dst, int32_t x, int32_t y, const blit_surface_t *src, blit_rect_t rect, blit_mode_t mode, uint32_t key);
+
+#endif // INCLUDE_BLIT_H_
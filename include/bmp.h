@@ -14,6 +14,17 @@
 
 #include "stdint.h"
 
+#define BMP_MAGIC       0x4d42 // "BM"
+#define BMP_FILE_HEADER 14     // Bytes before the info header, bmp_info_size counts from there
+#define BMP_STRIP_ROWS  32     // Rows converted before they are blitted together
+#define BMP_MAX_WIDTH   16384  // Wider images are rejected, this bounds the row size and the strip
+
+/* Compression modes */
+#define BMP_RGB       0 // Uncompressed
+#define BMP_RLE8      1 // Runs of 8-bit palette indices
+#define BMP_RLE4      2 // Runs of 4-bit palette indices
+#define BMP_BITFIELDS 3 // Uncompressed with channel masks
+
 typedef struct {
         uint16_t magic;
         uint32_t file_size;
@@ -32,7 +43,15 @@ typedef struct {
         uint32_t important_color_count;
 } __attribute__((packed)) bmp_t;
 
-/* Parse bitmap images and draw them to the screen */
+/* Channel masks following the info header fields, the alpha mask is there if bmp_info_size >= 56 */
+typedef struct {
+        uint32_t red_mask;
+        uint32_t green_mask;
+        uint32_t blue_mask;
+        uint32_t alpha_mask;
+} __attribute__((packed)) bmp_masks_t;
+
+/* Parse bitmap images and draw them to the screen, with transparency black is skipped and images with alpha are blended */
 void bmp_analysis(bmp_t *bmp, uint32_t offset_x, uint32_t offset_y, int enable_transparency);
 
 #endif // INCLUDE_BMP_H_
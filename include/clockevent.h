@@ -0,0 +1,36 @@
+/*
+ *
+ *      clockevent.h
+ *      Kernel clock event device header file
+ *
+ *      2026/10/18 By MicroFish
+ *      Based on GPL-3.0 open source agreement
+ *      Copyright © 2020 ViudiraTech, based on the GPLv3 agreement.
+ *
+ */
+
+#ifndef INCLUDE_CLOCKEVENT_H_
+#define INCLUDE_CLOCKEVENT_H_
+
+#include "stdint.h"
+
+#define CLOCKEVENT_MIN_DELTA_NS 100 // Shortest delay asked from a one-shot device
+
+typedef enum {
+    CLOCKEVENT_LAPIC = 0, // Periodic local APIC timer on every CPU
+    CLOCKEVENT_HPET  = 1, // One-shot HPET comparator driving the boot CPU
+} clockevent_type_t;
+
+/* Returns the clock event device driving the boot CPU */
+clockevent_type_t clockevent_get(void);
+
+/* Request an event interrupt at an absolute time, returns 0 on success */
+int clockevent_program(uint64_t deadline_ns);
+
+/* Clock event interrupt (called from the timer interrupt) */
+void clockevent_handle(void);
+
+/* Initialize the clock event device selected by "clockevent=" on the command line */
+void clockevent_init(void);
+
+#endif // INCLUDE_CLOCKEVENT_H_
@@ -0,0 +1,48 @@
+/*
+ *
+ *      clocksource.h
+ *      Kernel clock source header file
+ *
+ *      2026/10/18 By MicroFish
+ *      Based on GPL-3.0 open source agreement
+ *      Copyright © 2020 ViudiraTech, based on the GPLv3 agreement.
+ *
+ */
+
+#ifndef INCLUDE_CLOCKSOURCE_H_
+#define INCLUDE_CLOCKSOURCE_H_
+
+#include "stdint.h"
+
+#define MSR_IA32_TSC_ADJUST 0x3b
+
+#define TSC_CALIBRATE_MS 10   // Length of the TSC calibration window against HPET
+#define TSC_SHIFT        32   // Fixed-point shift of the cycle to nanosecond multiplier
+#define TSC_SYNC_ROUNDS  64   // Round trips measured per AP during TSC synchronization
+#define TSC_SYNC_SLACK   1000 // Tolerated TSC skew in cycles beyond the measurement error
+
+typedef enum {
+    CLOCKSOURCE_NONE = 0, // No clock source, time is 0
+    CLOCKSOURCE_HPET = 1, // HPET main counter
+    CLOCKSOURCE_TSC  = 2, // Invariant TSC calibrated against HPET
+} clocksource_type_t;
+
+/* Returns the nanosecond value of the current time */
+uint64_t nano_time(void);
+
+/* Returns the current clock source */
+clocksource_type_t clocksource_get(void);
+
+/* Returns the calibrated TSC frequency in kHz (0 if the TSC is not used) */
+uint64_t tsc_get_khz(void);
+
+/* Service TSC synchronization requests of APs (called by the BSP while waiting) */
+void tsc_sync_master(void);
+
+/* Synchronize the TSC of the current AP with the BSP */
+void tsc_sync_ap(void);
+
+/* Initialize the clock source */
+void clocksource_init(void);
+
+#endif // INCLUDE_CLOCKSOURCE_H_
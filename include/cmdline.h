@@ -15,4 +15,10 @@
 /* Get the kernel command line */
 const char *get_cmdline(void);
 
+/* Find a "name=value" argument, returns the length of the value or -1 if absent */
+int cmdline_get_arg(const char *name, const char **value);
+
+/* Check whether a "name=value" argument is present with the specified value */
+int cmdline_arg_is(const char *name, const char *value);
+
 #endif // INCLUDE_CMDLINE_H_
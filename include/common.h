@@ -65,6 +65,9 @@ uint64_t rdmsr(uint32_t msr);
 /* Write to msr register */
 void wrmsr(uint32_t msr, uint64_t value);
 
+/* Read the time stamp counter */
+uint64_t rdtsc(void);
+
 /* Loading data atomically */
 uint64_t load(uint64_t *addr);
 
@@ -71,4 +71,25 @@ int cpu_support_avx(void);
 /* Check CPU supports AVX2 */
 int cpu_support_avx2(void);
 
+/* Check CPU supports TSC */
+int cpu_support_tsc(void);
+
+/* Check CPU supports invariant TSC */
+int cpu_support_invariant_tsc(void);
+
+/* Check CPU supports IA32_TSC_ADJUST MSR */
+int cpu_support_tsc_adjust(void);
+
+/* Get the architectural performance monitoring leaf, returns the version (0 if not supported) */
+uint32_t cpu_get_perfmon(uint32_t *counters, uint32_t *width, uint32_t *unavailable);
+
+/* Check CPU supports the AMD core performance counter extensions */
+int cpu_support_perfctr_core(void);
+
+/* Check CPU supports RDTSCP and IA32_TSC_AUX */
+int cpu_support_rdtscp(void);
+
+/* Check CPU supports the page attribute table */
+int cpu_support_pat(void);
+
 #endif // INCLUDE_CPUID_H_
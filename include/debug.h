@@ -12,6 +12,8 @@
 #ifndef INCLUDE_DEBUG_H_
 #define INCLUDE_DEBUG_H_
 
+#include "stdint.h"
+
 #define assert(exp) \
     if (!(exp)) assertion_failure(#exp, __FILE__, __LINE__)
 
@@ -21,6 +23,12 @@ extern int carry_error_code;
 /* Dump stack */
 void dump_stack(void);
 
+/* Record the call trace of an interrupted context without printing, returns the number of entries */
+int stack_trace_at(uintptr_t rip, uintptr_t rbp, uintptr_t *trace, int max);
+
+/* Print a call trace recorded by stack_trace_at */
+void dump_trace(const uintptr_t *trace, int count);
+
 /* Kernel panic */
 void panic(const char *format, ...);
 
@@ -0,0 +1,46 @@
+/*
+ *
+ *      ftrace.h
+ *      Function entry/exit tracer header file
+ *
+ *      2026/10/18 By MicroFish
+ *      Based on GPL-3.0 open source agreement
+ *      Copyright © 2020 ViudiraTech, based on the GPLv3 agreement.
+ *
+ */
+
+#ifndef INCLUDE_FTRACE_H_
+#define INCLUDE_FTRACE_H_
+
+#include "stdint.h"
+
+#define MSR_IA32_TSC_AUX 0xc0000103
+
+#define FTRACE_DEPTH     64    // Nested calls tracked per CPU
+#define FTRACE_HASH_SIZE 1024  // Distinct functions accounted per CPU (power of two)
+#define FTRACE_PROBES    16    // Hash probes before a function is dropped
+#define FTRACE_TOP_MAX   64    // Longest function profile printed
+#define FTRACE_DUMP_MS   10000 // Delay of the automatic dump when started from the command line
+
+/* Functions the tracer must not instrument (the tracer itself) */
+#define NOTRACE __attribute__((no_instrument_function))
+
+/* Compiler hook called on entry of every instrumented function */
+void __cyg_profile_func_enter(void *this_fn, void *call_site);
+
+/* Compiler hook called on exit of every instrumented function */
+void __cyg_profile_func_exit(void *this_fn, void *call_site);
+
+/* Start tracing on every CPU, the previous statistics are discarded. Returns 0 on success */
+int ftrace_start(void);
+
+/* Stop tracing, the statistics are kept for ftrace_dump() */
+void ftrace_stop(void);
+
+/* Print the functions with the most exclusive time, returns 0 on success */
+int ftrace_dump(uint32_t top);
+
+/* Start the tracer if "ftrace=1" is on the command line */
+void ftrace_init(void);
+
+#endif // INCLUDE_FTRACE_H_
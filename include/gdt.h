@@ -14,6 +14,16 @@
 
 #include "stdint.h"
 
+#define IST_NMI 1 // Interrupt stack table index of NMI
+#define IST_DF  2 // Interrupt stack table index of #DF
+#define IST_MC  3 // Interrupt stack table index of #MC
+#define IST_DB  4 // Interrupt stack table index of #DB
+
+#define IST_COUNT      4                  // Number of guarded IST stacks per CPU
+#define IST_STACK_SIZE 0x4000             // 16 KiB per IST stack
+#define IST_GUARD_SIZE 0x1000             // Unmapped guard page below each IST stack
+#define IST_STACK_BASE 0xffffa00000000000 // Virtual area of the IST stacks
+
 typedef struct {
         uint16_t size;
         void    *ptr;
@@ -47,6 +57,9 @@ void init_gdt(void);
 /* Initialize TSS */
 void tss_init(void);
 
+/* Map the guarded IST stacks of a CPU and point its TSS at them, returns 0 on success */
+int tss_init_ist(tss_t *tss, uint32_t cpu);
+
 /* Setting up the kernel stack */
 void set_kernel_stack(uint64_t rsp);
 
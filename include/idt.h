@@ -52,6 +52,9 @@
 #define IRQ_14 46 // IDE0 transmission control usage
 #define IRQ_15 47 // IDE1 transmission control usage
 
+#define IDT_VECTOR_DYNAMIC_START 48   // First vector after the legacy IRQs
+#define IDT_VECTOR_DYNAMIC_END   0xef // Last vector handed out by the allocator
+
 typedef struct {
         uint16_t size;
         void    *ptr;
@@ -83,4 +86,13 @@ void init_idt(void);
 /* Register an interrupt handler */
 void register_interrupt_handler(uint16_t vector, void *handler, uint8_t ist, uint8_t flags);
 
+/* Allocate a block of free vectors aligned to its size, returns the first vector or -1 */
+int idt_alloc_vectors(uint32_t count);
+
+/* Allocate a free vector, returns the vector or -1 */
+int idt_alloc_vector(void);
+
+/* Return allocated vectors and restore their empty handlers */
+void idt_free_vectors(uint8_t vector, uint32_t count);
+
 #endif // INCLUDE_IDT_H_
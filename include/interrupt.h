@@ -30,6 +30,9 @@
 /* Empty function handling */
 extern void (*empty_handle[256])(interrupt_frame_t *frame);
 
+/* Handle an NMI (called from nmi_entry with the vector registers saved) */
+void nmi_dispatch(interrupt_frame_t *frame, uint64_t rbp);
+
 /* Register ISR interrupt processing */
 void isr_registe_handle(void);
 
@@ -12,6 +12,11 @@
 #ifndef INCLUDE_INTRUSIVE_LIST_H_
 #define INCLUDE_INTRUSIVE_LIST_H_
 
+#include "stddef.h"
+
+/* Get the structure that embeds the list node */
+#define ilist_entry(node, type, member) ((type *)((char *)(node) - offsetof(type, member)))
+
 typedef struct ilist_node {
         struct ilist_node *prev;
         struct ilist_node *next;
@@ -0,0 +1,93 @@
+/*
+ *
+ *      irq.h
+ *      Generic interrupt dispatch header file
+ *
+ *      2026/10/18 By MicroFish
+ *      Based on GPL-3.0 open source agreement
+ *      Copyright © 2020 ViudiraTech, based on the GPLv3 agreement.
+ *
+ */
+
+#ifndef INCLUDE_IRQ_H_
+#define INCLUDE_IRQ_H_
+
+#include "idt.h"
+#include "stdint.h"
+
+#define IRQ_VECTOR_BASE     32 // First vector with a common entry stub
+#define IRQ_STUB_SIZE       16 // Size of each entry stub
+#define IRQ_HIST_BUCKETS    32 // log2 buckets of the handler cycle histogram
+#define SOFTIRQ_MAX_RESTART 10 // Rounds of softirqs run on one interrupt exit
+
+typedef enum {
+    IRQ_NONE    = 0, // The interrupt was not from this device
+    IRQ_HANDLED = 1, // The interrupt was handled
+} irq_return_t;
+
+typedef enum {
+    SOFTIRQ_TIMER = 0, // Run the timer wheel
+    SOFTIRQ_WORK  = 1, // Run the deferred work queue
+    SOFTIRQ_COUNT,
+} softirq_t;
+
+/* Called with interrupts disabled, the heavy work belongs in a softirq */
+typedef irq_return_t (*irq_handler_t)(uint8_t vector, void *data);
+
+/* Called on interrupt exit with interrupts enabled */
+typedef void (*softirq_handler_t)(void);
+
+typedef struct irq_action {
+        irq_handler_t      handler; // Handler
+        void              *data;    // Any data passed to the handler
+        const char        *name;    // Name shown in the statistics
+        struct irq_action *next;    // Next action sharing the vector
+} irq_action_t;
+
+/* Register frame built by the entry stub */
+typedef struct {
+        uint64_t          r15, r14, r13, r12, r11, r10, r9, r8;
+        uint64_t          rbp, rdi, rsi, rdx, rcx, rbx, rax;
+        uint64_t          vector;
+        interrupt_frame_t frame;
+} __attribute__((packed)) irq_regs_t;
+
+typedef struct {
+        uint64_t count;                  // Number of interrupts
+        uint32_t hist[IRQ_HIST_BUCKETS]; // Handler time, bucket n counts [2^n, 2^(n+1)) cycles
+} irq_stat_t;
+
+/* Common interrupt dispatcher (called from the entry stubs) */
+void interrupt_dispatch(irq_regs_t *regs);
+
+/* Add a handler to a vector, vectors may be shared. Returns 0 on success */
+int irq_register(uint8_t vector, irq_handler_t handler, void *data, const char *name);
+
+/* Remove a handler from a vector, returns 0 on success */
+int irq_unregister(uint8_t vector, irq_handler_t handler, void *data);
+
+/* Remove every handler of a vector and give the vector back to the allocator */
+void irq_release_vector(uint8_t vector);
+
+/* Register a softirq handler */
+void softirq_register(softirq_t nr, softirq_handler_t handler);
+
+/* Mark a softirq pending on the current CPU */
+void softirq_raise(softirq_t nr);
+
+/* Mark a softirq pending on the specified CPU, it runs on that CPU's next interrupt exit or idle loop */
+void softirq_raise_on(uint32_t cpu, softirq_t nr);
+
+/* Run the pending softirqs of the current CPU (called with interrupts disabled) */
+void softirq_run(void);
+
+/* Get the statistics of a vector on a CPU */
+const irq_stat_t *irq_get_stat(uint32_t cpu, uint8_t vector);
+
+/* Print the interrupt statistics of all CPUs */
+void irq_print_stats(void);
+
+/* Allocate the per-CPU interrupt state (called before the APs start) */
+void irq_init_percpu(uint32_t cpu_count);
+
+#endif // INCLUDE_IRQ_H_
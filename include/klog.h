@@ -0,0 +1,98 @@
+/*
+ *
+ *      klog.h
+ *      Kernel log ring header file
+ *
+ *      2026/10/18 By MicroFish
+ *      Based on GPL-3.0 open source agreement
+ *      Copyright © 2020 ViudiraTech, based on the GPLv3 agreement.
+ *
+ */
+
+#ifndef INCLUDE_KLOG_H_
+#define INCLUDE_KLOG_H_
+
+#include "printk.h"
+#include "stdarg.h"
+#include "stdint.h"
+
+#define KLOG_RING_SIZE        128     // Records buffered per CPU (power of two)
+#define KLOG_TEXT_SIZE        232     // Longest message kept, longer ones are truncated
+#define KLOG_PANIC_SPIN       1000000 // Spins a panicking CPU waits for the console before taking it over
+#define KLOG_RATE_BURST       10      // Messages a call site may print in a burst
+#define KLOG_RATE_INTERVAL_MS 1000    // A call site earns one more message per interval
+
+#define KLOG_SUPPRESSED 0x01 // Record flag: kept in the ring but not written to the console
+
+/* Prefix of the klog_*() messages of a file, defined before the includes */
+#ifndef KLOG_PREFIX
+#    define KLOG_PREFIX ""
+#endif
+
+typedef enum {
+    KLOG_EMERG   = 0, // System is unusable
+    KLOG_ALERT   = 1, // Action must be taken immediately
+    KLOG_CRIT    = 2, // Critical conditions
+    KLOG_ERR     = 3, // Error conditions
+    KLOG_WARNING = 4, // Warning conditions
+    KLOG_NOTICE  = 5, // Normal but significant condition
+    KLOG_INFO    = 6, // Informational
+    KLOG_DEBUG   = 7, // Debug-level messages
+} klog_level_t;
+
+typedef struct {
+        volatile uint64_t seq;                  // Ring position + 1 once the record is complete
+        uint64_t          ns;                   // Time of the message
+        uint16_t          cpu;                  // CPU that logged the message
+        uint8_t           level;                // klog_level_t
+        uint8_t           flags;                // KLOG_SUPPRESSED
+        uint32_t          len;                  // Length of the text
+        char              text[KLOG_TEXT_SIZE]; // Message, not NUL-terminated
+} klog_record_t;
+
+/* Token bucket of a call site */
+typedef struct {
+        uint64_t stamp;  // Time the bucket was last refilled, in milliseconds (0 if never used)
+        uint32_t tokens; // Messages that may still be printed
+        uint32_t missed; // Messages suppressed since the last printed one
+} klog_ratelimit_t;
+
+/* Log with a level, rate limited per call site, the format is parsed once per call site */
+#define klog_printf(level, format, ...)                                            \
+    do {                                                                           \
+        static klog_ratelimit_t klog_limit_  = {0, 0, 0};                          \
+        static fmt_cache_t      klog_format_ = FMT_CACHE_INIT(KLOG_PREFIX format); \
+        klog_write(&klog_limit_, level, &klog_format_, ##__VA_ARGS__);             \
+    } while (0)
+
+#define klog_err(format, ...)    klog_printf(KLOG_ERR, format, ##__VA_ARGS__)
+#define klog_warn(format, ...)   klog_printf(KLOG_WARNING, format, ##__VA_ARGS__)
+#define klog_notice(format, ...) klog_printf(KLOG_NOTICE, format, ##__VA_ARGS__)
+#define klog_info(format, ...)   klog_printf(KLOG_INFO, format, ##__VA_ARGS__)
+#define klog_debug(format, ...)  klog_printf(KLOG_DEBUG, format, ##__VA_ARGS__)
+
+/* Format a message into the log ring of the current CPU */
+void klog_vwrite(klog_level_t level, uint8_t flags, const char *format, va_list args);
+
+/* Log a message if the call site has tokens left, otherwise keep it in the ring only */
+void klog_write(klog_ratelimit_t *limit, klog_level_t level, fmt_cache_t *format, ...);
+
+/* Set the most verbose level written to the console */
+void klog_set_console_level(klog_level_t level);
+
+/* Get the most verbose level written to the console ("loglevel=", KLOG_INFO by default) */
+klog_level_t klog_get_console_level(void);
+
+/* Print the messages still held by the rings up to a level, including the suppressed ones */
+void klog_dump(klog_level_t level);
+
+/* Write the buffered messages to the console, returns the number of messages written */
+uint64_t klog_flush(void);
+
+/* Switch to synchronous output and write out everything buffered (called on panic) */
+void klog_panic(void);
+
+/* Allocate the per-CPU rings and hand the console output to an AP */
+void klog_init(void);
+
+#endif // INCLUDE_KLOG_H_
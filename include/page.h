@@ -16,12 +16,40 @@
 
 #define MSR_IA32_PAT 0x277
 
-#define PTE_PRESENT      (0x1 << 0)
-#define PTE_WRITEABLE    (0x1 << 1)
-#define PTE_USER         (0x1 << 2)
-#define PTE_HUGE         (0x1 << 7)
-#define PTE_NO_EXECUTE   (((uint64_t)0x1) << 63)
-#define KERNEL_PTE_FLAGS (PTE_PRESENT | PTE_WRITEABLE | PTE_NO_EXECUTE)
+#define PTE_PRESENT       (0x1 << 0)
+#define PTE_WRITEABLE     (0x1 << 1)
+#define PTE_USER          (0x1 << 2)
+#define PTE_WRITE_THROUGH (0x1 << 3) // PAT index bit 0
+#define PTE_CACHE_DISABLE (0x1 << 4) // PAT index bit 1
+#define PTE_HUGE          (0x1 << 7)
+#define PTE_PAT           (0x1 << 7) // PAT index bit 2, in 4 KiB entries only (PTE_HUGE elsewhere)
+#define PTE_NO_EXECUTE    (((uint64_t)0x1) << 63)
+#define KERNEL_PTE_FLAGS  (PTE_PRESENT | PTE_WRITEABLE | PTE_NO_EXECUTE)
+
+/* PAT memory types */
+#define PAT_UC       0x00 // Uncacheable
+#define PAT_WC       0x01 // Write combining
+#define PAT_WT       0x04 // Write through
+#define PAT_WP       0x05 // Write protected
+#define PAT_WB       0x06 // Write back
+#define PAT_UC_MINUS 0x07 // Uncacheable, overridable by MTRR write combining
+
+/* PAT layout of the kernel, entries 0-3 keep the power-on types so PWT/PCD alone mean the same as without PAT */
+#define PAT_ENTRY(index, type) ((uint64_t)(type) << ((index) * 8))
+#define PAT_KERNEL_LAYOUT                                                                                                     \
+    (PAT_ENTRY(0, PAT_WB) | PAT_ENTRY(1, PAT_WT) | PAT_ENTRY(2, PAT_UC_MINUS) | PAT_ENTRY(3, PAT_UC) | PAT_ENTRY(4, PAT_WP) | \
+     PAT_ENTRY(5, PAT_WC) | PAT_ENTRY(6, PAT_UC_MINUS) | PAT_ENTRY(7, PAT_UC))
+
+/* Memory type flags of a 4 KiB mapping (page_map_to(), page_map_range() and friends), selecting a PAT_KERNEL_LAYOUT entry */
+#define PTE_MEMTYPE_WB       0
+#define PTE_MEMTYPE_WT       PTE_WRITE_THROUGH
+#define PTE_MEMTYPE_UC_MINUS PTE_CACHE_DISABLE
+#define PTE_MEMTYPE_UC       (PTE_CACHE_DISABLE | PTE_WRITE_THROUGH)
+#define PTE_MEMTYPE_WP       PTE_PAT
+#define PTE_MEMTYPE_WC       (PTE_PAT | PTE_WRITE_THROUGH)
+
+#define KERNEL_IO_START 0xffffb00000000000 // Virtual area of the device memory mappings
+#define KERNEL_IO_SIZE  0x1000000000       // 64 GiB
 
 #define PAGE_SIZE 0x1000
 
@@ -70,6 +98,9 @@ void free_directory(page_directory_t *dir);
 /* Maps a virtual address to a physical frame */
 void page_map_to(page_directory_t *directory, uint64_t addr, uint64_t frame, uint64_t flags);
 
+/* Check whether a virtual address is mapped, huge pages included */
+int page_is_mapped(page_directory_t *directory, uint64_t addr);
+
 /* Switch the page directory of the current process */
 void switch_page_directory(page_directory_t *dir);
 
@@ -82,9 +113,15 @@ void page_map_range_to(page_directory_t *directory, uint64_t frame, uint64_t len
 /* Maps random non-contiguous physical pages to the virtual address range */
 void page_map_range_to_random(page_directory_t *directory, uint64_t addr, uint64_t length, uint64_t flags);
 
+/* Map device memory (framebuffers, BARs) with a memory type, returns its virtual address or 0 */
+void *page_map_io(uint64_t phys, uint64_t length, uint64_t memtype);
+
 /* Get the PAT configuration */
 pat_config_t get_pat_config(void);
 
+/* Program the PAT with PAT_KERNEL_LAYOUT, on every CPU */
+void pat_init(void);
+
 /* Initialize memory page table */
 void page_init(void);
 
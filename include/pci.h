@@ -13,17 +13,36 @@
 #define INCLUDE_PCI_H_
 
 #include "acpi.h"
+#include "irq.h"
 #include "stddef.h"
 #include "stdint.h"
 
 #define PCI_HEADER_TYPE_MASK 0x7F
 
-#define PCI_CONF_VENDOR      0x0 // Vendor ID
-#define PCI_CONF_DEVICE      0x2 // Device ID
-#define PCI_CONF_COMMAND     0x4 // Command
-#define PCI_CONF_STATUS      0x6 // Status
-#define PCI_CONF_REVISION    0x8 // Revision ID
-#define PCI_CONF_HEADER_TYPE 0xe // Header Type
+#define PCI_CONF_VENDOR      0x0  // Vendor ID
+#define PCI_CONF_DEVICE      0x2  // Device ID
+#define PCI_CONF_COMMAND     0x4  // Command
+#define PCI_CONF_STATUS      0x6  // Status
+#define PCI_CONF_REVISION    0x8  // Revision ID
+#define PCI_CONF_HEADER_TYPE 0xe  // Header Type
+#define PCI_CONF_CAP_PTR     0x34 // Capabilities Pointer
+
+#define PCI_COMMAND_INTX_DISABLE (1 << 10) // Disable legacy INTx interrupts
+#define PCI_STATUS_CAP_LIST      (1 << 4)  // The capability list is present
+
+#define PCI_CAP_ID_MSI  0x05 // Message Signaled Interrupts
+#define PCI_CAP_ID_MSIX 0x11 // Extended Message Signaled Interrupts
+
+#define PCI_MSI_CTRL_ENABLE  (1 << 0)  // MSI enable
+#define PCI_MSI_CTRL_MME     (7 << 4)  // Multiple message enable
+#define PCI_MSI_CTRL_64BIT   (1 << 7)  // 64-bit message address
+#define PCI_MSIX_CTRL_SIZE   0x7ff     // Table size - 1
+#define PCI_MSIX_CTRL_MASK   (1 << 14) // Function mask
+#define PCI_MSIX_CTRL_ENABLE (1 << 15) // MSI-X enable
+#define PCI_MSIX_ENTRY_SIZE  16        // Size of an MSI-X table entry
+#define PCI_MSIX_ENTRY_MASK  (1 << 0)  // Vector control: masked
+
+#define PCI_MSI_ADDRESS_BASE 0xfee00000 // Local APIC message address
 
 #define PCI_COMMAND_PORT 0xCF8
 #define PCI_DATA_PORT    0xCFC
@@ -59,11 +78,12 @@ typedef enum {
 
 /* Used to offset in ECAM */
 typedef enum {
-    ECAM_AREA_ID    = 4 * 0, // Device and vendor id
-    ECAM_AREA_OPS   = 4 * 1, // Status and command
-    ECAM_AREA_FIELD = 4 * 2, // Class code, subclass, prog IF and revision ID
-    ECAM_AREA_OPS2  = 4 * 3, // BIST, header type, latency timer, cache line size
-    ECAM_OTHERS     = 4 * 4, // Other registers
+    ECAM_AREA_ID    = 4 * 0,  // Device and vendor id
+    ECAM_AREA_OPS   = 4 * 1,  // Status and command
+    ECAM_AREA_FIELD = 4 * 2,  // Class code, subclass, prog IF and revision ID
+    ECAM_AREA_OPS2  = 4 * 3,  // BIST, header type, latency timer, cache line size
+    ECAM_OTHERS     = 4 * 4,  // Other registers
+    ECAM_CAPS       = 4 * 16, // Capabilities and extended configuration space (not cached)
 } ecam_area_t;
 
 typedef struct {
@@ -182,6 +202,27 @@ uint32_t read_bar_n(pci_device_cache_t *device, uint32_t bar_n);
 /* Get the interrupt number of the PCI device */
 uint32_t pci_get_irq(pci_device_cache_t *device);
 
+/* Find a capability in the capability list, returns its offset or 0 */
+uint32_t pci_find_capability(pci_device_cache_t *device, uint8_t cap_id);
+
+/* Enable MSI with a single message targeting the specified CPU, returns the vector or -1 */
+int pci_msi_enable(pci_device_cache_t *device, uint32_t cpu, irq_handler_t handler, void *data);
+
+/* Disable MSI and release its vector */
+void pci_msi_disable(pci_device_cache_t *device);
+
+/* Enable MSI-X with all entries masked, returns the table size or -1 */
+int pci_msix_enable(pci_device_cache_t *device);
+
+/* Route an MSI-X entry to the specified CPU, returns the vector or -1 */
+int pci_msix_set_vector(pci_device_cache_t *device, uint32_t entry, uint32_t cpu, irq_handler_t handler, void *data);
+
+/* Mask an MSI-X entry and release its vector */
+void pci_msix_free_vector(pci_device_cache_t *device, uint32_t entry);
+
+/* Disable MSI-X */
+void pci_msix_disable(pci_device_cache_t *device);
+
 /* Configuring PCI Devices */
 void pci_config(pci_device_cache_t *cache, uint32_t addr);
 
@@ -0,0 +1,78 @@
+/*
+ *
+ *      pmu.h
+ *      Performance monitoring unit header file
+ *
+ *      2026/10/18 By MicroFish
+ *      Based on GPL-3.0 open source agreement
+ *      Copyright © 2020 ViudiraTech, based on the GPLv3 agreement.
+ *
+ */
+
+#ifndef INCLUDE_PMU_H_
+#define INCLUDE_PMU_H_
+
+#include "stdint.h"
+
+#define MSR_IA32_PERFEVTSEL0          0x186
+#define MSR_IA32_PMC0                 0xc1
+#define MSR_IA32_PERF_GLOBAL_STATUS   0x38e
+#define MSR_IA32_PERF_GLOBAL_CTRL     0x38f
+#define MSR_IA32_PERF_GLOBAL_OVF_CTRL 0x390
+#define MSR_AMD_PERF_CTL0             0xc0010200 // Core performance counters, control and counter interleaved
+#define MSR_AMD_PERF_CTR0             0xc0010201
+
+#define PERFEVTSEL_USR (1 << 16) // Count in user mode
+#define PERFEVTSEL_OS  (1 << 17) // Count in kernel mode
+#define PERFEVTSEL_INT (1 << 20) // Interrupt on overflow
+#define PERFEVTSEL_EN  (1 << 22) // Enable the counter
+
+#define PMU_INTEL_CYCLES       0x3c // Unhalted core cycles
+#define PMU_INTEL_INSTRUCTIONS 0xc0 // Instructions retired
+#define PMU_AMD_CYCLES         0x76 // CPU clocks not halted
+#define PMU_AMD_INSTRUCTIONS   0xc0 // Retired instructions
+#define PMU_AMD_COUNTERS       6    // AMD core performance counters
+#define PMU_AMD_WIDTH          48   // Width of the AMD counters
+
+#define PMU_COUNTER_WATCHDOG 0 // Counter used by the NMI watchdog
+#define PMU_COUNTER_PROFILER 1 // Counter used by the sampling profiler
+
+typedef enum {
+    PMU_NONE  = 0, // No usable cycle counter
+    PMU_INTEL = 1, // Intel architectural performance monitoring
+    PMU_AMD   = 2, // AMD core performance counter extensions
+} pmu_type_t;
+
+typedef enum {
+    PMU_EVENT_CYCLES       = 0, // Unhalted core cycles
+    PMU_EVENT_INSTRUCTIONS = 1, // Instructions retired
+} pmu_event_t;
+
+/* Returns the type of the performance monitoring unit */
+pmu_type_t pmu_get_type(void);
+
+/* Returns the number of general purpose counters */
+uint32_t pmu_get_counters(void);
+
+/* Returns the longest period a counter can be loaded with */
+uint64_t pmu_max_period(void);
+
+/* Returns 1 if an event can be counted */
+int pmu_event_supported(pmu_event_t event);
+
+/* Count an event on a counter of the current CPU and raise an NMI every period events, returns 0 on success */
+int pmu_counter_start(uint32_t counter, pmu_event_t event, uint64_t period);
+
+/* Stop a counter of the current CPU */
+void pmu_counter_stop(uint32_t counter);
+
+/* Returns 1 if a counter of the current CPU has overflowed */
+int pmu_counter_overflowed(uint32_t counter);
+
+/* Re-arm a counter of the current CPU after it overflowed (called from the NMI) */
+void pmu_counter_reload(uint32_t counter, uint64_t period);
+
+/* Detect the performance monitoring unit */
+void pmu_init(void);
+
+#endif // INCLUDE_PMU_H_
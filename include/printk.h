@@ -42,6 +42,51 @@ typedef struct {
         size_t idx;
 } unsafe_buf_data;
 
+typedef struct {
+        char  *buf;  // Destination
+        size_t size; // Size of the destination, including the '\0'
+        size_t idx;  // Characters the output needed so far
+} bounded_buf_data;
+
+typedef enum num_size {
+    HALF_2 = 0, // char
+    HALF_1 = 1, // short
+    INT    = 2, // int
+    LONG_1 = 3, // long
+    LONG_2 = 4, // long long
+    SIZE_T = 5, // size_t
+} num_size_t;
+
+#define FMT_CACHE_OPS 16 // Literal runs and conversions a cached format may have
+
+#define FMT_STAR_WIDTH     0x01 // The width is read from the arguments
+#define FMT_STAR_PRECISION 0x02 // The precision is read from the arguments
+
+#define FMT_CACHE_EMPTY 0 // Not parsed yet
+#define FMT_CACHE_BUSY  1 // Being parsed
+#define FMT_CACHE_READY 2 // Op list ready
+#define FMT_CACHE_UNFIT 3 // Too many ops, formatted without the cache
+
+/* A pre-parsed conversion, or a literal run of the format if conv is 0 */
+typedef struct {
+        uint8_t      conv;      // Conversion character, 0 for a literal run
+        num_fmt_type flags;     // Flags of the conversion
+        int8_t       size_cnt;  // Length modifier (num_size_t)
+        uint8_t      star;      // FMT_STAR_WIDTH, FMT_STAR_PRECISION
+        uint32_t     width;     // Minimum field width, offset of a literal run
+        uint32_t     precision; // Precision, length of a literal run
+} fmt_op_t;
+
+/* A format parsed on first use, declared static at the call site with FMT_CACHE_INIT() */
+typedef struct {
+        const char       *fmt;   // Format string
+        volatile uint32_t state; // FMT_CACHE_*
+        uint32_t          count; // Ops in use
+        fmt_op_t          ops[FMT_CACHE_OPS];
+} fmt_cache_t;
+
+#define FMT_CACHE_INIT(format) {.fmt = (format), .state = FMT_CACHE_EMPTY, .count = 0, .ops = {}}
+
 typedef struct {
         const char **fmt_ptr;       // a pointer to `fmt`
         size_t      *write_counter; // for `%n`
@@ -56,16 +101,40 @@ void plogk(const char *format, ...);
 /* Handler of unsafe buf writing */
 uint8_t unsafe_buf_write(writer *writer, char c);
 
+/* Handler of unsafe buf slice writing */
+size_t unsafe_buf_write_span(writer *writer, const char *str, size_t len);
+
 /* Store the formatted output in a character array */
 int sprintf(char *str, const char *fmt, ...);
 
 /* Format with va_list, then store the formatted output in a character array */
 int vsprintf(char *str, const char *fmt, va_list args);
 
+/* Handler of bounded buf writing, characters past the end are counted but dropped */
+uint8_t bounded_buf_write(writer *writer, char c);
+
+/* Handler of bounded buf slice writing, characters past the end are counted but dropped */
+size_t bounded_buf_write_span(writer *writer, const char *str, size_t len);
+
+/* Format with va_list into at most `size` bytes (including the '\0'), returns the length the whole output needs */
+int vsnprintf(char *str, size_t size, const char *fmt, va_list args);
+
+/* Store the formatted output in at most `size` bytes (including the '\0'), returns the length the whole output needs */
+int snprintf(char *str, size_t size, const char *fmt, ...);
+
+/* vsnprintf() with a format parsed once into a cache */
+int vsnprintf_cached(char *str, size_t size, fmt_cache_t *cache, va_list args);
+
+/* snprintf() with a format parsed once into a cache */
+int snprintf_cached(char *str, size_t size, fmt_cache_t *cache, ...);
+
 /* Formatted output processing */
 void wfmt_arg(writer *writer, args_fmter *fmter, va_list args);
 
 /* Use a `writer` to write formatted string */
 size_t vwprintf(writer *writer, const char *fmt, va_list args);
 
+/* Use a `writer` to write a formatted string, the format is parsed on first use only */
+size_t vwprintf_cached(writer *writer, fmt_cache_t *cache, va_list args);
+
 #endif // INCLUDE_PRINTK_H_
@@ -0,0 +1,40 @@
+/*
+ *
+ *      profiler.h
+ *      Sampling profiler header file
+ *
+ *      2026/10/18 By MicroFish
+ *      Based on GPL-3.0 open source agreement
+ *      Copyright © 2020 ViudiraTech, based on the GPLv3 agreement.
+ *
+ */
+
+#ifndef INCLUDE_PROFILER_H_
+#define INCLUDE_PROFILER_H_
+
+#include "idt.h"
+#include "pmu.h"
+#include "stdint.h"
+
+#define PROFILER_RING_SIZE      4096    // Samples buffered per CPU (power of two)
+#define PROFILER_DEFAULT_PERIOD 1000000 // Events between two samples
+#define PROFILER_HASH_SIZE      4096    // Distinct sample addresses aggregated by a dump (power of two)
+#define PROFILER_TOP_MAX        64      // Longest flat profile printed
+#define PROFILER_DUMP_MS        10000   // Delay of the automatic dump when started from the command line
+
+/* Record a sample, returns 1 if the NMI came from the profiler counter */
+int profiler_nmi(interrupt_frame_t *frame);
+
+/* Start sampling on every CPU, returns 0 on success */
+int profiler_start(pmu_event_t event, uint64_t period);
+
+/* Stop sampling on every CPU */
+void profiler_stop(void);
+
+/* Drain the sample rings and print the top functions, returns 0 on success */
+int profiler_dump(uint32_t top);
+
+/* Start the profiler selected by "profile=cycles|instructions" and "profile_period=" */
+void profiler_init(void);
+
+#endif // INCLUDE_PROFILER_H_
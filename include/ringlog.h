@@ -9,20 +9,82 @@
  *
  */
 
+#ifndef INCLUDE_RINGLOG_H_
+#define INCLUDE_RINGLOG_H_
+
+#include "spin_lock.h"
 #include "stddef.h"
+#include "stdint.h"
+
+#define LOG_RING_SIZE    32768 // Bytes of records kept (power of two)
+#define LOG_MAX_LENGTH   1024  // Longest message including the '\0', longer ones are truncated
+#define LOG_RECORD_ALIGN 16    // Records start on this boundary, a multiple of the header size
+#define LOG_RECORD_PAD   0x01  // Record flag: filler up to the end of the ring, no text
+
+#define LOG_DUMP_MAGIC   0x474f4c55 // "ULOG" in the dump header
+#define LOG_DUMP_VERSION 1
+#define LOG_DUMP_PORT    0x3f8 // Serial port of the raw dump (COM1)
 
-#define LOG_MAX_LENGTH  1024
-#define LOG_BUFFER_SIZE 32
+/*
+ * Raw dump format (little endian): a log_dump_header_t, then `bytes` bytes of records from the oldest one.
+ * Each record is a log_record_t followed by `len` characters and a '\0', padded to `size` bytes.
+ * Records with LOG_RECORD_PAD carry no text and are skipped.
+ */
+
+/* Record header, the text follows it in the ring */
+typedef struct {
+        uint32_t size;  // Bytes of the whole record, aligned to LOG_RECORD_ALIGN
+        uint16_t len;   // Length of the text without the '\0'
+        uint16_t flags; // LOG_RECORD_PAD
+        uint64_t seq;   // Sequence number of the record
+} log_record_t;
+
+typedef struct {
+        uint32_t magic;       // LOG_DUMP_MAGIC
+        uint16_t version;     // LOG_DUMP_VERSION
+        uint16_t header_size; // sizeof(log_record_t)
+        uint32_t bytes;       // Bytes of records following the header
+        uint32_t reserved;    // Zero
+        uint64_t first_seq;   // Sequence number of the oldest record
+        uint64_t next_seq;    // Sequence number of the next record to be written
+} log_dump_header_t;
 
 typedef struct {
-        char logs[LOG_BUFFER_SIZE][LOG_MAX_LENGTH];
-        int  head;
-        int  tail;
-        int  count;
+        uint64_t   head;      // Ring position of the next record
+        uint64_t   tail;      // Ring position of the oldest record
+        uint64_t   first_seq; // Sequence number of the oldest record
+        uint64_t   next_seq;  // Sequence number of the next record
+        spinlock_t lock;      // Serializes writers
+        uint8_t    data[LOG_RING_SIZE] __attribute__((aligned(LOG_RECORD_ALIGN)));
 } log_buffer_t;
 
+/* Reader position, a cursor left behind by the writer restarts at the oldest record */
+typedef struct {
+        uint64_t offset; // Ring position of the next record to read
+        uint64_t seq;    // Sequence number of that record
+} log_cursor_t;
+
+#define LOG_CURSOR_INIT {.offset = 0, .seq = 0}
+
 /* Write logs to the ring log buffer */
 void log_buffer_write(log_buffer_t *log, const char *fmt, ...);
 
+/* Get the next record of a cursor, returns 0 at the end. The record stays in place until the writer reuses its space */
+const log_record_t *log_buffer_next(log_buffer_t *log, log_cursor_t *cursor);
+
+/* Get the text of a record */
+static inline const char *log_record_text(const log_record_t *record)
+{
+    return (const char *)(record + 1);
+}
+
 /* Printing ring log buffer */
 void log_buffer_print(log_buffer_t *log);
+
+/* Stream the ring raw over a serial port for host-side decoding */
+void log_buffer_dump(log_buffer_t *log, uint16_t port);
+
+/* Stream the ring raw to LOG_DUMP_PORT if "ringlog=raw" is on the command line */
+void log_buffer_export(log_buffer_t *log);
+
+#endif // INCLUDE_RINGLOG_H_
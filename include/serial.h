@@ -12,16 +12,21 @@
 #ifndef INCLUDE_SERIAL_H_
 #define INCLUDE_SERIAL_H_
 
+#include "stddef.h"
 #include "stdint.h"
 
 /* Register offset */
 #define SERIAL_REG_DATA 0 // Data Register
 #define SERIAL_REG_IER  1 // Interrupt Enable Register
 #define SERIAL_REG_FCR  2 // FIFO Control Register
+#define SERIAL_REG_IIR  2 // Interrupt Identification Register (read)
 #define SERIAL_REG_LCR  3 // Line Control Register
 #define SERIAL_REG_MCR  4 // Modem Control Registers
 #define SERIAL_REG_LSR  5 // Line Status Register
 
+#define SERIAL_FIFO_SIZE 16   // Transmit FIFO depth of a 16550A, empty whenever LSR reports it
+#define SERIAL_IIR_FIFO  0xc0 // IIR bits reading back 11 once the FIFOs are enabled
+
 /* Serial port I/O */
 #define SERIAL_PORT_1 0x3f8 // Serial port 1 number.
 #define SERIAL_PORT_2 0x2f8 // Serial port 2 number.
@@ -46,11 +51,12 @@
 #    define SERIAL_STOP_BITS 1
 #endif
 
-void    init_serial(void);                         // Initialize the serial port
-int     serial_received(uint16_t port);            // Check whether the serial port is ready to read
-int     is_transmit_empty(uint16_t port);          // Check whether the serial port is idle
-uint8_t read_serial(uint16_t port);                // Read serial port
-void    write_serial(uint16_t port, uint8_t data); // Write serial port
-uint8_t get_serial_status(uint16_t port);          // Get the status value of the specified serial port
+void    init_serial(void);                                             // Initialize the serial port
+int     serial_received(uint16_t port);                                // Check whether the serial port is ready to read
+int     is_transmit_empty(uint16_t port);                              // Check whether the serial port is idle
+uint8_t read_serial(uint16_t port);                                    // Read serial port
+void    write_serial(uint16_t port, uint8_t data);                     // Write serial port
+void    write_serial_span(uint16_t port, const char *str, size_t len); // Write a slice to the serial port
+uint8_t get_serial_status(uint16_t port);                              // Get the status value of the specified serial port
 
 #endif // INCLUDE_SERIAL_H_
@@ -51,6 +51,9 @@ uint32_t get_cpu_count(void);
 /* Get the ID of the current CPU */
 uint32_t get_current_cpu_id(void);
 
+/* Get the local APIC ID of the specified CPU */
+uint32_t get_cpu_lapic_id(uint32_t cpu_id);
+
 /* Multi-core boot entry */
 void ap_entry(struct limine_smp_info *info);
 
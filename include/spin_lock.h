@@ -25,4 +25,7 @@ void spin_lock(spinlock_t *lock);
 /* Unlock a spinlock */
 void spin_unlock(spinlock_t *lock);
 
+/* Force a spinlock free whoever holds it (only on panic, when the holder may never release it) */
+void spin_lock_reset(spinlock_t *lock);
+
 #endif // INCLUDE_SPIN_LOCK_H_
@@ -39,10 +39,14 @@ struct writer;
  */
 typedef uint8_t (*write_handler)(struct writer *writer, char ch);
 
-/* A interface of writing a char (May be extended in the future) */
+/* A handle of writing a slice at once, returns the number of characters written */
+typedef size_t (*write_span_handler)(struct writer *writer, const char *str, size_t len);
+
+/* A interface of writing a char or a slice */
 typedef struct writer {
-        void         *data; // Any data
-        write_handler handler;
+        void              *data; // Any data
+        write_handler      handler;
+        write_span_handler span; // Optional, slices go through `handler` one character at a time without it
 } writer;
 /* END TODO BLOCK */
 
@@ -63,6 +67,21 @@ typedef struct num_formatter {
         size_t precision; // Precision (In integer, it's seems like ZEROPAD)
 } num_formatter_t;
 
+/* Write a slice to a writer */
+size_t writer_write(writer *writer, const char *str, size_t len);
+
+/* Write a character repeatedly to a writer */
+size_t writer_fill(writer *writer, char c, size_t count);
+
+/* Number of digits of an unsigned integer in a base (2 to 36) */
+size_t num_digits(uint64_t num, size_t base);
+
+/* Convert an unsigned integer to a string in a base (2 to 36), returns its length without the '\0' */
+size_t utoa(uint64_t num, char *str, size_t base);
+
+/* Convert a signed integer to a string in a base (2 to 36), returns its length without the '\0' */
+size_t itoa(int64_t num, char *str, size_t base);
+
 /* Write a formatted number to a writer */
 size_t wnumber(writer *writer, num_formatter_t fmter, num_fmt_type type);
 
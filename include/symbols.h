@@ -21,7 +21,16 @@ typedef struct {
         Elf64_Xword size;
 } sym_info_t;
 
+typedef struct {
+        Elf64_Addr  addr; // Function start, relative to the kernel base
+        Elf64_Xword size; // Function size (0 if unknown)
+        const char *name; // Function name in the string table
+} sym_index_t;
+
 /* Get symbol information */
 sym_info_t get_symbol_info(uint64_t *kernel_file_address, Elf64_Addr symbol_address);
 
+/* Build the sorted function symbol index of the kernel */
+void symbols_init(void);
+
 #endif // INCLUDE_SYMBOLS_H_
@@ -12,12 +12,74 @@
 #ifndef INCLUDE_TIMER_H_
 #define INCLUDE_TIMER_H_
 
+#include "intrusive_list.h"
+#include "irq.h"
 #include "stdint.h"
 
+#define TIMER_FREQUENCY 250                            // Ticks per second of the per-CPU tick
+#define TIMER_TICK_NS   (1000000000 / TIMER_FREQUENCY) // Nanoseconds per tick
+
+/* The boot CPU halts with interrupts off after initialization, periodic background timers run here instead */
+#define TIMER_BACKGROUND_CPU 1
+
+/* Timing wheel geometry: a 256-slot root wheel followed by 4 cascading 64-slot levels */
+#define TIMER_ROOT_BITS  8
+#define TIMER_LEVEL_BITS 6
+#define TIMER_ROOT_SIZE  (1 << TIMER_ROOT_BITS)
+#define TIMER_LEVEL_SIZE (1 << TIMER_LEVEL_BITS)
+#define TIMER_ROOT_MASK  (TIMER_ROOT_SIZE - 1)
+#define TIMER_LEVEL_MASK (TIMER_LEVEL_SIZE - 1)
+#define TIMER_LEVELS     4
+#define TIMER_MAX_DELAY  0xffffffff // Longest timeout in ticks the wheel can hold
+
+struct timer;
+
+/* Called in softirq context (with interrupts enabled) when a timer expires */
+typedef void (*timer_callback_t)(struct timer *timer);
+
+typedef struct timer {
+        ilist_node_t      node;     // Link in a wheel slot
+        uint64_t          expires;  // Expiry time in ticks
+        timer_callback_t  callback; // Expiry callback
+        void             *data;     // Any data
+        volatile uint32_t cpu;      // CPU whose wheel holds the timer
+        volatile uint8_t  pending;  // Whether the timer is armed
+} timer_t;
+
+/* Timer interrupt */
+irq_return_t timer_handle(uint8_t vector, void *data);
+
 /* Millisecond-based delay functions */
 void msleep(uint64_t ms);
 
 /* Nanosecond-based delay function */
 void nsleep(uint64_t ns);
 
+/* Returns the current time in ticks */
+uint64_t timer_get_ticks(void);
+
+/* Convert milliseconds to ticks (rounded up) */
+uint64_t timer_ms_to_ticks(uint64_t ms);
+
+/* Prepare a timer for use */
+void timer_setup(timer_t *timer, timer_callback_t callback, void *data);
+
+/* Arm a timer to expire at an absolute tick (re-arms it if it is pending) */
+void timer_add_at(timer_t *timer, uint64_t expires);
+
+/* Arm a timer to expire after the specified milliseconds */
+void timer_add(timer_t *timer, uint64_t ms);
+
+/* Arm a timer on the wheel of another CPU, the callback runs there. Returns -1 if the CPU has no wheel */
+int timer_add_on(uint32_t cpu, timer_t *timer, uint64_t ms);
+
+/* Disarm a timer, returns 1 if it was pending */
+int timer_cancel(timer_t *timer);
+
+/* Process expired timers of the current CPU (the timer softirq) */
+void timer_tick(void);
+
+/* Initialize the per-CPU timer wheels */
+void timer_init(void);
+
 #endif // INCLUDE_TIMER_H_
@@ -0,0 +1,101 @@
+/*
+ *
+ *      trace.h
+ *      Static tracepoints header file
+ *
+ *      2026/10/18 By MicroFish
+ *      Based on GPL-3.0 open source agreement
+ *      Copyright © 2020 ViudiraTech, based on the GPLv3 agreement.
+ *
+ */
+
+#ifndef INCLUDE_TRACE_H_
+#define INCLUDE_TRACE_H_
+
+#include "stddef.h"
+#include "stdint.h"
+
+#define TRACE_RING_SIZE   1024  // Records buffered per CPU (power of two)
+#define TRACE_STREAM_MS   1000  // Interval at which the rings are streamed to the serial port
+#define TRACE_STREAM_PORT 0x3f8 // Serial port receiving the decoded records (COM1)
+#define TRACE_MAX_FIELDS  3     // Fields recorded per event
+
+/*
+ * Every event is listed once, EVENTn describes an event with n typed fields:
+ * EVENTn(ID, name, type, field, ...)
+ */
+#define TRACE_EVENTS(EVENT1, EVENT2, EVENT3)                                                       \
+    EVENT2(FRAME_ALLOC, frame_alloc, uint64_t, addr, uint64_t, count)                              \
+    EVENT1(FRAME_FREE, frame_free, uint64_t, addr)                                                 \
+    EVENT3(PAGE_MAP, page_map, uint64_t, addr, uint64_t, frame, uint64_t, flags)                   \
+    EVENT1(IRQ_ENTRY, irq_entry, uint8_t, vector)                                                  \
+    EVENT2(IRQ_EXIT, irq_exit, uint8_t, vector, uint64_t, cycles)                                  \
+    EVENT2(IPI_SEND, ipi_send, uint32_t, apic_id, uint32_t, command)                               \
+    EVENT3(IDE_COMMAND, ide_command, uint8_t, drive, uint32_t, lba, uint8_t, sectors)              \
+    EVENT3(PCI_READ, pci_read, uint32_t, device, uint32_t, offset, uint32_t, value)                \
+    EVENT3(PCI_WRITE, pci_write, uint32_t, device, uint32_t, offset, uint32_t, value)
+
+#define TRACE_ENUM1(id, name, ...) TRACE_##id,
+#define TRACE_ENUM2(id, name, ...) TRACE_##id,
+#define TRACE_ENUM3(id, name, ...) TRACE_##id,
+
+typedef enum {
+    TRACE_EVENTS(TRACE_ENUM1, TRACE_ENUM2, TRACE_ENUM3) TRACE_EVENT_COUNT,
+} trace_event_t;
+
+typedef struct {
+        volatile uint64_t seq;                    // Ring position + 1 once the record is complete
+        uint64_t          tsc;                    // Time stamp counter at the event
+        uint16_t          event;                  // trace_event_t
+        uint16_t          cpu;                    // CPU that recorded the event
+        uint32_t          reserved;
+        uint64_t          args[TRACE_MAX_FIELDS]; // Field values
+} trace_record_t;
+
+extern volatile uint64_t trace_mask; // Enabled events, bit n enables event n
+
+/* Record an event on the current CPU (use the trace_<name>() wrappers) */
+void trace_record(trace_event_t event, uint64_t arg0, uint64_t arg1, uint64_t arg2);
+
+/* Enable or disable events by name, "all" selects every event, returns 0 on success */
+int trace_set_event(const char *name, size_t len, int enable);
+
+/* Decode the records buffered on every CPU to a serial port */
+void trace_stream(uint16_t port);
+
+/* Allocate the per-CPU rings and enable the events listed in "trace=" */
+void trace_init(void);
+
+/* Typed wrappers, a disabled event costs one test of trace_mask */
+#if KERNEL_TRACE
+#    define TRACE_EMIT(id, arg0, arg1, arg2) \
+        if (__builtin_expect(trace_mask & (1ULL << TRACE_##id), 0)) trace_record(TRACE_##id, arg0, arg1, arg2)
+#else
+#    define TRACE_EMIT(id, arg0, arg1, arg2)
+#endif
+
+#define TRACE_WRAPPER1(id, name, t0, f0)    \
+    static inline void trace_##name(t0 f0)  \
+    {                                       \
+        (void)f0;                           \
+        TRACE_EMIT(id, (uint64_t)f0, 0, 0); \
+    }
+#define TRACE_WRAPPER2(id, name, t0, f0, t1, f1)       \
+    static inline void trace_##name(t0 f0, t1 f1)      \
+    {                                                  \
+        (void)f0;                                      \
+        (void)f1;                                      \
+        TRACE_EMIT(id, (uint64_t)f0, (uint64_t)f1, 0); \
+    }
+#define TRACE_WRAPPER3(id, name, t0, f0, t1, f1, t2, f2)          \
+    static inline void trace_##name(t0 f0, t1 f1, t2 f2)          \
+    {                                                             \
+        (void)f0;                                                 \
+        (void)f1;                                                 \
+        (void)f2;                                                 \
+        TRACE_EMIT(id, (uint64_t)f0, (uint64_t)f1, (uint64_t)f2); \
+    }
+
+TRACE_EVENTS(TRACE_WRAPPER1, TRACE_WRAPPER2, TRACE_WRAPPER3)
+
+#endif // INCLUDE_TRACE_H_
@@ -47,6 +47,9 @@ extern writer tty_writer;
 /* Directs character write operations to terminal output */
 uint8_t tty_writer_handler(writer *writer, char c);
 
+/* Directs slice write operations to terminal output */
+size_t tty_writer_span(writer *writer, const char *str, size_t len);
+
 /* Parse boot_tty string to tty_device_t */
 tty_device_t parse_boot_tty_str(char *boot_tty_str);
 
@@ -56,6 +59,9 @@ tty_device_t *get_boot_tty(void);
 /* Print characters to tty */
 void tty_print_ch(const char ch);
 
+/* Print a slice to tty */
+void tty_print_span(const char *str, size_t len);
+
 /* Print string to tty */
 void tty_print_str(const char *str);
 
@@ -12,8 +12,14 @@
 #ifndef INCLUDE_VIDEO_H_
 #define INCLUDE_VIDEO_H_
 
+#include "blit.h"
 #include "stdint.h"
 
+#define VIDEO_FONT_WIDTH  9   // Character cell width in pixels
+#define VIDEO_FONT_HEIGHT 16  // Character cell height in pixels
+#define VIDEO_GLYPH_CACHE 512 // Rendered glyphs kept (power of two)
+#define VIDEO_FLUSH_MS    16  // Period of the deferred console flush
+
 typedef struct {
         uint8_t red;
         uint8_t green;
@@ -25,6 +31,21 @@ typedef struct {
         uint32_t y;
 } position_t;
 
+/* A character rendered with its colors, ready to be copied row by row */
+typedef struct {
+        uint32_t fore_color;                                  // Foreground color of the key
+        uint32_t back_color;                                  // Background color of the key
+        uint16_t ch;                                          // Character of the key, 0xffff if the slot is empty
+        uint32_t pixels[VIDEO_FONT_HEIGHT][VIDEO_FONT_WIDTH]; // Rendered cell
+} video_glyph_t;
+
+/* A character cell of the text grid */
+typedef struct {
+        uint32_t fore_color; // Foreground color
+        uint32_t back_color; // Background color
+        uint32_t ch;         // Character
+} video_cell_t;
+
 typedef struct {
         uint32_t *framebuffer;       // Frame buffer
         uint32_t  cx, cy;            // The character position of the current cursor
@@ -64,6 +85,18 @@ void video_clear_color(uint32_t color);
 /* Scroll to a position that units are characters */
 void video_move_to(uint32_t cx, uint32_t cy);
 
+/* Mark an area of the back buffer as changed, the end is exclusive */
+void video_mark_dirty(uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1);
+
+/* Redraw the changed cells of the text grid and copy the changed area of the back buffer to video memory */
+void video_flush(void);
+
+/* Flush the console from a periodic timer instead of after every string */
+void video_flush_init(void);
+
+/* Take the console over and flush after every string again (called on panic, when the timer CPU may be gone) */
+void video_panic(void);
+
 /* Screen scrolling operation */
 void video_scroll(void);
 
@@ -79,6 +112,12 @@ void video_invoke_area(position_t p0, position_t p1, void (*callback)(position_t
 /* Draw a matrix at the specified coordinates on the screen */
 void video_draw_rect(position_t p0, position_t p1, uint32_t color);
 
+/* Transfer an area of a surface to (x, y) of the back buffer, video_flush() makes it visible */
+void video_blit(int32_t x, int32_t y, const blit_surface_t *src, blit_rect_t rect, blit_mode_t mode, uint32_t key);
+
+/* Draw a character with its colors at the specified coordinates on the screen */
+void video_draw_cell(uint8_t c, uint32_t x, uint32_t y, uint32_t color, uint32_t background);
+
 /* Draw a character at the specified coordinates on the screen */
 void video_draw_char(const char c, uint32_t x, uint32_t y, uint32_t color);
 
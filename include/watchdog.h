@@ -0,0 +1,35 @@
+/*
+ *
+ *      watchdog.h
+ *      Lockup detector header file
+ *
+ *      2026/10/18 By MicroFish
+ *      Based on GPL-3.0 open source agreement
+ *      Copyright © 2020 ViudiraTech, based on the GPLv3 agreement.
+ *
+ */
+
+#ifndef INCLUDE_WATCHDOG_H_
+#define INCLUDE_WATCHDOG_H_
+
+#include "idt.h"
+#include "stdint.h"
+
+#define WATCHDOG_NMI_PERIOD_MS  1000  // Interval of the watchdog NMI on a busy CPU
+#define WATCHDOG_HARD_THRESH_MS 10000 // No timer interrupt for this long is a hard lockup
+#define WATCHDOG_SOFT_THRESH_MS 20000 // Not reaching the idle loop for this long is a soft lockup
+#define WATCHDOG_TRACE_DEPTH    16    // Call trace entries recorded for a hard lockup
+
+/* Timer interrupt heartbeat, also checks for a soft lockup (called from the timer interrupt) */
+void watchdog_tick(void);
+
+/* The current CPU reached a scheduling point (the idle loop) */
+void watchdog_touch(void);
+
+/* Handle a watchdog NMI, rbp is the frame pointer of the interrupted context, returns 1 if the NMI came from the watchdog counter */
+int watchdog_nmi(interrupt_frame_t *frame, uint64_t rbp);
+
+/* Start the lockup detectors on every CPU, "nmi_watchdog=0" disables the hard lockup detector */
+void watchdog_init(void);
+
+#endif // INCLUDE_WATCHDOG_H_
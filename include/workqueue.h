@@ -0,0 +1,46 @@
+/*
+ *
+ *      workqueue.h
+ *      Deferred work header file
+ *
+ *      2026/10/18 By MicroFish
+ *      Based on GPL-3.0 open source agreement
+ *      Copyright © 2020 ViudiraTech, based on the GPLv3 agreement.
+ *
+ */
+
+#ifndef INCLUDE_WORKQUEUE_H_
+#define INCLUDE_WORKQUEUE_H_
+
+#include "stdint.h"
+
+#define WORK_BATCH 32 // Work items run per softirq round before other softirqs get a turn
+
+struct work;
+
+/* Called in softirq context (with interrupts enabled), the work may queue itself again */
+typedef void (*work_func_t)(struct work *work);
+
+typedef struct work {
+        struct work      *next;    // Link in a work queue
+        work_func_t       func;    // Work function
+        void             *data;    // Any data
+        volatile uint8_t  pending; // Whether the work is queued
+} work_t;
+
+/* Prepare a work item for use */
+void work_setup(work_t *work, work_func_t func, void *data);
+
+/* Queue work on the current CPU (safe from interrupt context), returns 0 if it was already queued */
+int work_queue(work_t *work);
+
+/* Queue work on the specified CPU (safe from interrupt context), returns 0 if it was already queued */
+int work_queue_on(uint32_t cpu, work_t *work);
+
+/* Returns the number of work items run on a CPU */
+uint64_t work_get_count(uint32_t cpu);
+
+/* Initialize the per-CPU work queues */
+void workqueue_init(void);
+
+#endif // INCLUDE_WORKQUEUE_H_
@@ -10,28 +10,40 @@
  */
 
 #include "acpi.h"
+#include "apic.h"
+#include "clockevent.h"
+#include "clocksource.h"
 #include "cmdline.h"
 #include "common.h"
 #include "cpuid.h"
 #include "debug.h"
 #include "eis.h"
 #include "frame.h"
+#include "ftrace.h"
 #include "gdt.h"
 #include "heap.h"
 #include "hhdm.h"
 #include "ide.h"
 #include "interrupt.h"
+#include "klog.h"
 #include "limine_module.h"
 #include "page.h"
 #include "parallel.h"
 #include "pci.h"
+#include "pmu.h"
 #include "printk.h"
+#include "profiler.h"
 #include "ps2.h"
 #include "serial.h"
 #include "smbios.h"
 #include "smp.h"
+#include "symbols.h"
+#include "timer.h"
+#include "trace.h"
 #include "uinxed.h"
 #include "video.h"
+#include "watchdog.h"
+#include "workqueue.h"
 
 /* Executable entry */
 void executable_entry(void)
@@ -82,19 +94,33 @@ void kernel_entry(void)
     plogk("x86/PAT: Configuration [0-7]: %s\n", get_pat_config().pat_str);
     plogk("dmi: %s %s, BIOS %s %s\n", smbios_sys_manufacturer(), smbios_sys_product_name(), smbios_bios_version(), smbios_bios_release_date());
 
-    init_gdt();                   // Initialize global descriptors
-    init_idt();                   // Initialize interrupt descriptor
-    isr_registe_handle();         // Register ISR interrupt processing
-    acpi_init();                  // Initialize ACPI
-    smp_init();                   // Initialize SMP
-    print_memory_map();           // Print memory map information
-    log_buffer_print(&frame_log); // Print frame log
-    pci_init();                   // Initialize PCI
-    lmodule_init();               // Initialize the passed-in resource module list
-    init_ide();                   // Initialize ATA/ATAPI driver
-    init_serial();                // Initialize the serial port
-    init_parallel();              // Initialize the parallel port
-    init_ps2();                   // Initialize PS/2 controller
+    symbols_init();                // Build the kernel symbol index
+    init_gdt();                    // Initialize global descriptors
+    init_idt();                    // Initialize interrupt descriptor
+    isr_registe_handle();          // Register ISR interrupt processing
+    acpi_init();                   // Initialize ACPI
+    clocksource_init();            // Initialize clock source
+    smp_init();                    // Initialize SMP
+    timer_init();                  // Initialize kernel timers
+    workqueue_init();              // Initialize deferred work queues
+    video_flush_init();            // Flush the console from a timer
+    klog_init();                   // Move the kernel log to per-CPU rings
+    trace_init();                  // Enable the tracepoints requested by "trace="
+    ftrace_init();                 // Start the function tracer if requested
+    clockevent_init();             // Initialize clock event device
+    print_memory_map();            // Print memory map information
+    log_buffer_print(&frame_log);  // Print frame log
+    pci_init();                    // Initialize PCI
+    lmodule_init();                // Initialize the passed-in resource module list
+    init_ide();                    // Initialize ATA/ATAPI driver
+    init_serial();                 // Initialize the serial port
+    log_buffer_export(&frame_log); // Stream the frame log raw if "ringlog=raw"
+    init_parallel();               // Initialize the parallel port
+    init_ps2();                    // Initialize PS/2 controller
+    ioapic_spread_irqs();          // Spread device interrupts across CPUs
+    pmu_init();                    // Detect performance counters
+    watchdog_init();               // Start the lockup detectors
+    profiler_init();               // Start the sampling profiler if requested
     enable_intr();
 
     panic("No operation.");
@@ -166,3 +166,72 @@ int cpu_support_avx2(void)
     cpuid(0x00000007, &eax, &ebx, &ecx, &edx);
     return ((ebx & (1 << 5)) != 0);
 }
+
+/* Check CPU supports TSC */
+int cpu_support_tsc(void)
+{
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(0x00000001, &eax, &ebx, &ecx, &edx);
+    return ((edx & (1 << 4)) != 0);
+}
+
+/* Check CPU supports invariant TSC */
+int cpu_support_invariant_tsc(void)
+{
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(0x80000000, &eax, &ebx, &ecx, &edx);
+    if (eax < 0x80000007) return 0; // Power management leaf not available
+    cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+    return ((edx & (1 << 8)) != 0);
+}
+
+/* Check CPU supports IA32_TSC_ADJUST MSR */
+int cpu_support_tsc_adjust(void)
+{
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(0x00000000, &eax, &ebx, &ecx, &edx);
+    if (eax < 0x00000007) return 0;
+    cpuid(0x00000007, &eax, &ebx, &ecx, &edx);
+    return ((ebx & (1 << 1)) != 0);
+}
+
+/* Get the architectural performance monitoring leaf, returns the version (0 if not supported) */
+uint32_t cpu_get_perfmon(uint32_t *counters, uint32_t *width, uint32_t *unavailable)
+{
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(0x00000000, &eax, &ebx, &ecx, &edx);
+    if (eax < 0x0000000a) return 0;
+    cpuid(0x0000000a, &eax, &ebx, &ecx, &edx);
+    *counters    = (eax >> 8) & 0xff;
+    *width       = (eax >> 16) & 0xff;
+    *unavailable = (uint32_t)(ebx | ~((1ULL << ((eax >> 24) & 0xff)) - 1)); // Set bits mark missing architectural events
+    return eax & 0xff;
+}
+
+/* Check CPU supports the AMD core performance counter extensions */
+int cpu_support_perfctr_core(void)
+{
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(0x80000000, &eax, &ebx, &ecx, &edx);
+    if (eax < 0x80000001) return 0;
+    cpuid(0x80000001, &eax, &ebx, &ecx, &edx);
+    return ((ecx & (1 << 23)) != 0);
+}
+
+/* Check CPU supports RDTSCP and IA32_TSC_AUX */
+int cpu_support_rdtscp(void)
+{
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(0x80000000, &eax, &ebx, &ecx, &edx);
+    if (eax < 0x80000001) return 0;
+    cpuid(0x80000001, &eax, &ebx, &ecx, &edx);
+    return ((edx & (1 << 27)) != 0);
+}
+
+/* Check CPU supports the page attribute table */
+int cpu_support_pat(void)
+{
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(0x00000001, &eax, &ebx, &ecx, &edx);
+    return ((edx & (1 << 16)) != 0);
+}
@@ -0,0 +1,152 @@
+/*
+ *
+ *      pmu.c
+ *      Performance monitoring unit
+ *
+ *      2026/10/18 By MicroFish
+ *      Based on GPL-3.0 open source agreement
+ *      Copyright © 2020 ViudiraTech, based on the GPLv3 agreement.
+ *
+ */
+
+#include "pmu.h"
+#include "apic.h"
+#include "common.h"
+#include "cpuid.h"
+#include "printk.h"
+#include "stdint.h"
+#include "string.h"
+
+static pmu_type_t pmu_type     = PMU_NONE;
+static uint32_t   pmu_version  = 0; // Intel architectural performance monitoring version
+static uint32_t   pmu_counters = 0; // Number of general purpose counters
+static uint32_t   pmu_width    = 0; // Counter width in bits
+static uint32_t   pmu_missing  = 0; // Architectural events the CPU does not count (Intel)
+
+/* Returns the type of the performance monitoring unit */
+pmu_type_t pmu_get_type(void)
+{
+    return pmu_type;
+}
+
+/* Returns the number of general purpose counters */
+uint32_t pmu_get_counters(void)
+{
+    return pmu_counters;
+}
+
+/* Returns the longest period a counter can be loaded with */
+uint64_t pmu_max_period(void)
+{
+    if (pmu_type == PMU_INTEL) return 0x7fffffff; // Legacy counter writes sign-extend bit 31
+    if (pmu_type == PMU_AMD) return (1ULL << (pmu_width - 1)) - 1;
+    return 0;
+}
+
+/* Returns 1 if an event can be counted */
+int pmu_event_supported(pmu_event_t event)
+{
+    if (pmu_type == PMU_AMD) return 1;
+    if (pmu_type != PMU_INTEL) return 0;
+
+    /* Bit 0 of the missing mask is core cycles, bit 1 instructions retired */
+    return !(pmu_missing & (1 << (event == PMU_EVENT_CYCLES ? 0 : 1)));
+}
+
+/* Event select register of a counter */
+static uint32_t pmu_evtsel_msr(uint32_t counter)
+{
+    return pmu_type == PMU_AMD ? MSR_AMD_PERF_CTL0 + counter * 2 : MSR_IA32_PERFEVTSEL0 + counter;
+}
+
+/* Counter register of a counter */
+static uint32_t pmu_counter_msr(uint32_t counter)
+{
+    return pmu_type == PMU_AMD ? MSR_AMD_PERF_CTR0 + counter * 2 : MSR_IA32_PMC0 + counter;
+}
+
+/* Load a counter so that it overflows after period events */
+static void pmu_counter_load(uint32_t counter, uint64_t period)
+{
+    uint64_t mask = pmu_width < 64 ? (1ULL << pmu_width) - 1 : (uint64_t)-1;
+    if (period > pmu_max_period()) period = pmu_max_period();
+    wrmsr(pmu_counter_msr(counter), (0 - period) & mask);
+}
+
+/* Count an event on a counter of the current CPU and raise an NMI every period events, returns 0 on success */
+int pmu_counter_start(uint32_t counter, pmu_event_t event, uint64_t period)
+{
+    if (!pmu_event_supported(event) || counter >= pmu_counters || !period) return -1;
+
+    uint64_t code;
+    if (pmu_type == PMU_AMD)
+        code = event == PMU_EVENT_CYCLES ? PMU_AMD_CYCLES : PMU_AMD_INSTRUCTIONS;
+    else
+        code = event == PMU_EVENT_CYCLES ? PMU_INTEL_CYCLES : PMU_INTEL_INSTRUCTIONS;
+    wrmsr(pmu_evtsel_msr(counter), 0);
+    pmu_counter_load(counter, period);
+
+    /* Overflows are delivered as NMIs so that they also hit code running with interrupts disabled */
+    lapic_write(LAPIC_REG_LVT_PMC, APIC_LVT_NMI);
+    wrmsr(pmu_evtsel_msr(counter), code | PERFEVTSEL_OS | PERFEVTSEL_USR | PERFEVTSEL_INT | PERFEVTSEL_EN);
+    if (pmu_type == PMU_INTEL && pmu_version >= 2)
+        wrmsr(MSR_IA32_PERF_GLOBAL_CTRL, rdmsr(MSR_IA32_PERF_GLOBAL_CTRL) | (1ULL << counter));
+    return 0;
+}
+
+/* Stop a counter of the current CPU */
+void pmu_counter_stop(uint32_t counter)
+{
+    if (pmu_type == PMU_NONE || counter >= pmu_counters) return;
+    wrmsr(pmu_evtsel_msr(counter), 0);
+}
+
+/* Returns 1 if a counter of the current CPU has overflowed */
+int pmu_counter_overflowed(uint32_t counter)
+{
+    if (pmu_type == PMU_NONE || counter >= pmu_counters) return 0;
+    if (!(rdmsr(pmu_evtsel_msr(counter)) & PERFEVTSEL_EN)) return 0;
+
+    /* The counter was loaded with a negative value, its top bit clears when it wraps */
+    return !(rdmsr(pmu_counter_msr(counter)) & (1ULL << (pmu_width - 1)));
+}
+
+/* Re-arm a counter of the current CPU after it overflowed (called from the NMI) */
+void pmu_counter_reload(uint32_t counter, uint64_t period)
+{
+    pmu_counter_load(counter, period);
+    if (pmu_type == PMU_INTEL && pmu_version >= 2) wrmsr(MSR_IA32_PERF_GLOBAL_OVF_CTRL, 1ULL << counter);
+
+    /* The local APIC masks the LVT entry when it delivers a counter overflow */
+    lapic_write(LAPIC_REG_LVT_PMC, APIC_LVT_NMI);
+}
+
+/* Detect the performance monitoring unit */
+void pmu_init(void)
+{
+    uint32_t counters = 0, width = 0, missing = 0;
+
+    if (!strcmp(get_vendor_name(), "AuthenticAMD")) {
+        /* Only trust the counters when the core counter extensions are advertised, emulators often lack them */
+        if (!cpu_support_perfctr_core()) {
+            plogk("pmu: No AMD core performance counter extensions.\n");
+            return;
+        }
+        pmu_type     = PMU_AMD;
+        pmu_counters = PMU_AMD_COUNTERS;
+        pmu_width    = PMU_AMD_WIDTH;
+        plogk("pmu: AMD performance counters, %u x %u bits.\n", pmu_counters, pmu_width);
+        return;
+    }
+
+    pmu_version = cpu_get_perfmon(&counters, &width, &missing);
+    if (!pmu_version || !counters || (missing & 3) == 3) {
+        plogk("pmu: No architectural performance monitoring.\n");
+        return;
+    }
+    pmu_type     = PMU_INTEL;
+    pmu_counters = counters;
+    pmu_width    = width;
+    pmu_missing  = missing;
+    plogk("pmu: Architectural performance monitoring version %u, %u x %u bits.\n", pmu_version, pmu_counters, pmu_width);
+}
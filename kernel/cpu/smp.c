@@ -9,14 +9,19 @@
  *
  */
 
+#define KLOG_PREFIX "smp: "
+
 #include "smp.h"
 #include "alloc.h"
 #include "apic.h"
+#include "clocksource.h"
 #include "common.h"
 #include "debug.h"
 #include "eis.h"
 #include "gdt.h"
 #include "interrupt.h"
+#include "irq.h"
+#include "klog.h"
 #include "limine.h"
 #include "page.h"
 #include "printk.h"
@@ -25,7 +30,9 @@
 #include "stdint.h"
 #include "stdlib.h"
 #include "string.h"
+#include "timer.h"
 #include "uinxed.h"
+#include "watchdog.h"
 
 static cpu_processor_t *cpus;
 static size_t           cpu_count = 0;
@@ -34,48 +41,40 @@ static volatile uint64_t ap_ready_count = 0;
 spinlock_t               ap_start_lock  = {0};
 
 /* Rescheduling Requests */
-INTERRUPT_BEGIN static void ipi_reschedule_handler(interrupt_frame_t *frame)
+static irq_return_t ipi_reschedule_handler(uint8_t vector, void *data)
 {
-    (void)frame;
-    disable_intr();
+    (void)vector;
+    (void)data;
     /* TODO: Handle rescheduling */
-    send_eoi();
-    enable_intr();
+    return IRQ_HANDLED;
 }
-INTERRUPT_END
 
 /* Downtime Request */
-INTERRUPT_BEGIN static void ipi_halt_handler(interrupt_frame_t *frame)
+static irq_return_t ipi_halt_handler(uint8_t vector, void *data)
 {
-    (void)frame;
-    disable_intr();
+    (void)vector;
+    (void)data;
     /* TODO: Handle halting */
-    send_eoi();
-    enable_intr();
+    return IRQ_HANDLED;
 }
-INTERRUPT_END
 
 /* TLB flush request */
-INTERRUPT_BEGIN static void ipi_tlb_shootdown_handler(interrupt_frame_t *frame)
+static irq_return_t ipi_tlb_shootdown_handler(uint8_t vector, void *data)
 {
-    (void)frame;
-    disable_intr();
+    (void)vector;
+    (void)data;
     /* TODO: Handle TLB shootdown */
-    send_eoi();
-    enable_intr();
+    return IRQ_HANDLED;
 }
-INTERRUPT_END
 
 /* Emergency Error Broadcast */
-INTERRUPT_BEGIN static void ipi_panic_handler(interrupt_frame_t *frame)
+static irq_return_t ipi_panic_handler(uint8_t vector, void *data)
 {
-    (void)frame;
-    disable_intr();
+    (void)vector;
+    (void)data;
     /* TODO: Handle panic */
-    send_eoi();
-    enable_intr();
+    return IRQ_HANDLED;
 }
-INTERRUPT_END
 
 /* Send an IPI to all CPUs */
 void send_ipi_all(uint8_t vector)
@@ -118,6 +117,13 @@ uint32_t get_current_cpu_id(void)
     return 0; // Default to CPU 0 if not found
 }
 
+/* Get the local APIC ID of the specified CPU */
+uint32_t get_cpu_lapic_id(uint32_t cpu_id)
+{
+    if (cpu_id >= cpu_count) return lapic_id();
+    return cpus[cpu_id].lapic_id;
+}
+
 /* Initialize the TSS for the AP  */
 void ap_init_tss(cpu_processor_t *cpu)
 {
@@ -130,7 +136,10 @@ void ap_init_tss(cpu_processor_t *cpu)
 
     cpu->gdt.entries[5] = (((low_base | mid_base) | limit) | access_byte);
     cpu->gdt.entries[6] = high_base;
-    cpu->tss->ist[0]    = ((uint64_t)cpu->tss_stack) + sizeof(tss_stack_t);
+
+    /* Fall back to the small TSS stack if the guarded stacks could not be mapped */
+    for (int i = 0; i < IST_COUNT; i++)
+        if (!cpu->tss->ist[i]) cpu->tss->ist[i] = ((uint64_t)cpu->tss_stack) + sizeof(tss_stack_t);
     __asm__ volatile("ltr %w[offset]" ::[offset] "rm"((uint16_t)0x28) : "memory");
 }
 
@@ -163,6 +172,7 @@ void ap_entry(struct limine_smp_info *info)
     init_fpu();
     init_sse();
     init_avx();
+    pat_init();
 
     pointer_cast_t cast;
     cast.val             = info->extra_argument;
@@ -182,15 +192,20 @@ void ap_entry(struct limine_smp_info *info)
     /* Initializing Local APIC */
     local_apic_init();
 
+    /* Synchronize TSC with the BSP */
+    tsc_sync_ap();
+
     spin_lock(&ap_start_lock);
     ap_ready_count++;
     spin_unlock(&ap_start_lock);
 
     /* TODO: Implement the scheduler loop */
     while (1) {
+        disable_intr();
+        softirq_run(); // Deferred work left over from the last interrupt
+        watchdog_touch();
         enable_intr();
         __asm__ volatile("hlt");
-        disable_intr();
     }
 
     /* Shouldn't reach here */
@@ -211,11 +226,16 @@ void smp_init(void)
     cpus      = (cpu_processor_t *)aligned_alloc(16, sizeof(cpu_processor_t) * cpu_count);
     plogk("smp: Found %d CPUs.\n", cpu_count);
 
+    /* The per-CPU interrupt state is indexed by CPU id, set the ids up before any AP runs */
+    for (uint32_t i = 0; i < cpu_count; i++) {
+        cpus[i].id       = i;
+        cpus[i].lapic_id = smp->cpus[i]->lapic_id;
+    }
+    irq_init_percpu(cpu_count);
+
     /* Init BootStrap Processor */
     for (uint32_t i = 0; i < cpu_count; i++) {
         struct limine_smp_info *cpu = smp->cpus[i];
-        cpus[i].id                  = i;
-        cpus[i].lapic_id            = cpu->lapic_id;
         /* Allocate kernel stack for each CPU */
         cpus[i].kernel_stack = malloc(sizeof(kernel_stack_t)); // 64 KiB stack
 
@@ -224,6 +244,7 @@ void smp_init(void)
             cpus[i].gdt       = gdt0;
             cpus[i].tss_stack = &tss_stack;
             cpus[i].tss       = &tss0;
+            tss_init_ist(cpus[i].tss, i);
             pointer_cast_t cast;
             cast.ptr = cpus[i].kernel_stack;
             set_kernel_stack(ALIGN_DOWN((uint64_t)cast.val + sizeof(kernel_stack_t), 16));
@@ -232,6 +253,8 @@ void smp_init(void)
             /* Allocate TSS Stack for each CPU */
             cpus[i].tss_stack = malloc(sizeof(tss_stack_t));
             cpus[i].tss       = (tss_t *)malloc(sizeof(tss_t));
+            memset(cpus[i].tss, 0, sizeof(tss_t));
+            tss_init_ist(cpus[i].tss, i);
 
             /* Configure the AP entry point */
             cpu->extra_argument = (uint64_t)&cpus[i];
@@ -243,15 +266,19 @@ void smp_init(void)
     }
 
     /* Register IPI handler */
-    register_interrupt_handler(IPI_RESCHEDULE, (void *)ipi_reschedule_handler, 0, 0x8e);
-    register_interrupt_handler(IPI_HALT, (void *)ipi_halt_handler, 0, 0x8e);
-    register_interrupt_handler(IPI_TLB_SHOOTDOWN, (void *)ipi_tlb_shootdown_handler, 0, 0x8e);
-    register_interrupt_handler(IPI_PANIC, (void *)ipi_panic_handler, 0, 0x8e);
+    irq_register(IPI_RESCHEDULE, ipi_reschedule_handler, 0, "ipi-resched");
+    irq_register(IPI_HALT, ipi_halt_handler, 0, "ipi-halt");
+    irq_register(IPI_TLB_SHOOTDOWN, ipi_tlb_shootdown_handler, 0, "ipi-tlb");
+    irq_register(IPI_PANIC, ipi_panic_handler, 0, "ipi-panic");
     plogk("smp: IPI handlers registered.\n");
 
     /* Wait for all APs to be ready */
-    while (ap_ready_count < cpu_count - 1) __asm__ volatile("pause");
+    while (ap_ready_count < cpu_count - 1) {
+        tsc_sync_master();
+        __asm__ volatile("pause");
+    }
     for (size_t i = 0; i < cpu_count; i++)
-        plogk("smp: CPU %03u: tss_stack = %p, kernel_stack = %p\n", cpus[i].id, cpus[i].tss_stack, cpus[i].kernel_stack);
+        klog_debug("CPU %03u: tss_stack = %p, kernel_stack = %p, ist_stack = %p\n", cpus[i].id, cpus[i].tss_stack,
+                   cpus[i].kernel_stack, cpus[i].tss->ist[0]);
     plogk("smp: All APs are up, total %llu CPUs.\n", cpu_count);
 }
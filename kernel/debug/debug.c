@@ -11,48 +11,51 @@
 
 #include "debug.h"
 #include "common.h"
+#include "klog.h"
 #include "limine.h"
 #include "printk.h"
 #include "smbios.h"
 #include "stdarg.h"
 #include "symbols.h"
 #include "uinxed.h"
+#include "video.h"
 
 int carry_error_code = 0;
 
-/* Dump stack */
-void dump_stack(void)
-{
-    uintptr_t current_address = kernel_address_request.response->virtual_base;
+union rbp_node {
+        uintptr_t       inner;
+        union rbp_node *next;
+}; // A way to avoid performance-no-int-to-ptr
 
-    union rbp_node {
-            uintptr_t       inner;
-            union rbp_node *next;
-    } *rbp; // A way to avoid performance-no-int-to-ptr
+/* Print one entry of a call trace */
+static void dump_frame(uintptr_t rip)
+{
+    uintptr_t  current_address = kernel_address_request.response->virtual_base;
+    sym_info_t sym_info        = get_symbol_info(kernel_file_request.response->kernel_file->address, rip);
 
-    uintptr_t rip;
-    __asm__ volatile("movq %%rbp, %0" : "=r"(rbp));
-    __asm__ volatile("leaq (%%rip), %0" : "=r"(rip));
+    if (!sym_info.name) {
+        plogk("  [<0x%016zx>] %s\n", rip, "unknown");
+    } else {
+        plogk("  [<0x%016zx>] `%s`+0x%lx/0x%lx\n", rip, sym_info.name, rip - (current_address + sym_info.addr), sym_info.size);
+    }
+}
 
+/* Print the call trace of a frame pointer chain, skipping the frame of the error code if skip_error is set */
+static void dump_frames(uintptr_t rip, union rbp_node *rbp, int skip_error)
+{
     plogk("Call Trace:\n");
     plogk(" <TASK>\n");
 
     int frame_count = 0;
     for (int i = 0; i < 16 && rip && (uintptr_t)rbp > 0x1000; ++i) {
-        if (carry_error_code && frame_count == 3) {
+        if (skip_error && frame_count == 3) {
             rip = *(uintptr_t *)(rbp + 1);
             rbp = rbp->next;
             ++frame_count;
             continue;
         }
 
-        sym_info_t sym_info = get_symbol_info(kernel_file_request.response->kernel_file->address, rip);
-        if (!sym_info.name) {
-            plogk("  [<0x%016zx>] %s\n", rip, "unknown");
-        } else {
-            plogk("  [<0x%016zx>] `%s`+0x%lx/0x%lx\n", rip, sym_info.name, rip - (current_address + sym_info.addr), sym_info.size);
-        }
-
+        dump_frame(rip);
         rip = *(uintptr_t *)(rbp + 1);
         rbp = rbp->next;
         ++frame_count;
@@ -60,6 +63,43 @@ void dump_stack(void)
     plogk(" </TASK>\n");
 }
 
+/* Dump stack */
+void dump_stack(void)
+{
+    union rbp_node *rbp;
+    uintptr_t       rip;
+
+    __asm__ volatile("movq %%rbp, %0" : "=r"(rbp));
+    __asm__ volatile("leaq (%%rip), %0" : "=r"(rip));
+    dump_frames(rip, rbp, carry_error_code);
+}
+
+/* Record the call trace of an interrupted context without printing, returns the number of entries */
+int stack_trace_at(uintptr_t rip, uintptr_t rbp, uintptr_t *trace, int max)
+{
+    pointer_cast_t  cast;
+    union rbp_node *node;
+    int             count = 0;
+
+    cast.val = rbp;
+    node     = cast.ptr;
+    while (count < max && rip && (uintptr_t)node > 0x1000) {
+        trace[count++] = rip;
+        rip            = *(uintptr_t *)(node + 1);
+        node           = node->next;
+    }
+    return count;
+}
+
+/* Print a call trace recorded by stack_trace_at */
+void dump_trace(const uintptr_t *trace, int count)
+{
+    plogk("Call Trace:\n");
+    plogk(" <TASK>\n");
+    for (int i = 0; i < count; ++i) dump_frame(trace[i]);
+    plogk(" </TASK>\n");
+}
+
 /* Kernel panic */
 void panic(const char *format, ...)
 {
@@ -71,14 +111,13 @@ void panic(const char *format, ...)
 
     static char buff[1024];
     va_list     args;
-    int         i;
 
+    video_panic();
+    klog_panic();
     va_start(args, format);
-    i = vsprintf(buff, format, args);
+    vsnprintf(buff, sizeof(buff), format, args);
     va_end(args);
 
-    buff[i] = '\0';
-
     plogk("\n");
     plogk("Kernel panic - not syncing: %s\n", buff);
     plogk("Hardware name: %s %s, BIOS %s %s\n", sys_vendor, sys_product, bios_version, bios_date);
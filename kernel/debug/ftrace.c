@@ -0,0 +1,308 @@
+/*
+ *
+ *      ftrace.c
+ *      Function entry/exit tracer
+ *
+ *      2026/10/18 By MicroFish
+ *      Based on GPL-3.0 open source agreement
+ *      Copyright © 2020 ViudiraTech, based on the GPLv3 agreement.
+ *
+ */
+
+#include "ftrace.h"
+#include "alloc.h"
+#include "clocksource.h"
+#include "cmdline.h"
+#include "common.h"
+#include "cpuid.h"
+#include "printk.h"
+#include "smp.h"
+#include "stdint.h"
+#include "string.h"
+#include "symbols.h"
+#include "timer.h"
+#include "uinxed.h"
+#include "workqueue.h"
+
+/* The hooks also run inside interrupt handlers, which do not save the SSE registers */
+#define FTRACE_HOOK NOTRACE __attribute__((target("general-regs-only")))
+
+/* A function being executed */
+typedef struct {
+        uint64_t fn;    // Function address
+        uint64_t start; // TSC at entry
+        uint64_t child; // Cycles spent in traced callees
+} ftrace_frame_t;
+
+/* Statistics of one function */
+typedef struct {
+        uint64_t fn;    // Function address (0 if the slot is free)
+        uint64_t calls; // Number of returns
+        uint64_t incl;  // Cycles including the callees
+        uint64_t excl;  // Cycles excluding the callees
+} ftrace_func_t;
+
+/* Per-CPU tracer state, only written by its own CPU */
+typedef struct {
+        volatile uint32_t busy;       // A hook is running, nested hooks (interrupts, NMIs) are skipped
+        uint32_t          depth;      // Frames on the stack
+        uint32_t          generation; // Matches ftrace_generation once the statistics were reset
+        uint64_t          overflow;   // Calls not tracked because the stack was full
+        uint64_t          dropped;    // Returns not accounted because the table was full
+        work_t            setup;      // Loads the CPU index into IA32_TSC_AUX
+        ftrace_frame_t    stack[FTRACE_DEPTH];
+        ftrace_func_t     funcs[FTRACE_HASH_SIZE];
+} ftrace_cpu_t;
+
+static ftrace_cpu_t *volatile ftrace_cpus = 0;
+static uint32_t               ftrace_cpu_count;
+static volatile uint8_t       ftrace_enabled    = 0;
+static volatile uint32_t      ftrace_generation = 0;
+static volatile uint8_t       ftrace_dumping    = 0;
+static timer_t                ftrace_timer;
+
+/* Read the TSC together with IA32_TSC_AUX, which holds the CPU index + 1 */
+static inline FTRACE_HOOK uint64_t ftrace_clock(uint32_t *aux)
+{
+    uint32_t low, high;
+    __asm__ volatile("rdtscp" : "=a"(low), "=d"(high), "=c"(*aux));
+    return ((uint64_t)high << 32) | low;
+}
+
+/* Get the state of the current CPU and mark it busy, returns 0 if the hook must not run */
+static inline FTRACE_HOOK ftrace_cpu_t *ftrace_enter_hook(uint32_t aux)
+{
+    ftrace_cpu_t *cpus = ftrace_cpus;
+    if (!aux || aux > ftrace_cpu_count || !cpus) return 0;
+
+    ftrace_cpu_t *cpu = &cpus[aux - 1];
+    if (cpu->busy) return 0;
+    cpu->busy = 1;
+    __asm__ volatile("" ::: "memory");
+
+    /* A new trace started, the CPU resets its own statistics */
+    if (cpu->generation != ftrace_generation) {
+        for (uint32_t i = 0; i < FTRACE_HASH_SIZE; i++) cpu->funcs[i].fn = 0;
+        cpu->depth      = 0;
+        cpu->overflow   = 0;
+        cpu->dropped    = 0;
+        cpu->generation = ftrace_generation;
+    }
+    return cpu;
+}
+
+/* Let nested hooks run again */
+static inline FTRACE_HOOK void ftrace_leave_hook(ftrace_cpu_t *cpu)
+{
+    __asm__ volatile("" ::: "memory");
+    cpu->busy = 0;
+}
+
+/* Add the cost of one call to the statistics of its function */
+static inline FTRACE_HOOK void ftrace_account(ftrace_cpu_t *cpu, uint64_t fn, uint64_t incl, uint64_t excl)
+{
+    uint32_t index = (uint32_t)((fn * 0x9e3779b97f4a7c15ULL) >> 32) & (FTRACE_HASH_SIZE - 1);
+
+    for (uint32_t i = 0; i < FTRACE_PROBES; i++) {
+        ftrace_func_t *func = &cpu->funcs[(index + i) & (FTRACE_HASH_SIZE - 1)];
+        if (func->fn != fn && func->fn) continue;
+        if (!func->fn) {
+            func->calls = 0;
+            func->incl  = 0;
+            func->excl  = 0;
+            func->fn    = fn;
+        }
+        func->calls++;
+        func->incl += incl;
+        func->excl += excl;
+        return;
+    }
+    cpu->dropped++;
+}
+
+/* Compiler hook called on entry of every instrumented function */
+FTRACE_HOOK void __cyg_profile_func_enter(void *this_fn, void *call_site)
+{
+    (void)call_site;
+    if (__builtin_expect(!ftrace_enabled, 1)) return;
+
+    uint32_t      aux;
+    uint64_t      now = ftrace_clock(&aux);
+    ftrace_cpu_t *cpu = ftrace_enter_hook(aux);
+    if (!cpu) return;
+
+    if (cpu->depth < FTRACE_DEPTH) {
+        ftrace_frame_t *frame = &cpu->stack[cpu->depth++];
+        frame->fn             = (uint64_t)this_fn;
+        frame->start          = now;
+        frame->child          = 0;
+    } else {
+        cpu->overflow++;
+    }
+    ftrace_leave_hook(cpu);
+}
+
+/* Compiler hook called on exit of every instrumented function */
+FTRACE_HOOK void __cyg_profile_func_exit(void *this_fn, void *call_site)
+{
+    (void)call_site;
+    if (__builtin_expect(!ftrace_enabled, 1)) return;
+
+    uint32_t      aux;
+    uint64_t      now = ftrace_clock(&aux);
+    ftrace_cpu_t *cpu = ftrace_enter_hook(aux);
+    if (!cpu) return;
+
+    /* The entry of this call was not tracked (skipped hook, full stack, or tracing started later) */
+    if (!cpu->depth || cpu->stack[cpu->depth - 1].fn != (uint64_t)this_fn) {
+        ftrace_leave_hook(cpu);
+        return;
+    }
+
+    ftrace_frame_t *frame = &cpu->stack[--cpu->depth];
+    uint64_t        incl  = now - frame->start;
+    uint64_t        excl  = incl > frame->child ? incl - frame->child : 0;
+    if (cpu->depth) cpu->stack[cpu->depth - 1].child += incl;
+    ftrace_account(cpu, frame->fn, incl, excl);
+    ftrace_leave_hook(cpu);
+}
+
+/* Load the CPU index into IA32_TSC_AUX, read back by RDTSCP in the hooks */
+static NOTRACE void ftrace_cpu_setup(work_t *work)
+{
+    ftrace_cpu_t *cpu = (ftrace_cpu_t *)work->data;
+    wrmsr(MSR_IA32_TSC_AUX, (uint64_t)(cpu - ftrace_cpus) + 1);
+}
+
+/* Start tracing on every CPU, the previous statistics are discarded. Returns 0 on success */
+NOTRACE int ftrace_start(void)
+{
+    if (!cpu_support_rdtscp()) {
+        plogk("ftrace: RDTSCP is not supported, the tracer is unavailable.\n");
+        return -1;
+    }
+    if (!ftrace_cpus) {
+        uint32_t      count = get_cpu_count() ? get_cpu_count() : 1;
+        ftrace_cpu_t *cpus  = (ftrace_cpu_t *)malloc(sizeof(ftrace_cpu_t) * count);
+        if (!cpus) {
+            plogk("ftrace: Failed to allocate per-CPU tracer state.\n");
+            return -1;
+        }
+        memset(cpus, 0, sizeof(ftrace_cpu_t) * count);
+        ftrace_cpu_count = count;
+        __asm__ volatile("" ::: "memory");
+        ftrace_cpus = cpus;
+
+        /* Each CPU records nothing until it has loaded its index */
+        for (uint32_t i = 0; i < count; i++) {
+            work_setup(&cpus[i].setup, ftrace_cpu_setup, &cpus[i]);
+            if (i == get_current_cpu_id())
+                ftrace_cpu_setup(&cpus[i].setup);
+            else
+                work_queue_on(i, &cpus[i].setup);
+        }
+    }
+    __atomic_fetch_add(&ftrace_generation, 1, __ATOMIC_RELEASE);
+    ftrace_enabled = 1;
+    plogk("ftrace: Tracing function entry and exit on %u CPUs.\n", ftrace_cpu_count);
+    return 0;
+}
+
+/* Stop tracing, the statistics are kept for ftrace_dump() */
+NOTRACE void ftrace_stop(void)
+{
+    ftrace_enabled = 0;
+}
+
+/* Print the functions with the most exclusive time, returns 0 on success */
+NOTRACE int ftrace_dump(uint32_t top)
+{
+    if (!ftrace_cpus || __atomic_exchange_n(&ftrace_dumping, 1, __ATOMIC_ACQUIRE)) return -1;
+
+    ftrace_func_t *table = (ftrace_func_t *)malloc(sizeof(ftrace_func_t) * FTRACE_HASH_SIZE);
+    if (!table) {
+        __atomic_store_n(&ftrace_dumping, 0, __ATOMIC_RELEASE);
+        return -1;
+    }
+    memset(table, 0, sizeof(ftrace_func_t) * FTRACE_HASH_SIZE);
+
+    /* Merge the CPUs, the counters are read while they may still be updated */
+    uint32_t functions = 0;
+    uint64_t overflow = 0, dropped = 0;
+    for (uint32_t i = 0; i < ftrace_cpu_count; i++) {
+        ftrace_cpu_t *cpu = &ftrace_cpus[i];
+        if (cpu->generation != ftrace_generation) continue;
+
+        for (uint32_t j = 0; j < FTRACE_HASH_SIZE; j++) {
+            ftrace_func_t func = cpu->funcs[j];
+            if (!func.fn) continue;
+
+            uint32_t k = 0;
+            while (k < functions && table[k].fn != func.fn) k++;
+            if (k == functions) {
+                if (functions == FTRACE_HASH_SIZE) {
+                    dropped += func.calls;
+                    continue;
+                }
+                table[functions++].fn = func.fn;
+            }
+            table[k].calls += func.calls;
+            table[k].incl += func.incl;
+            table[k].excl += func.excl;
+        }
+        overflow += cpu->overflow;
+        dropped += cpu->dropped;
+    }
+
+    /* Selection of the top entries by exclusive time */
+    if (top > FTRACE_TOP_MAX) top = FTRACE_TOP_MAX;
+    if (top > functions) top = functions;
+    for (uint32_t i = 0; i < top; i++) {
+        uint32_t best = i;
+        for (uint32_t j = i + 1; j < functions; j++)
+            if (table[j].excl > table[best].excl) best = j;
+        ftrace_func_t swap = table[i];
+        table[i]           = table[best];
+        table[best]        = swap;
+    }
+
+    uint64_t  khz         = tsc_get_khz();
+    uint64_t *kernel_file = kernel_file_request.response->kernel_file->address;
+    plogk("ftrace: %u functions, %llu untracked calls, %llu unaccounted returns, times in %s.\n", functions, overflow,
+          dropped, khz ? "us" : "cycles");
+    plogk("ftrace: %10s %12s %12s %10s %s\n", "calls", "inclusive", "exclusive", "avg excl", "function");
+    for (uint32_t i = 0; i < top; i++) {
+        ftrace_func_t *func = &table[i];
+        sym_info_t     sym  = get_symbol_info(kernel_file, func->fn);
+        uint64_t       incl = khz ? func->incl * 1000 / khz : func->incl;
+        uint64_t       excl = khz ? func->excl * 1000 / khz : func->excl;
+        plogk("ftrace: %10llu %12llu %12llu %10llu %s\n", func->calls, incl, excl, func->calls ? excl / func->calls : 0,
+              sym.name ? sym.name : "[unknown]");
+    }
+
+    free(table);
+    __atomic_store_n(&ftrace_dumping, 0, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/* Dump the function profile collected since boot */
+static NOTRACE void ftrace_timer_expired(timer_t *timer)
+{
+    (void)timer;
+    ftrace_dump(FTRACE_TOP_MAX);
+}
+
+/* Start the tracer if "ftrace=1" is on the command line */
+NOTRACE void ftrace_init(void)
+{
+    if (!cmdline_arg_is("ftrace", "1")) return;
+#if !KERNEL_FTRACE
+    plogk("ftrace: The kernel is not instrumented, \"ftrace=1\" is ignored.\n");
+    return;
+#endif
+    if (ftrace_start() < 0) return;
+
+    timer_setup(&ftrace_timer, ftrace_timer_expired, 0);
+    if (timer_add_on(TIMER_BACKGROUND_CPU, &ftrace_timer, FTRACE_DUMP_MS) < 0)
+        plogk("ftrace: No CPU to run the timed dump, call ftrace_dump() instead.\n");
+}
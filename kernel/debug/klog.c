@@ -0,0 +1,390 @@
+/*
+ *
+ *      klog.c
+ *      Kernel log ring
+ *
+ *      2026/10/18 By MicroFish
+ *      Based on GPL-3.0 open source agreement
+ *      Copyright © 2020 ViudiraTech, based on the GPLv3 agreement.
+ *
+ */
+
+#include "klog.h"
+#include "alloc.h"
+#include "clocksource.h"
+#include "cmdline.h"
+#include "printk.h"
+#include "smp.h"
+#include "spin_lock.h"
+#include "stdarg.h"
+#include "stdint.h"
+#include "string.h"
+#include "tty.h"
+#include "workqueue.h"
+
+/* Record ring, producers reserve slots atomically, the console output is the only consumer */
+typedef struct {
+        volatile uint32_t head; // Next slot reserved by a producer
+        volatile uint32_t tail; // Next slot written to the console
+        volatile uint64_t lost; // Messages dropped because the ring was full
+        klog_record_t     records[KLOG_RING_SIZE];
+} klog_ring_t;
+
+/* Bounded destination of the message formatting */
+typedef struct {
+        char    *buf;  // Record text
+        uint32_t len;  // Characters stored
+        char     last; // Last character of the message, stored or not
+} klog_text_t;
+
+extern spinlock_t printk_lock;
+extern spinlock_t tty_flush_spinlock;
+
+static klog_ring_t           klog_boot_ring; // Shared by every CPU until the per-CPU rings exist
+static klog_ring_t *volatile klog_rings = 0;
+static uint32_t              klog_ring_count;
+static volatile uint8_t      klog_async    = 0; // Output is deferred to the consumer CPU
+static volatile uint8_t      klog_draining = 0; // A CPU is writing to the console
+static uint32_t              klog_consumer;
+static work_t                klog_work;
+static volatile int          klog_console_level = -1; // -1 until "loglevel=" was parsed
+static volatile int64_t      klog_panic_cpu     = -1; // CPU that took the console over on panic (-1 if none)
+
+/* Get the ring of the current CPU */
+static klog_ring_t *klog_this_ring(void)
+{
+    klog_ring_t *rings = klog_rings;
+    if (!rings) return &klog_boot_ring;
+
+    uint32_t cpu = get_current_cpu_id();
+    return cpu < klog_ring_count ? &rings[cpu] : &klog_boot_ring;
+}
+
+/* Get a ring by index, index 0 is the boot ring and index n the ring of CPU n - 1 */
+static klog_ring_t *klog_ring(uint32_t index)
+{
+    return index ? &klog_rings[index - 1] : &klog_boot_ring;
+}
+
+/* Store a character of the message, the rest of a long message is dropped (the last byte is kept for its newline) */
+static uint8_t klog_text_write(writer *writer, char c)
+{
+    klog_text_t *text = (klog_text_t *)writer->data;
+    text->last        = c;
+    if (text->len >= KLOG_TEXT_SIZE - 1) return 0;
+    text->buf[text->len++] = c;
+    return 1;
+}
+
+/* Store a slice of the message, the rest of a long message is dropped (the last byte is kept for its newline) */
+static size_t klog_text_write_span(writer *writer, const char *str, size_t len)
+{
+    klog_text_t *text = (klog_text_t *)writer->data;
+    if (len) text->last = str[len - 1];
+    if (len > KLOG_TEXT_SIZE - 1 - text->len) len = KLOG_TEXT_SIZE - 1 - text->len;
+    memcpy(text->buf + text->len, str, len);
+    text->len += len;
+    return len;
+}
+
+/* Reserve a slot, returns its position or -1 if the ring is full */
+static int64_t klog_reserve(klog_ring_t *ring)
+{
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    do {
+        if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >= KLOG_RING_SIZE) return -1;
+    } while (!__atomic_compare_exchange_n(&ring->head, &head, head + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    return head;
+}
+
+/* Set the most verbose level written to the console */
+void klog_set_console_level(klog_level_t level)
+{
+    klog_console_level = level > KLOG_DEBUG ? KLOG_DEBUG : level;
+}
+
+/* Get the most verbose level written to the console ("loglevel=", KLOG_INFO by default) */
+klog_level_t klog_get_console_level(void)
+{
+    if (klog_console_level < 0) {
+        const char *value;
+        int         level = KLOG_INFO;
+
+        if (cmdline_get_arg("loglevel", &value) == 1 && value[0] >= '0' && value[0] <= '7') level = value[0] - '0';
+        klog_console_level = level;
+    }
+    return (klog_level_t)klog_console_level;
+}
+
+/* Format a message into the log ring of the current CPU, from a cached format if `cache` is set */
+static void klog_vformat(klog_level_t level, uint8_t flags, fmt_cache_t *cache, const char *format, va_list args)
+{
+    klog_ring_t *ring = klog_this_ring();
+    int64_t      pos  = klog_reserve(ring);
+
+    /* Without a consumer the producer empties the ring itself */
+    if (pos < 0 && !klog_async) {
+        klog_flush();
+        pos = klog_reserve(ring);
+    }
+    if (pos < 0) {
+        __atomic_fetch_add(&ring->lost, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    /* The slot is private until seq is published, an interrupt logging meanwhile takes the next one */
+    klog_record_t *record = &ring->records[pos & (KLOG_RING_SIZE - 1)];
+    klog_text_t    text   = {.buf = record->text, .len = 0, .last = 0};
+    writer         out    = {.data = &text, .handler = klog_text_write, .span = klog_text_write_span};
+
+    /* klog_dump() may still be reading the message this slot held */
+    __atomic_store_n(&record->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    if (level > klog_get_console_level()) flags |= KLOG_SUPPRESSED;
+    record->ns    = nano_time();
+    record->cpu   = klog_rings ? get_current_cpu_id() : 0;
+    record->level = level;
+    record->flags = flags;
+    if (cache)
+        vwprintf_cached(&out, cache, args);
+    else
+        vwprintf(&out, format, args);
+
+    /* A truncated line still ends the console line */
+    if (text.last == '\n' && (!text.len || text.buf[text.len - 1] != '\n')) text.buf[text.len++] = '\n';
+    record->len = text.len;
+    __atomic_store_n(&record->seq, (uint64_t)pos + 1, __ATOMIC_RELEASE);
+
+    if (klog_async)
+        work_queue_on(klog_consumer, &klog_work);
+    else
+        klog_flush();
+}
+
+/* Format a message into the log ring of the current CPU */
+void klog_vwrite(klog_level_t level, uint8_t flags, const char *format, va_list args)
+{
+    klog_vformat(level, flags, 0, format, args);
+}
+
+/* Log a message without rate limiting */
+static void klog_note(klog_level_t level, uint8_t flags, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    klog_vwrite(level, flags, format, args);
+    va_end(args);
+}
+
+/* Take a token from a call site bucket, returns 0 if the bucket is empty */
+static int klog_ratelimit(klog_ratelimit_t *limit)
+{
+    uint64_t now = nano_time() / 1000000 + 1;
+
+    /* Updated without a lock, concurrent callers only blur the limit */
+    if (!limit->stamp) {
+        limit->stamp  = now;
+        limit->tokens = KLOG_RATE_BURST;
+    } else if (now - limit->stamp >= KLOG_RATE_INTERVAL_MS) {
+        uint64_t earned = (now - limit->stamp) / KLOG_RATE_INTERVAL_MS;
+        limit->tokens   = limit->tokens + earned > KLOG_RATE_BURST ? KLOG_RATE_BURST : limit->tokens + earned;
+        limit->stamp += earned * KLOG_RATE_INTERVAL_MS;
+    }
+    if (!limit->tokens) return 0;
+    limit->tokens--;
+    return 1;
+}
+
+/* Log a message if the call site has tokens left, otherwise keep it in the ring only */
+void klog_write(klog_ratelimit_t *limit, klog_level_t level, fmt_cache_t *format, ...)
+{
+    uint8_t flags = 0;
+
+    /* Messages the console filters out do not use up tokens */
+    if (level <= klog_get_console_level()) {
+        if (!klog_ratelimit(limit)) {
+            limit->missed++;
+            flags = KLOG_SUPPRESSED;
+        } else if (limit->missed) {
+            klog_note(level, 0, "klog: %u messages suppressed by rate limiting.\n", limit->missed);
+            limit->missed = 0;
+        }
+    }
+
+    va_list args;
+    va_start(args, format);
+    klog_vformat(level, flags, format, 0, args);
+    va_end(args);
+}
+
+/* Find the oldest complete message of all rings, returns 0 if there is none */
+static klog_ring_t *klog_oldest(void)
+{
+    klog_ring_t *oldest = 0;
+    uint64_t     ns     = 0;
+    uint32_t     count  = klog_rings ? klog_ring_count + 1 : 1;
+
+    for (uint32_t i = 0; i < count; i++) {
+        klog_ring_t   *ring   = klog_ring(i);
+        uint32_t       tail   = ring->tail;
+        klog_record_t *record = &ring->records[tail & (KLOG_RING_SIZE - 1)];
+
+        /* A ring stops at its first message still being written */
+        if (tail == __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE)) continue;
+        if (__atomic_load_n(&record->seq, __ATOMIC_ACQUIRE) != (uint64_t)tail + 1) continue;
+        if (!oldest || record->ns < ns) {
+            oldest = ring;
+            ns     = record->ns;
+        }
+    }
+    return oldest;
+}
+
+/* Check if the current CPU may write to the console, after a panic only the panicking CPU does */
+static int klog_console_owned(void)
+{
+    int64_t owner = klog_panic_cpu;
+    return owner < 0 || owner == get_current_cpu_id();
+}
+
+/* Write a line to the console */
+static void klog_output(const char *line)
+{
+    spin_lock(&printk_lock);
+    tty_print_str(line);
+    spin_unlock(&printk_lock);
+}
+
+/* Write the complete messages to the console in time order (called by the draining CPU only) */
+static uint64_t klog_drain(void)
+{
+    static fmt_cache_t stamp_format = FMT_CACHE_INIT("[%5llu.%06llu] ");
+    static fmt_cache_t lost_format  = FMT_CACHE_INIT("klog: %llu messages lost.\n");
+    char               line[KLOG_TEXT_SIZE + 32];
+    uint64_t           written = 0;
+
+    for (klog_ring_t *ring; klog_console_owned() && (ring = klog_oldest()); written++) {
+        uint32_t      tail   = ring->tail;
+        klog_record_t record = ring->records[tail & (KLOG_RING_SIZE - 1)];
+        __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+        if (record.flags & KLOG_SUPPRESSED) continue;
+
+        int len = snprintf_cached(line, sizeof(line) - KLOG_TEXT_SIZE, &stamp_format, record.ns / 1000000000,
+                                  (record.ns / 1000) % 1000000);
+        memcpy(line + len, record.text, record.len);
+        line[len + record.len] = '\0';
+        klog_output(line);
+    }
+
+    uint32_t count = klog_rings ? klog_ring_count + 1 : 1;
+    for (uint32_t i = 0; i < count; i++) {
+        uint64_t lost = __atomic_exchange_n(&klog_ring(i)->lost, 0, __ATOMIC_RELAXED);
+        if (!lost) continue;
+        snprintf_cached(line, sizeof(line), &lost_format, lost);
+        klog_output(line);
+    }
+    return written;
+}
+
+/* Copy a message of the history, returns 0 if the slot was reused meanwhile */
+static int klog_history_read(klog_ring_t *ring, uint32_t pos, klog_record_t *record)
+{
+    klog_record_t *slot = &ring->records[pos & (KLOG_RING_SIZE - 1)];
+
+    if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != (uint64_t)pos + 1) return 0;
+    *record = *slot;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == (uint64_t)pos + 1;
+}
+
+/* Print the messages still held by the rings up to a level, including the suppressed ones */
+void klog_dump(klog_level_t level)
+{
+    static fmt_cache_t header_format = FMT_CACHE_INIT("[%5llu.%06llu] CPU %03u <%u>%c");
+    uint32_t           count         = klog_rings ? klog_ring_count + 1 : 1;
+    char               line[KLOG_TEXT_SIZE + 40];
+
+    klog_flush();
+    for (uint32_t i = 0; i < count; i++) {
+        klog_ring_t *ring = klog_ring(i);
+        uint32_t     tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        uint32_t     head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+        /* Written messages stay in their slots until producers reuse them */
+        for (uint32_t pos = head - KLOG_RING_SIZE; pos != tail; pos++) {
+            klog_record_t record;
+            if (!klog_history_read(ring, pos, &record) || record.level > level) continue;
+
+            /* '*' marks the messages the console did not show */
+            int len = snprintf_cached(line, sizeof(line) - KLOG_TEXT_SIZE, &header_format, record.ns / 1000000000,
+                                      (record.ns / 1000) % 1000000, record.cpu, record.level,
+                                      record.flags & KLOG_SUPPRESSED ? '*' : ' ');
+            memcpy(line + len, record.text, record.len);
+            line[len + record.len] = '\0';
+            klog_output(line);
+        }
+    }
+}
+
+/* Write the buffered messages to the console, returns the number of messages written */
+uint64_t klog_flush(void)
+{
+    uint64_t written = 0;
+
+    if (!klog_console_owned()) return 0;
+
+    /* A message completed after the drain looked at its ring is picked up by another round */
+    do {
+        if (__atomic_exchange_n(&klog_draining, 1, __ATOMIC_ACQUIRE)) break;
+        written += klog_drain();
+        __atomic_store_n(&klog_draining, 0, __ATOMIC_RELEASE);
+    } while (klog_oldest());
+    return written;
+}
+
+/* Run the console output on the consumer CPU */
+static void klog_work_func(work_t *work)
+{
+    (void)work;
+    klog_flush();
+}
+
+/* Switch to synchronous output and write out everything buffered (called on panic) */
+void klog_panic(void)
+{
+    klog_async     = 0;
+    klog_panic_cpu = get_current_cpu_id();
+
+    /*
+     * The consumer stops at its next message. If it is stuck on a dead CPU, or this CPU panicked inside the
+     * console, the locks below are never released, so take them over after a while.
+     */
+    for (uint32_t i = 0; i < KLOG_PANIC_SPIN && klog_draining; i++) __asm__ volatile("pause");
+    __atomic_store_n(&klog_draining, 0, __ATOMIC_RELEASE);
+    spin_lock_reset(&printk_lock);
+    spin_lock_reset(&tty_flush_spinlock);
+    klog_flush();
+}
+
+/* Allocate the per-CPU rings and hand the console output to an AP */
+void klog_init(void)
+{
+    uint32_t     count = get_cpu_count() ? get_cpu_count() : 1;
+    klog_ring_t *rings = (klog_ring_t *)malloc(sizeof(klog_ring_t) * count);
+    if (!rings) {
+        plogk("klog: Failed to allocate per-CPU log rings.\n");
+        return;
+    }
+    memset(rings, 0, sizeof(klog_ring_t) * count);
+    klog_ring_count = count;
+    __asm__ volatile("" ::: "memory");
+    klog_rings = rings;
+
+    /* The boot CPU halts after initialization, a single CPU system keeps the synchronous output */
+    if (count < 2) return;
+    work_setup(&klog_work, klog_work_func, 0);
+    klog_consumer = 1;
+    klog_async    = 1;
+    plogk("klog: %u per-CPU log rings, console output runs on CPU %u.\n", count, klog_consumer);
+}
@@ -10,6 +10,7 @@
  */
 
 #include "printk.h"
+#include "klog.h"
 #include "spin_lock.h"
 #include "stdarg.h"
 #include "stddef.h"
@@ -18,10 +19,6 @@
 #include "string.h"
 #include "tty.h"
 
-#ifdef KERNEL_LOG
-#    include "acpi.h"
-#endif
-
 #define BUF_SIZE 2048 // least 2 bytes (1 byte is for '\0')
 
 /* Lock for printk */
@@ -30,12 +27,6 @@ spinlock_t printk_lock = {
     .rflags = 0,
 };
 
-/* Lock for plogk */
-spinlock_t plogk_lock = {
-    .lock   = 0,
-    .rflags = 0,
-};
-
 /* Kernel print string */
 void printk(const char *format, ...)
 {
@@ -51,13 +42,10 @@ void printk(const char *format, ...)
 void plogk(const char *format, ...)
 {
 #if KERNEL_LOG
-    spin_lock(&plogk_lock); // Lock
-    printk("[%5d.%06d] ", nano_time() / 1000000000, (nano_time() / 1000) % 1000000);
     va_list args;
     va_start(args, format);
-    vwprintf(&tty_writer, format, args);
+    klog_vwrite(KLOG_INFO, 0, format, args);
     va_end(args);
-    spin_unlock(&plogk_lock); // Unlock
 #else
     (void)format;
 #endif
@@ -72,6 +60,15 @@ uint8_t unsafe_buf_write(writer *writer, char c)
     return 1; // Always success? :(
 }
 
+/* Handler of unsafe buf slice writing */
+size_t unsafe_buf_write_span(writer *writer, const char *str, size_t len)
+{
+    unsafe_buf_data *data = (unsafe_buf_data *)writer->data;
+    memcpy(data->buf + data->idx, str, len);
+    data->idx += len;
+    return len;
+}
+
 /* Store the formatted output in a character array */
 int sprintf(char *str, const char *fmt, ...)
 {
@@ -80,11 +77,13 @@ int sprintf(char *str, const char *fmt, ...)
     writer          unsafe_buf_writer = {
                  .data    = &unsafe_buf_data,
                  .handler = unsafe_buf_write,
+                 .span    = unsafe_buf_write_span,
     };
     va_list arg;
     va_start(arg, fmt);
 
-    c = (int)vwprintf(&unsafe_buf_writer, fmt, arg); // NOLINT
+    c      = (int)vwprintf(&unsafe_buf_writer, fmt, arg); // NOLINT
+    str[c] = '\0';
 
     va_end(arg);
     return c;
@@ -98,287 +97,308 @@ int vsprintf(char *str, const char *fmt, va_list args)
     writer          unsafe_buf_writer = {
                  .data    = &unsafe_buf_data,
                  .handler = unsafe_buf_write,
+                 .span    = unsafe_buf_write_span,
     };
-    c = (int)vwprintf(&unsafe_buf_writer, fmt, args); // NOLINT
+    c      = (int)vwprintf(&unsafe_buf_writer, fmt, args); // NOLINT
+    str[c] = '\0';
     return c;
 }
 
-typedef enum num_size {
-    HALF_2 = 0, // char
-    HALF_1 = 1, // short
-    INT    = 2, // int
-    LONG_1 = 3, // long
-    LONG_2 = 4, // long long
-    SIZE_T = 5, // size_t
-} num_size_t;
+/* Handler of bounded buf writing, characters past the end are counted but dropped */
+uint8_t bounded_buf_write(writer *writer, char c)
+{
+    bounded_buf_data *data = (bounded_buf_data *)writer->data;
+    if (data->idx + 1 < data->size) data->buf[data->idx] = c;
+    ++data->idx;
+    return 1;
+}
 
-/* Formatted output processing */
-void wfmt_arg(writer *writer, args_fmter *fmter, va_list args) // NOLINT
+/* Handler of bounded buf slice writing, characters past the end are counted but dropped */
+size_t bounded_buf_write_span(writer *writer, const char *str, size_t len)
 {
-    char         *str           = 0; // for `%s`
-    size_t        write_counter = 0;
-    size_t        str_len       = 0; // for align `%s`
-    const char  **fmt_ptr       = fmter->fmt_ptr;
-    write_handler write         = writer->handler;
+    bounded_buf_data *data = (bounded_buf_data *)writer->data;
+    if (data->idx + 1 < data->size) {
+        size_t room = data->size - 1 - data->idx;
+        memcpy(data->buf + data->idx, str, len < room ? len : room);
+    }
+    data->idx += len;
+    return len;
+}
 
-    num_formatter_t num_fmter = {};
-    num_fmt_type    num_flag  = {};
-    int8_t          size_cnt  = INT;
+/* Terminate a bounded buf, returns the length the whole output needed */
+static int bounded_buf_finish(bounded_buf_data *data)
+{
+    if (data->size) data->buf[data->idx < data->size ? data->idx : data->size - 1] = '\0';
+    return (int)data->idx;
+}
 
-    /* Error args */
-    if (!writer || !write || !fmt_ptr || !(*fmt_ptr) || **fmt_ptr != '%') return;
+/* Format with va_list into at most `size` bytes (including the '\0'), returns the length the whole output needs */
+int vsnprintf(char *str, size_t size, const char *fmt, va_list args)
+{
+    bounded_buf_data bounded_buf_data   = {.buf = str, .size = size, .idx = 0};
+    writer           bounded_buf_writer = {
+                  .data    = &bounded_buf_data,
+                  .handler = bounded_buf_write,
+                  .span    = bounded_buf_write_span,
+    };
+    vwprintf(&bounded_buf_writer, fmt, args);
+    return bounded_buf_finish(&bounded_buf_data);
+}
+
+/* Store the formatted output in at most `size` bytes (including the '\0'), returns the length the whole output needs */
+int snprintf(char *str, size_t size, const char *fmt, ...)
+{
+    va_list arg;
+    va_start(arg, fmt);
+    int c = vsnprintf(str, size, fmt, arg);
+    va_end(arg);
+    return c;
+}
+
+/* vsnprintf() with a format parsed once into a cache */
+int vsnprintf_cached(char *str, size_t size, fmt_cache_t *cache, va_list args)
+{
+    bounded_buf_data bounded_buf_data   = {.buf = str, .size = size, .idx = 0};
+    writer           bounded_buf_writer = {
+                  .data    = &bounded_buf_data,
+                  .handler = bounded_buf_write,
+                  .span    = bounded_buf_write_span,
+    };
+    vwprintf_cached(&bounded_buf_writer, cache, args);
+    return bounded_buf_finish(&bounded_buf_data);
+}
 
-    while (1) {
-        ++(*fmt_ptr); // Skip '%' or any flags
+/* snprintf() with a format parsed once into a cache */
+int snprintf_cached(char *str, size_t size, fmt_cache_t *cache, ...)
+{
+    va_list arg;
+    va_start(arg, cache);
+    int c = vsnprintf_cached(str, size, cache, arg);
+    va_end(arg);
+    return c;
+}
+
+/* Parse a conversion specification, `*fmt_ptr` points at the '%' and is left at the conversion character */
+static void fmt_parse(const char **fmt_ptr, fmt_op_t *op)
+{
+    *op = (fmt_op_t) {.size_cnt = INT};
+    ++(*fmt_ptr); // Skip '%'
+
+    /* Flags */
+    for (;; ++(*fmt_ptr)) {
         switch (**fmt_ptr) {
             case '-' :
-                num_flag.left = 1;
-                break;
+                op->flags.left = 1;
+                continue;
             case '+' :
-                num_flag.plus = 1;
-                break;
+                op->flags.plus = 1;
+                continue;
             case ' ' :
-                num_flag.space = 1;
-                break;
+                op->flags.space = 1;
+                continue;
             case '#' :
-                num_flag.special = 1;
-                break;
+                op->flags.special = 1;
+                continue;
             case '0' :
-                num_flag.zeropad = 1;
-                break;
+                op->flags.zeropad = 1;
+                continue;
             default :
                 break;
         }
+        break;
+    }
+
+    /* Minimum field width */
+    if (IS_DIGIT(**fmt_ptr)) {
+        op->width = skip_atoi(fmt_ptr);
+    } else if (**fmt_ptr == '*') {
+        /* by the following argument */
+        ++(*fmt_ptr); // Skip '*'
+        op->star |= FMT_STAR_WIDTH;
+    }
 
-        /* Calc num_fmter.size */
+    /* Precision */
+    if (**fmt_ptr == '.') {
+        ++(*fmt_ptr); // Skip '.'
         if (IS_DIGIT(**fmt_ptr)) {
-            num_fmter.size = skip_atoi(fmt_ptr);
+            op->precision = skip_atoi(fmt_ptr);
         } else if (**fmt_ptr == '*') {
             /* by the following argument */
             ++(*fmt_ptr); // Skip '*'
-            num_fmter.size = (size_t)va_arg(args, int);
-        }
-
-        /* Calc num_fmter.precision */
-        if (**fmt_ptr == '.') {
-            ++(*fmt_ptr); // Skip '.'
-            if (IS_DIGIT(**fmt_ptr)) {
-                num_fmter.precision = skip_atoi(fmt_ptr);
-            } else if (**fmt_ptr == '*') {
-                /* by the following argument */
-                ++(*fmt_ptr); // Skip '*'
-                num_fmter.precision = (size_t)va_arg(args, int);
-            }
+            op->star |= FMT_STAR_PRECISION;
         }
+    }
 
-        /* Calc size_cnt */
+    /* Length modifier */
+    for (;; ++(*fmt_ptr)) {
         switch (**fmt_ptr) {
             case 'h' :
-                size_cnt--;
-                if (size_cnt < HALF_2) size_cnt = HALF_2; // hh
+                if (op->size_cnt > HALF_2) op->size_cnt--; // hh
                 continue;
-            case 'L' :      // += 2
-                size_cnt++; // fallthrough
+            case 'L' :          // += 2
+                op->size_cnt++; // fallthrough
             case 'l' :
-                size_cnt++;
-                if (size_cnt > LONG_2) size_cnt = LONG_2; // ll
+                op->size_cnt++;
+                if (op->size_cnt > LONG_2) op->size_cnt = LONG_2; // ll
                 continue;
             case 'z' :
-                size_cnt = SIZE_T; // z
+                op->size_cnt = SIZE_T; // z
                 continue;
             default :
                 break;
         }
+        break;
+    }
+    op->conv = **fmt_ptr;
+}
 
-        /* Read argument */
-        switch (**fmt_ptr) {
-            case 'c' :
-                num_fmter.num = va_arg(args, int);
-                break;
-            case 's' :
-                str                    = va_arg(args, char *);
-                static char null_str[] = "(null)";
-                if (str == 0) str = null_str;
-                break;
-            case 'd' :
-            case 'i' :
-                /* NOLINTBEGIN */
-                switch (size_cnt) {
-                    case HALF_2 :
-                        num_fmter.num = (size_t)(char)va_arg(args, int);
-                        break;
-                    case HALF_1 :
-                        num_fmter.num = (size_t)(short)va_arg(args, int);
-                        break;
-                    case INT :
-                        num_fmter.num = (size_t)(int)va_arg(args, int);
-                        break;
-                    case LONG_1 :
-                        num_fmter.num = (size_t)(long)va_arg(args, long);
-                        break;
-                    case LONG_2 :
-                        num_fmter.num = (size_t)(long long)va_arg(args, long long);
-                        break;
-                    case SIZE_T : // fallthrough
-                    default :
-                        num_fmter.num = va_arg(args, size_t);
-                        break;
-                }
-                /* NOLINTEND */
-                break;
-            case 'o' :
-            case 'x' :
-            case 'X' :
-            case 'b' :
-            case 'u' :
-                switch (size_cnt) {
-                    case HALF_2 :
-                        num_fmter.num = (size_t)(unsigned char)va_arg(args, int);
-                        break;
-                    case HALF_1 :
-                        num_fmter.num = (size_t)(unsigned short)va_arg(args, int);
-                        break;
-                    case INT :
-                        num_fmter.num = (size_t)(unsigned int)va_arg(args, int);
-                        break;
-                    case LONG_1 :
-                        num_fmter.num = (size_t)(unsigned long)va_arg(args, long);
-                        break;
-                    case LONG_2 :
-                        num_fmter.num = (size_t)(unsigned long long)va_arg(args, long long);
-                        break;
-                    case SIZE_T : // fallthrough
-                    default :
-                        num_fmter.num = va_arg(args, size_t);
-                        break;
-                }
-                break;
-            case 'p' :
-                num_fmter.num = (size_t)va_arg(args, void *);
-                break;
-            default : // may no data
-                break;
-        }
+/* Read a signed integer argument of a conversion */
+static size_t fmt_signed_arg(int8_t size_cnt, va_list args)
+{
+    /* NOLINTBEGIN */
+    switch (size_cnt) {
+        case HALF_2 :
+            return (size_t)(char)va_arg(args, int);
+        case HALF_1 :
+            return (size_t)(short)va_arg(args, int);
+        case INT :
+            return (size_t)(int)va_arg(args, int);
+        case LONG_1 :
+            return (size_t)(long)va_arg(args, long);
+        case LONG_2 :
+            return (size_t)(long long)va_arg(args, long long);
+        case SIZE_T : // fallthrough
+        default :
+            return va_arg(args, size_t);
+    }
+    /* NOLINTEND */
+}
 
-        /* Calc length of `%s` and set num_flag */
-        switch (**fmt_ptr) {
-            case 'c' :
-                break;
-            case 's' :
-                str_len = strlen(str);
-                if (num_fmter.size < str_len) num_fmter.size = str_len;
-                break;
-            case 'o' :
-                num_fmter.base = 8;
-                break;
-            case 'p' :
-                num_flag.small   = 1;
-                num_flag.special = 1;
-                num_flag.zeropad = 1;
-                if (num_fmter.size < 16) num_fmter.size = 16;
-                num_fmter.base = 16;
-                break;
-            case 'x' :
-                num_flag.small = 1; // fallthrough
-            case 'X' :
-                num_fmter.base = 16;
-                break;
-            case 'd' :
-            case 'i' :
-                num_flag.sign = 1; // fallthrough
-            case 'u' :
-                num_fmter.base = 10;
-                break;
-            case 'b' :
-                num_fmter.base = 2;
-                break;
-            case 'n' :
-                *(fmter->write_counter) += write_counter;
-                *(int *)va_arg(args, void *) = (int)*fmter->write_counter;
-                break;
-            case '%' :
-                break;
-            default :
-                /* Unexpected */
-                return;
+/* Read an unsigned integer argument of a conversion */
+static size_t fmt_unsigned_arg(int8_t size_cnt, va_list args)
+{
+    switch (size_cnt) {
+        case HALF_2 :
+            return (size_t)(unsigned char)va_arg(args, int);
+        case HALF_1 :
+            return (size_t)(unsigned short)va_arg(args, int);
+        case INT :
+            return (size_t)(unsigned int)va_arg(args, int);
+        case LONG_1 :
+            return (size_t)(unsigned long)va_arg(args, long);
+        case LONG_2 :
+            return (size_t)(unsigned long long)va_arg(args, long long);
+        case SIZE_T : // fallthrough
+        default :
+            return va_arg(args, size_t);
+    }
+}
+
+/* Convert the argument of a parsed conversion and write it, `written` is the output so far (for `%n`) */
+static size_t fmt_emit(writer *writer, const fmt_op_t *op, size_t written, va_list args) // NOLINT
+{
+    num_formatter_t num_fmter = {.size = op->width, .precision = op->precision};
+    num_fmt_type    num_flag  = op->flags;
+
+    if (op->star & FMT_STAR_WIDTH) num_fmter.size = (size_t)va_arg(args, int);
+    if (op->star & FMT_STAR_PRECISION) num_fmter.precision = (size_t)va_arg(args, int);
+
+    switch (op->conv) {
+        case 'c' : {
+            char   ch  = (char)va_arg(args, int);
+            size_t pad = num_fmter.size > 1 ? num_fmter.size - 1 : 0;
+
+            /* Right align */
+            if (!(num_flag.left)) writer_fill(writer, ' ', pad);
+
+            /* Write char */
+            writer->handler(writer, ch);
+
+            /* Left align */
+            if (num_flag.left) writer_fill(writer, ' ', pad);
+            return pad + 1;
         }
+        case 's' : {
+            const char *str = va_arg(args, const char *);
+            if (str == 0) str = "(null)";
 
-        /* Write to arg space */
-        switch (**fmt_ptr) {
-            case 'c' :
-                /* Right align */
-                if (!(num_flag.left)) {
-                    while (write_counter < num_fmter.size - 1) {
-                        write(writer, ' ');
-                        ++write_counter;
-                    }
-                }
-
-                /* Write char */
-                write(writer, (char)num_fmter.num);
-
-                /* Left align */
-                if (num_flag.left) {
-                    while (write_counter < num_fmter.size - 1) {
-                        write(writer, ' ');
-                        ++write_counter;
-                    }
-                }
-                break;
-            case 's' :
-
-                /* Right align */
-                if (!(num_flag.left)) {
-                    while (write_counter < num_fmter.size - str_len) {
-                        write(writer, ' ');
-                        ++write_counter;
-                    }
-                    str_len = num_fmter.size;
-                }
-
-                /* Write string */
-                while (write_counter < str_len) {
-                    write(writer, *str);
-                    ++str;
-                    ++write_counter;
-                }
-
-                /* Left align */
-                if (num_flag.left) {
-                    while (write_counter < num_fmter.size - str_len) {
-                        write(writer, ' ');
-                        ++write_counter;
-                    }
-                }
-                break;
-            case 'o' : // fallthrough
-            case 'p' : // fallthrough
-            case 'x' : // fallthrough
-            case 'X' : // fallthrough
-            case 'd' : // fallthrough
-            case 'i' : // fallthrough
-            case 'u' : // fallthrough
-            case 'b' :
-                write_counter += wnumber(writer, num_fmter, num_flag);
-                break; // Format number with `writer`
-            case '%' :
-                write(writer, '%');
-                break;
-            default :
-                break;
+            size_t str_len = strlen(str);
+            size_t pad     = num_fmter.size > str_len ? num_fmter.size - str_len : 0;
+
+            /* Right align */
+            if (!(num_flag.left)) writer_fill(writer, ' ', pad);
+
+            /* Write string */
+            writer_write(writer, str, str_len);
+
+            /* Left align */
+            if (num_flag.left) writer_fill(writer, ' ', pad);
+            return str_len + pad;
         }
-        break;
+        case 'o' :
+            num_fmter.num  = fmt_unsigned_arg(op->size_cnt, args);
+            num_fmter.base = 8;
+            break;
+        case 'p' :
+            num_fmter.num    = (size_t)va_arg(args, void *);
+            num_flag.small   = 1;
+            num_flag.special = 1;
+            num_flag.zeropad = 1;
+            if (num_fmter.size < 16) num_fmter.size = 16;
+            num_fmter.base = 16;
+            break;
+        case 'x' :
+            num_flag.small = 1; // fallthrough
+        case 'X' :
+            num_fmter.num  = fmt_unsigned_arg(op->size_cnt, args);
+            num_fmter.base = 16;
+            break;
+        case 'd' :
+        case 'i' :
+            num_fmter.num  = fmt_signed_arg(op->size_cnt, args);
+            num_flag.sign  = 1;
+            num_fmter.base = 10;
+            break;
+        case 'u' :
+            num_fmter.num  = fmt_unsigned_arg(op->size_cnt, args);
+            num_fmter.base = 10;
+            break;
+        case 'b' :
+            num_fmter.num  = fmt_unsigned_arg(op->size_cnt, args);
+            num_fmter.base = 2;
+            break;
+        case 'n' :
+            *(int *)va_arg(args, void *) = (int)written;
+            return 0;
+        case '%' :
+            writer->handler(writer, '%');
+            return 1;
+        default :
+            /* Unexpected */
+            return 0;
     }
-    *(fmter->write_counter) += write_counter;
+    return wnumber(writer, num_fmter, num_flag); // Format number with `writer`
+}
+
+/* Formatted output processing */
+void wfmt_arg(writer *writer, args_fmter *fmter, va_list args) // NOLINT
+{
+    const char **fmt_ptr = fmter->fmt_ptr;
+    fmt_op_t     op;
+
+    /* Error args */
+    if (!writer || !writer->handler || !fmt_ptr || !(*fmt_ptr) || **fmt_ptr != '%') return;
+
+    fmt_parse(fmt_ptr, &op);
+    *(fmter->write_counter) += fmt_emit(writer, &op, *(fmter->write_counter), args);
     /* Unnecessary to update `fmt_ptr` */
 }
 
 /* Use a `writer` to write formatted string */
 size_t vwprintf(writer *writer, const char *fmt, va_list args)
 {
-    const char   *fmt_ptr = fmt;
-    size_t        result  = 0;
-    write_handler write   = writer->handler;
+    const char *fmt_ptr = fmt;
+    size_t      result  = 0;
 
     args_fmter fmter = {
         .fmt_ptr       = &fmt_ptr,
@@ -387,15 +407,70 @@ size_t vwprintf(writer *writer, const char *fmt, va_list args)
 
     while (*fmt_ptr != '\0') {
         if (*fmt_ptr != '%') {
-            write(writer, *fmt_ptr); // TODO: Catch Error
-            fmt_ptr++;
-            result++;
+            /* The literal text up to the next conversion goes out as one slice */
+            const char *literal = fmt_ptr;
+            while (*fmt_ptr != '\0' && *fmt_ptr != '%') fmt_ptr++;
+            writer_write(writer, literal, fmt_ptr - literal); // TODO: Catch Error
+            result += fmt_ptr - literal;
             continue;
         }
 
         /* *fmt_ptr == '%' */
         wfmt_arg(writer, &fmter, args); // NOLINT
-        fmt_ptr++;
+        if (*fmt_ptr != '\0') fmt_ptr++; // A '%' ending the format stops here
+    }
+    return result;
+}
+
+/* Parse a format into the op list of its cache, returns -1 if it does not fit */
+static int fmt_compile(fmt_cache_t *cache)
+{
+    const char *fmt_ptr = cache->fmt;
+    uint32_t    count   = 0;
+
+    while (*fmt_ptr != '\0') {
+        if (count == FMT_CACHE_OPS) return -1;
+        fmt_op_t *op = &cache->ops[count++];
+
+        if (*fmt_ptr != '%') {
+            /* A literal run keeps its offset and length in the width and precision */
+            const char *literal = fmt_ptr;
+            while (*fmt_ptr != '\0' && *fmt_ptr != '%') fmt_ptr++;
+            *op = (fmt_op_t) {.width = literal - cache->fmt, .precision = fmt_ptr - literal};
+            continue;
+        }
+        fmt_parse(&fmt_ptr, op);
+        if (*fmt_ptr != '\0') fmt_ptr++;
+    }
+    cache->count = count;
+    return 0;
+}
+
+/* Use a `writer` to write a formatted string, the format is parsed on first use only */
+size_t vwprintf_cached(writer *writer, fmt_cache_t *cache, va_list args)
+{
+    uint32_t state = __atomic_load_n(&cache->state, __ATOMIC_ACQUIRE);
+
+    /* One caller compiles, the others meanwhile take the slow path */
+    if (state == FMT_CACHE_EMPTY) {
+        uint32_t expected = FMT_CACHE_EMPTY;
+        if (__atomic_compare_exchange_n(&cache->state, &expected, FMT_CACHE_BUSY, 0, __ATOMIC_ACQUIRE,
+                                        __ATOMIC_RELAXED)) {
+            state = fmt_compile(cache) ? FMT_CACHE_UNFIT : FMT_CACHE_READY;
+            __atomic_store_n(&cache->state, state, __ATOMIC_RELEASE);
+        }
+    }
+    if (state != FMT_CACHE_READY) return vwprintf(writer, cache->fmt, args);
+
+    size_t result = 0;
+    for (uint32_t i = 0; i < cache->count; i++) {
+        const fmt_op_t *op = &cache->ops[i];
+        if (!op->conv) {
+            writer_write(writer, cache->fmt + op->width, op->precision);
+            result += op->precision;
+        } else {
+            result += fmt_emit(writer, op, result, args);
+        }
     }
     return result;
 }
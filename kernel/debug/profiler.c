@@ -0,0 +1,255 @@
+/*
+ *
+ *      profiler.c
+ *      Sampling profiler
+ *
+ *      2026/10/18 By MicroFish
+ *      Based on GPL-3.0 open source agreement
+ *      Copyright © 2020 ViudiraTech, based on the GPLv3 agreement.
+ *
+ */
+
+#include "profiler.h"
+#include "alloc.h"
+#include "cmdline.h"
+#include "pmu.h"
+#include "printk.h"
+#include "smp.h"
+#include "stdint.h"
+#include "stdlib.h"
+#include "string.h"
+#include "symbols.h"
+#include "timer.h"
+#include "uinxed.h"
+#include "workqueue.h"
+
+/* Per-CPU sample ring, filled by the NMI and drained by profiler_dump() */
+typedef struct {
+        volatile uint32_t head;     // Next slot written by the NMI
+        volatile uint32_t tail;     // Next slot read by the dump
+        volatile uint64_t lost;     // Samples dropped because the ring was full
+        volatile uint8_t  running;  // The profiler counter runs on this CPU
+        work_t            control;  // Starts or stops the counter on the CPU
+        uint64_t          samples[PROFILER_RING_SIZE];
+} profiler_cpu_t;
+
+/* Hits of one sampled address or function */
+typedef struct {
+        uint64_t    addr; // Sampled address, or function start once resolved
+        const char *name; // Function name (0 if unknown)
+        uint64_t    hits; // Number of samples
+} profiler_hit_t;
+
+static profiler_cpu_t *volatile profiler_cpus = 0;
+static uint32_t                 profiler_cpu_count;
+static pmu_event_t              profiler_event;
+static uint64_t                 profiler_period;
+static volatile uint8_t         profiler_enabled = 0;
+static volatile uint8_t         profiler_dumping = 0;
+static timer_t                  profiler_timer;
+
+/* Record a sample, returns 1 if the NMI came from the profiler counter */
+int profiler_nmi(interrupt_frame_t *frame)
+{
+    uint32_t cpu = get_current_cpu_id();
+    if (!profiler_cpus || cpu >= profiler_cpu_count || !profiler_cpus[cpu].running) return 0;
+    if (!pmu_counter_overflowed(PMU_COUNTER_PROFILER)) return 0;
+
+    profiler_cpu_t *ring = &profiler_cpus[cpu];
+    uint32_t        head = ring->head;
+
+    /* Single producer: only this CPU's NMI writes head, and NMIs do not nest */
+    if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) < PROFILER_RING_SIZE) {
+        ring->samples[head & (PROFILER_RING_SIZE - 1)] = frame->rip;
+        __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    } else {
+        ring->lost++;
+    }
+    pmu_counter_reload(PMU_COUNTER_PROFILER, profiler_period);
+    return 1;
+}
+
+/* Start or stop the profiler counter on the current CPU */
+static void profiler_cpu_control(work_t *work)
+{
+    profiler_cpu_t *ring = (profiler_cpu_t *)work->data;
+
+    if (profiler_enabled && !ring->running) {
+        if (!pmu_counter_start(PMU_COUNTER_PROFILER, profiler_event, profiler_period)) ring->running = 1;
+    } else if (!profiler_enabled && ring->running) {
+        ring->running = 0;
+        pmu_counter_stop(PMU_COUNTER_PROFILER);
+    }
+}
+
+/* Run profiler_cpu_control() on every CPU */
+static void profiler_control_all(void)
+{
+    for (uint32_t i = 0; i < profiler_cpu_count; i++) {
+        if (i == get_current_cpu_id())
+            profiler_cpu_control(&profiler_cpus[i].control);
+        else
+            work_queue_on(i, &profiler_cpus[i].control);
+    }
+}
+
+/* Start sampling on every CPU, returns 0 on success */
+int profiler_start(pmu_event_t event, uint64_t period)
+{
+    if (!pmu_event_supported(event) || pmu_get_counters() <= PMU_COUNTER_PROFILER) {
+        plogk("profiler: The requested event cannot be counted.\n");
+        return -1;
+    }
+    if (!profiler_cpus) {
+        uint32_t        count = get_cpu_count() ? get_cpu_count() : 1;
+        profiler_cpu_t *cpus  = (profiler_cpu_t *)malloc(sizeof(profiler_cpu_t) * count);
+        if (!cpus) {
+            plogk("profiler: Failed to allocate sample rings.\n");
+            return -1;
+        }
+        memset(cpus, 0, sizeof(profiler_cpu_t) * count);
+        for (uint32_t i = 0; i < count; i++) work_setup(&cpus[i].control, profiler_cpu_control, &cpus[i]);
+
+        profiler_cpu_count = count;
+        __asm__ volatile("" ::: "memory");
+        profiler_cpus = cpus;
+    }
+    profiler_event   = event;
+    profiler_period  = period > pmu_max_period() ? pmu_max_period() : period;
+    profiler_enabled = 1;
+    profiler_control_all();
+
+    plogk("profiler: Sampling %s every %llu events on %u CPUs.\n", event == PMU_EVENT_CYCLES ? "cycles" : "instructions",
+          profiler_period, profiler_cpu_count);
+    return 0;
+}
+
+/* Stop sampling on every CPU */
+void profiler_stop(void)
+{
+    if (!profiler_cpus) return;
+    profiler_enabled = 0;
+    profiler_control_all();
+}
+
+/* Find the slot of an address in the aggregation table, returns 0 if the table is full */
+static profiler_hit_t *profiler_hash_slot(profiler_hit_t *table, uint64_t addr)
+{
+    uint32_t index = (uint32_t)((addr * 0x9e3779b97f4a7c15ULL) >> 32) & (PROFILER_HASH_SIZE - 1);
+
+    for (uint32_t i = 0; i < PROFILER_HASH_SIZE; i++) {
+        profiler_hit_t *slot = &table[(index + i) & (PROFILER_HASH_SIZE - 1)];
+        if (!slot->hits || slot->addr == addr) return slot;
+    }
+    return 0;
+}
+
+/* Drain the sample rings and print the top functions, returns 0 on success */
+int profiler_dump(uint32_t top)
+{
+    if (!profiler_cpus || __atomic_exchange_n(&profiler_dumping, 1, __ATOMIC_ACQUIRE)) return -1;
+
+    profiler_hit_t *table = (profiler_hit_t *)malloc(sizeof(profiler_hit_t) * PROFILER_HASH_SIZE);
+    if (!table) {
+        __atomic_store_n(&profiler_dumping, 0, __ATOMIC_RELEASE);
+        return -1;
+    }
+    memset(table, 0, sizeof(profiler_hit_t) * PROFILER_HASH_SIZE);
+
+    /* Count hits per sampled address first, so that each address is symbolized only once */
+    uint64_t total = 0, lost = 0, dropped = 0;
+    for (uint32_t i = 0; i < profiler_cpu_count; i++) {
+        profiler_cpu_t *ring = &profiler_cpus[i];
+        uint32_t        head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+        for (uint32_t tail = ring->tail; tail != head; tail++) {
+            uint64_t        rip  = ring->samples[tail & (PROFILER_RING_SIZE - 1)];
+            profiler_hit_t *slot = profiler_hash_slot(table, rip);
+            if (slot) {
+                slot->addr = rip;
+                slot->hits++;
+            } else {
+                dropped++;
+            }
+            total++;
+        }
+        __atomic_store_n(&ring->tail, head, __ATOMIC_RELEASE);
+        lost += ring->lost;
+    }
+
+    /* Resolve the addresses and merge them into their functions, reusing the same table in place */
+    uint64_t *kernel_file = kernel_file_request.response->kernel_file->address;
+    uint32_t  functions   = 0;
+    for (uint32_t i = 0; i < PROFILER_HASH_SIZE; i++) {
+        if (!table[i].hits) continue;
+        sym_info_t sym = get_symbol_info(kernel_file, table[i].addr);
+        uint64_t   key = sym.name ? sym.addr : 0;
+
+        uint32_t j = 0;
+        while (j < functions && table[j].addr != key) j++;
+        if (j < functions) {
+            table[j].hits += table[i].hits;
+        } else {
+            uint64_t hits         = table[i].hits;
+            table[functions].addr = key;
+            table[functions].name = sym.name;
+            table[functions].hits = hits;
+            functions++;
+        }
+        if (i >= functions) table[i].hits = 0;
+    }
+
+    /* Selection of the top entries, the profile is short */
+    if (top > PROFILER_TOP_MAX) top = PROFILER_TOP_MAX;
+    if (top > functions) top = functions;
+    for (uint32_t i = 0; i < top; i++) {
+        uint32_t best = i;
+        for (uint32_t j = i + 1; j < functions; j++)
+            if (table[j].hits > table[best].hits) best = j;
+        profiler_hit_t swap = table[i];
+        table[i]            = table[best];
+        table[best]         = swap;
+    }
+
+    plogk("profiler: %llu samples, %llu lost, %llu unaggregated, %u functions.\n", total, lost, dropped, functions);
+    for (uint32_t i = 0; i < top; i++) {
+        uint64_t permille = total ? table[i].hits * 1000 / total : 0;
+        plogk("profiler: %8llu %3llu.%llu%% %s\n", table[i].hits, permille / 10, permille % 10,
+              table[i].name ? table[i].name : "[unknown]");
+    }
+
+    free(table);
+    __atomic_store_n(&profiler_dumping, 0, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/* Dump the profile collected since boot */
+static void profiler_timer_expired(timer_t *timer)
+{
+    (void)timer;
+    profiler_dump(PROFILER_TOP_MAX);
+}
+
+/* Start the profiler selected by "profile=cycles|instructions" and "profile_period=" */
+void profiler_init(void)
+{
+    const char *value;
+    pmu_event_t event;
+    uint64_t    period = PROFILER_DEFAULT_PERIOD;
+
+    if (cmdline_get_arg("profile", &value) < 0) return;
+    if (cmdline_arg_is("profile", "cycles")) {
+        event = PMU_EVENT_CYCLES;
+    } else if (cmdline_arg_is("profile", "instructions")) {
+        event = PMU_EVENT_INSTRUCTIONS;
+    } else {
+        plogk("profiler: Unknown event, expected \"cycles\" or \"instructions\".\n");
+        return;
+    }
+    if (cmdline_get_arg("profile_period", &value) > 0 && atoi(value) > 0) period = atoi(value);
+    if (profiler_start(event, period) < 0) return;
+
+    timer_setup(&profiler_timer, profiler_timer_expired, 0);
+    if (timer_add_on(TIMER_BACKGROUND_CPU, &profiler_timer, PROFILER_DUMP_MS) < 0)
+        plogk("profiler: No CPU to run the timed dump, call profiler_dump() instead.\n");
+}
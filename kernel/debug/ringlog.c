@@ -10,46 +10,123 @@
  */
 
 #include "ringlog.h"
+#include "cmdline.h"
 #include "printk.h"
-#include "string.h"
+#include "serial.h"
+#include "spin_lock.h"
+#include "stdarg.h"
+#include "stdlib.h"
 
-/* Initialize the ring log buffer */
-static void log_buffer_init(log_buffer_t *log)
+/* Get the record at a ring position */
+static log_record_t *log_record_at(log_buffer_t *log, uint64_t pos)
 {
-    memset(log, 0, sizeof(log_buffer_t));
-    log->head  = 0;
-    log->tail  = 0;
-    log->count = 0;
+    return (log_record_t *)&log->data[pos & (LOG_RING_SIZE - 1)];
+}
+
+/* Drop the oldest records until `size` bytes are free after the head */
+static void log_buffer_reserve(log_buffer_t *log, uint64_t size)
+{
+    while (log->head + size - log->tail > LOG_RING_SIZE) {
+        log_record_t *record = log_record_at(log, log->tail);
+        log->tail += record->size;
+        if (!(record->flags & LOG_RECORD_PAD)) log->first_seq++;
+    }
 }
 
 /* Write logs to the ring log buffer */
 void log_buffer_write(log_buffer_t *log, const char *fmt, ...)
 {
-    va_list args;
+    uint64_t reserve = ALIGN_UP(sizeof(log_record_t) + LOG_MAX_LENGTH, LOG_RECORD_ALIGN);
+    va_list  args;
+
+    spin_lock(&log->lock);
 
-    if (!log->count && !log->head && !log->tail) { log_buffer_init(log); }
-    memset(log->logs[log->head], 0, LOG_MAX_LENGTH);
+    /* Records never wrap, the rest of the ring is skipped by a filler */
+    uint64_t room = LOG_RING_SIZE - (log->head & (LOG_RING_SIZE - 1));
+    if (room < reserve) {
+        log_buffer_reserve(log, room);
+        log_record_t *pad = log_record_at(log, log->head);
+        pad->size         = room;
+        pad->len          = 0;
+        pad->flags        = LOG_RECORD_PAD;
+        pad->seq          = log->next_seq;
+        log->head += room;
+    }
+    log_buffer_reserve(log, reserve);
 
+    /* The message is formatted once, straight into its place in the ring */
+    log_record_t *record = log_record_at(log, log->head);
     va_start(args, fmt);
-    (void)vsprintf(log->logs[log->head], fmt, args);
+    int len = vsnprintf((char *)(record + 1), LOG_MAX_LENGTH, fmt, args);
     va_end(args);
+    if (len > LOG_MAX_LENGTH - 1) len = LOG_MAX_LENGTH - 1;
 
-    log->head = (log->head + 1) % LOG_BUFFER_SIZE;
+    record->size  = ALIGN_UP(sizeof(log_record_t) + len + 1, LOG_RECORD_ALIGN);
+    record->len   = len;
+    record->flags = 0;
+    record->seq   = log->next_seq++;
+    log->head += record->size;
+
+    spin_unlock(&log->lock);
+}
+
+/* Get the next record of a cursor, returns 0 at the end. The record stays in place until the writer reuses its space */
+const log_record_t *log_buffer_next(log_buffer_t *log, log_cursor_t *cursor)
+{
+    /* Overwritten records are skipped, dropping a filler moves the tail but not first_seq */
+    if (cursor->seq < log->first_seq || cursor->offset < log->tail) {
+        cursor->offset = log->tail;
+        cursor->seq    = log->first_seq;
+    }
 
-    if (log->count == LOG_BUFFER_SIZE) {
-        log->tail = (log->tail + 1) % LOG_BUFFER_SIZE;
-    } else {
-        log->count++;
+    while (cursor->offset != log->head) {
+        log_record_t *record = log_record_at(log, cursor->offset);
+        cursor->offset += record->size;
+        if (record->flags & LOG_RECORD_PAD) continue;
+        cursor->seq = record->seq + 1;
+        return record;
     }
+    return 0;
 }
 
 /* Printing ring log buffer */
 void log_buffer_print(log_buffer_t *log)
 {
-    int current = log->tail;
+    log_cursor_t        cursor = LOG_CURSOR_INIT;
+    const log_record_t *record;
 
-    for (int i = 0; i < log->count; i++) {
-        plogk("%s", log->logs[current]);
-        current = (current + 1) % LOG_BUFFER_SIZE;
-    }
+    while ((record = log_buffer_next(log, &cursor))) plogk("%s", log_record_text(record));
+}
+
+/* Stream the ring raw over a serial port for host-side decoding */
+void log_buffer_dump(log_buffer_t *log, uint16_t port)
+{
+    spin_lock(&log->lock);
+
+    log_dump_header_t header = {
+        .magic       = LOG_DUMP_MAGIC,
+        .version     = LOG_DUMP_VERSION,
+        .header_size = sizeof(log_record_t),
+        .bytes       = log->head - log->tail,
+        .reserved    = 0,
+        .first_seq   = log->first_seq,
+        .next_seq    = log->next_seq,
+    };
+    write_serial_span(port, (const char *)&header, sizeof(header));
+
+    /* Two slices if the records wrap around the end of the ring */
+    uint64_t start = log->tail & (LOG_RING_SIZE - 1);
+    uint64_t first = header.bytes < LOG_RING_SIZE - start ? header.bytes : LOG_RING_SIZE - start;
+    write_serial_span(port, (const char *)&log->data[start], first);
+    write_serial_span(port, (const char *)log->data, header.bytes - first);
+
+    spin_unlock(&log->lock);
+}
+
+/* Stream the ring raw to LOG_DUMP_PORT if "ringlog=raw" is on the command line */
+void log_buffer_export(log_buffer_t *log)
+{
+    if (!cmdline_arg_is("ringlog", "raw")) return;
+    log_buffer_dump(log, LOG_DUMP_PORT);
+    plogk("ringlog: Streamed %llu bytes of records to serial port %#x.\n", log->head - log->tail, LOG_DUMP_PORT);
 }
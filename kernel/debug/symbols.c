@@ -10,35 +10,82 @@
  */
 
 #include "symbols.h"
+#include "alloc.h"
 #include "limine.h"
+#include "printk.h"
 #include "string.h"
 #include "uinxed.h"
 
-/* Get symbol information */
-sym_info_t get_symbol_info(uint64_t *kernel_file_address, Elf64_Addr symbol_address)
+static sym_index_t *sym_index       = 0; // Function symbols sorted by address
+static size_t       sym_index_count = 0;
+static uint64_t    *sym_index_file  = 0; // Kernel file the index was built from
+
+/* Find the symbol and string tables of a kernel file, returns the number of symbols */
+static size_t symbols_find_tables(uint64_t *kernel_file_address, Elf64_Sym **sym, const char **strtab)
 {
-    sym_info_t  sym_info = {0, 0, 0};
     Elf64_Ehdr *ehdr     = (Elf64_Ehdr *)kernel_file_address;
     Elf64_Shdr *shdr     = (Elf64_Shdr *)((char *)kernel_file_address + ehdr->e_shoff);
     const char *shstrtab = (const char *)kernel_file_address + shdr[ehdr->e_shstrndx].sh_offset;
-
-    Elf64_Sym  *sym      = 0;
-    const char *strtab   = 0;
     size_t      sym_size = 0;
 
+    *sym    = 0;
+    *strtab = 0;
     for (size_t i = 0; i < ehdr->e_shnum; ++i) {
         const char *sh_name = shstrtab + shdr[i].sh_name;
         if (!strcmp(sh_name, ".symtab")) {
-            sym      = (Elf64_Sym *)((char *)kernel_file_address + shdr[i].sh_offset);
+            *sym     = (Elf64_Sym *)((char *)kernel_file_address + shdr[i].sh_offset);
             sym_size = shdr[i].sh_size / sizeof(Elf64_Sym);
         } else if (!strcmp(sh_name, ".strtab")) {
-            strtab = (const char *)kernel_file_address + shdr[i].sh_offset;
+            *strtab = (const char *)kernel_file_address + shdr[i].sh_offset;
         }
     }
+    return (*sym && *strtab) ? sym_size : 0;
+}
 
-    if (!sym || !strtab) return sym_info;
+/* Returns 1 if a function symbol covers a relative address */
+static int symbols_contains(Elf64_Addr start, Elf64_Xword size, Elf64_Addr relative_addr)
+{
+    return relative_addr >= start && (!size ? relative_addr == start : relative_addr < start + size);
+}
+
+/* Look a relative address up in the index */
+static sym_info_t symbols_index_lookup(Elf64_Addr relative_addr)
+{
+    sym_info_t sym_info = {0, 0, 0};
+    size_t     low      = 0;
+    size_t     high     = sym_index_count;
+
+    /* Find the last function starting at or before the address */
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (sym_index[mid].addr <= relative_addr)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    if (!low) return sym_info;
+
+    sym_index_t *entry = &sym_index[low - 1];
+    if (!symbols_contains(entry->addr, entry->size, relative_addr)) return sym_info;
+    sym_info.name = entry->name;
+    sym_info.addr = entry->addr;
+    sym_info.size = entry->size;
+    return sym_info;
+}
+
+/* Get symbol information */
+sym_info_t get_symbol_info(uint64_t *kernel_file_address, Elf64_Addr symbol_address)
+{
+    sym_info_t sym_info      = {0, 0, 0};
     Elf64_Addr relative_addr = symbol_address - kernel_address_request.response->virtual_base;
 
+    if (sym_index && kernel_file_address == sym_index_file) return symbols_index_lookup(relative_addr);
+
+    /* Slow path before the index is built */
+    Elf64_Sym  *sym;
+    const char *strtab;
+    size_t      sym_size = symbols_find_tables(kernel_file_address, &sym, &strtab);
+
     for (size_t i = 0; i < sym_size; ++i) {
         unsigned char type = ELF64_ST_TYPE(sym[i].st_info);
 
@@ -46,7 +93,7 @@ sym_info_t get_symbol_info(uint64_t *kernel_file_address, Elf64_Addr symbol_addr
         Elf64_Addr  sym_start    = sym[i].st_value;
         Elf64_Xword sym_size_val = sym[i].st_size;
 
-        if (relative_addr >= sym_start && (!sym_size_val ? relative_addr == sym_start : relative_addr < sym_start + sym_size_val)) {
+        if (symbols_contains(sym_start, sym_size_val, relative_addr)) {
             sym_info.name = strtab + sym[i].st_name;
             sym_info.addr = sym_start;
             sym_info.size = sym_size_val;
@@ -55,3 +102,74 @@ sym_info_t get_symbol_info(uint64_t *kernel_file_address, Elf64_Addr symbol_addr
     }
     return sym_info;
 }
+
+/* Sift an entry down the heap used to sort the index */
+static void symbols_sift_down(sym_index_t *heap, size_t root, size_t count)
+{
+    while (root * 2 + 1 < count) {
+        size_t child = root * 2 + 1;
+        if (child + 1 < count && heap[child + 1].addr > heap[child].addr) child++;
+        if (heap[root].addr >= heap[child].addr) return;
+
+        sym_index_t swap = heap[root];
+        heap[root]       = heap[child];
+        heap[child]      = swap;
+        root             = child;
+    }
+}
+
+/* Build the sorted function symbol index of the kernel */
+void symbols_init(void)
+{
+    uint64_t   *kernel_file = kernel_file_request.response->kernel_file->address;
+    Elf64_Sym  *sym;
+    const char *strtab;
+    size_t      sym_size  = symbols_find_tables(kernel_file, &sym, &strtab);
+    size_t      functions = 0;
+
+    for (size_t i = 0; i < sym_size; ++i)
+        if (ELF64_ST_TYPE(sym[i].st_info) == STT_FUNC) functions++;
+    if (!functions) {
+        plogk("symbols: No function symbols, backtraces will not be symbolized.\n");
+        return;
+    }
+
+    sym_index_t *index = (sym_index_t *)malloc(sizeof(sym_index_t) * functions);
+    if (!index) {
+        plogk("symbols: Failed to allocate the symbol index.\n");
+        return;
+    }
+
+    size_t count = 0;
+    for (size_t i = 0; i < sym_size; ++i) {
+        if (ELF64_ST_TYPE(sym[i].st_info) != STT_FUNC) continue;
+        index[count].addr = sym[i].st_value;
+        index[count].size = sym[i].st_size;
+        index[count].name = strtab + sym[i].st_name;
+        count++;
+    }
+
+    /* Heap sort, no allocation and no recursion */
+    for (size_t i = count / 2; i-- > 0;) symbols_sift_down(index, i, count);
+    for (size_t end = count; end-- > 1;) {
+        sym_index_t swap = index[0];
+        index[0]         = index[end];
+        index[end]       = swap;
+        symbols_sift_down(index, 0, end);
+    }
+
+    /* Keep one entry per address, preferring the one that has a size */
+    size_t unique = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (unique && index[unique - 1].addr == index[i].addr) {
+            if (index[i].size > index[unique - 1].size) index[unique - 1] = index[i];
+            continue;
+        }
+        index[unique++] = index[i];
+    }
+
+    sym_index_count = unique;
+    sym_index_file  = kernel_file;
+    sym_index       = index;
+    plogk("symbols: Indexed %llu function symbols.\n", unique);
+}
@@ -0,0 +1,196 @@
+/*
+ *
+ *      trace.c
+ *      Static tracepoints
+ *
+ *      2026/10/18 By MicroFish
+ *      Based on GPL-3.0 open source agreement
+ *      Copyright © 2020 ViudiraTech, based on the GPLv3 agreement.
+ *
+ */
+
+#include "trace.h"
+#include "alloc.h"
+#include "cmdline.h"
+#include "common.h"
+#include "printk.h"
+#include "serial.h"
+#include "smp.h"
+#include "stdint.h"
+#include "string.h"
+#include "timer.h"
+
+/* Per-CPU record ring, producers are the CPU itself (possibly nested in interrupts), the consumer is the stream */
+typedef struct {
+        volatile uint32_t head; // Next slot reserved by a producer
+        volatile uint32_t tail; // Next slot read by the stream
+        volatile uint64_t lost; // Records dropped because the ring was full
+        trace_record_t    records[TRACE_RING_SIZE];
+} trace_cpu_t;
+
+/* Names used by the decoder */
+typedef struct {
+        const char *name;                    // Event name
+        uint32_t    fields;                  // Number of fields
+        const char *field[TRACE_MAX_FIELDS]; // Field names
+} trace_desc_t;
+
+#define TRACE_DESC1(id, name, t0, f0)                 {#name, 1, {#f0}},
+#define TRACE_DESC2(id, name, t0, f0, t1, f1)         {#name, 2, {#f0, #f1}},
+#define TRACE_DESC3(id, name, t0, f0, t1, f1, t2, f2) {#name, 3, {#f0, #f1, #f2}},
+
+static const trace_desc_t trace_descs[TRACE_EVENT_COUNT] = {TRACE_EVENTS(TRACE_DESC1, TRACE_DESC2, TRACE_DESC3)};
+
+volatile uint64_t trace_mask = 0;
+
+static trace_cpu_t *volatile trace_cpus = 0;
+static uint32_t              trace_cpu_count;
+static volatile uint8_t      trace_streaming = 0;
+static timer_t               trace_timer;
+
+/* Record an event on the current CPU (use the trace_<name>() wrappers) */
+void trace_record(trace_event_t event, uint64_t arg0, uint64_t arg1, uint64_t arg2)
+{
+    trace_cpu_t *cpus = trace_cpus;
+    if (!cpus) return;
+
+    uint32_t cpu = get_current_cpu_id();
+    if (cpu >= trace_cpu_count) return;
+    trace_cpu_t *ring = &cpus[cpu];
+
+    /* An interrupt may record between the reservation and the commit, so the slot is claimed atomically */
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    do {
+        if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >= TRACE_RING_SIZE) {
+            __atomic_fetch_add(&ring->lost, 1, __ATOMIC_RELAXED);
+            return;
+        }
+    } while (!__atomic_compare_exchange_n(&ring->head, &head, head + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    trace_record_t *record = &ring->records[head & (TRACE_RING_SIZE - 1)];
+    record->tsc            = rdtsc();
+    record->event          = event;
+    record->cpu            = cpu;
+    record->args[0]        = arg0;
+    record->args[1]        = arg1;
+    record->args[2]        = arg2;
+    __atomic_store_n(&record->seq, (uint64_t)head + 1, __ATOMIC_RELEASE);
+}
+
+/* Enable or disable events by name, "all" selects every event, returns 0 on success */
+int trace_set_event(const char *name, size_t len, int enable)
+{
+    uint64_t bits = 0;
+
+    if (len == 3 && !memcmp(name, "all", 3)) {
+        bits = (1ULL << TRACE_EVENT_COUNT) - 1;
+    } else {
+        for (uint32_t i = 0; i < TRACE_EVENT_COUNT; i++) {
+            if (strlen(trace_descs[i].name) == len && !memcmp(trace_descs[i].name, name, len)) {
+                bits = 1ULL << i;
+                break;
+            }
+        }
+    }
+    if (!bits) return -1;
+
+    if (enable)
+        __atomic_fetch_or(&trace_mask, bits, __ATOMIC_RELAXED);
+    else
+        __atomic_fetch_and(&trace_mask, ~bits, __ATOMIC_RELAXED);
+    return 0;
+}
+
+/* Write a line to a serial port */
+static void trace_write(uint16_t port, const char *str, size_t len)
+{
+    write_serial_span(port, str, len);
+}
+
+/* Decode the records buffered on every CPU to a serial port */
+void trace_stream(uint16_t port)
+{
+    if (!trace_cpus || __atomic_exchange_n(&trace_streaming, 1, __ATOMIC_ACQUIRE)) return;
+
+    static fmt_cache_t head_format  = FMT_CACHE_INIT("trace: %llu cpu%u %s");
+    static fmt_cache_t field_format = FMT_CACHE_INIT(" %s=%#llx");
+    static fmt_cache_t lost_format  = FMT_CACHE_INIT("trace: cpu%u lost %llu records\r\n");
+    char               line[160];
+
+    for (uint32_t i = 0; i < trace_cpu_count; i++) {
+        trace_cpu_t *ring = &trace_cpus[i];
+        uint32_t     tail = ring->tail;
+        uint32_t     head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+        /* Stop at the first record still being written, it is picked up next time */
+        for (; tail != head; tail++) {
+            trace_record_t *slot = &ring->records[tail & (TRACE_RING_SIZE - 1)];
+            if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != (uint64_t)tail + 1) break;
+
+            trace_record_t record = *slot;
+            __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+            if (record.event >= TRACE_EVENT_COUNT) continue;
+
+            const trace_desc_t *desc = &trace_descs[record.event];
+            size_t              len  = snprintf_cached(line, sizeof(line), &head_format, record.tsc, record.cpu, desc->name);
+            for (uint32_t f = 0; f < desc->fields && len < sizeof(line); f++)
+                len += snprintf_cached(line + len, sizeof(line) - len, &field_format, desc->field[f], record.args[f]);
+            if (len > sizeof(line) - 3) len = sizeof(line) - 3;
+            len += snprintf(line + len, sizeof(line) - len, "\r\n");
+            trace_write(port, line, len);
+        }
+
+        uint64_t lost = __atomic_exchange_n(&ring->lost, 0, __ATOMIC_RELAXED);
+        if (lost) {
+            int len = snprintf_cached(line, sizeof(line), &lost_format, i, lost);
+            trace_write(port, line, len);
+        }
+    }
+    __atomic_store_n(&trace_streaming, 0, __ATOMIC_RELEASE);
+}
+
+/* Stream the rings and re-arm */
+static void trace_timer_expired(timer_t *timer)
+{
+    trace_stream(TRACE_STREAM_PORT);
+    timer_add(timer, TRACE_STREAM_MS);
+}
+
+/* Allocate the per-CPU rings and enable the events listed in "trace=" */
+void trace_init(void)
+{
+    const char *value;
+    int         len = cmdline_get_arg("trace", &value);
+
+    if (len <= 0) return;
+#if !KERNEL_TRACE
+    plogk("trace: Tracepoints are not compiled in, \"trace=\" is ignored.\n");
+    return;
+#endif
+
+    uint32_t     count = get_cpu_count() ? get_cpu_count() : 1;
+    trace_cpu_t *cpus  = (trace_cpu_t *)malloc(sizeof(trace_cpu_t) * count);
+    if (!cpus) {
+        plogk("trace: Failed to allocate trace rings.\n");
+        return;
+    }
+    memset(cpus, 0, sizeof(trace_cpu_t) * count);
+    trace_cpu_count = count;
+    __asm__ volatile("" ::: "memory");
+    trace_cpus = cpus;
+
+    /* Comma separated event names */
+    for (int start = 0, end = 0; start < len; start = end + 1) {
+        end = start;
+        while (end < len && value[end] != ',') end++;
+        if (end > start && trace_set_event(value + start, end - start, 1) < 0)
+            plogk("trace: Unknown event in \"trace=\", ignored.\n");
+    }
+    if (!trace_mask) return;
+
+    timer_setup(&trace_timer, trace_timer_expired, 0);
+    if (timer_add_on(TIMER_BACKGROUND_CPU, &trace_timer, TRACE_STREAM_MS) < 0)
+        plogk("trace: No CPU to run the timed stream, call trace_stream() instead.\n");
+    plogk("trace: Tracing event mask %#llx on %u CPUs, streaming to serial port %#x.\n", trace_mask, count,
+          TRACE_STREAM_PORT);
+}
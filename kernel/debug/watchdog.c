@@ -0,0 +1,167 @@
+/*
+ *
+ *      watchdog.c
+ *      Lockup detector
+ *
+ *      2026/10/18 By MicroFish
+ *      Based on GPL-3.0 open source agreement
+ *      Copyright © 2020 ViudiraTech, based on the GPLv3 agreement.
+ *
+ */
+
+#include "watchdog.h"
+#include "alloc.h"
+#include "clocksource.h"
+#include "cmdline.h"
+#include "debug.h"
+#include "pmu.h"
+#include "printk.h"
+#include "smp.h"
+#include "stdint.h"
+#include "string.h"
+#include "workqueue.h"
+
+/* Per-CPU lockup detector state */
+typedef struct {
+        volatile uint64_t beats;                            // Timer interrupts seen, the hard lockup heartbeat
+        uint64_t          nmi_beats;                        // Heartbeat seen by the last watchdog NMI
+        uint64_t          nmi_beat_ns;                      // Time the heartbeat was last seen moving
+        volatile uint64_t touch_ns;                         // Time the CPU last reached the idle loop
+        uint8_t           hard_stalled;                     // A hard lockup was reported and has not cleared yet
+        uint8_t           soft_stalled;                     // A soft lockup was reported and has not cleared yet
+        volatile uint8_t  nmi;                              // The watchdog counter runs on this CPU
+        volatile uint8_t  hard_pending;                     // A hard lockup was recorded and waits to be printed
+        int               hard_depth;                       // Entries of the recorded call trace
+        uint64_t          hard_stuck_ns;                    // Time without a timer interrupt when the lockup was recorded
+        uintptr_t         hard_trace[WATCHDOG_TRACE_DEPTH]; // Call trace of the stalled context
+        work_t            setup;                            // Starts the detectors on the CPU
+} watchdog_cpu_t;
+
+static watchdog_cpu_t *volatile watchdog_cpus = 0;
+static uint32_t                 watchdog_cpu_count;
+static uint64_t                 watchdog_period  = 0; // Cycles between two watchdog NMIs (0 if disabled)
+static volatile uint32_t        watchdog_pending = 0; // Hard lockups recorded but not printed yet
+
+/* Get the lockup detector state of the current CPU */
+static watchdog_cpu_t *watchdog_this_cpu(void)
+{
+    uint32_t cpu = get_current_cpu_id();
+    if (!watchdog_cpus || cpu >= watchdog_cpu_count) return 0;
+    return &watchdog_cpus[cpu];
+}
+
+/* Print the hard lockups recorded by the watchdog NMI, the stalled CPU cannot print them itself */
+static void watchdog_report(void)
+{
+    for (uint32_t i = 0; i < watchdog_cpu_count; i++) {
+        watchdog_cpu_t *wd = &watchdog_cpus[i];
+        if (!__atomic_exchange_n(&wd->hard_pending, 0, __ATOMIC_ACQUIRE)) continue;
+        __atomic_fetch_sub(&watchdog_pending, 1, __ATOMIC_RELAXED);
+
+        plogk("watchdog: Hard lockup on CPU %u, no timer interrupt for %llu ms.\n", i, wd->hard_stuck_ns / 1000000);
+        dump_trace(wd->hard_trace, wd->hard_depth);
+    }
+}
+
+/* Timer interrupt heartbeat, also checks for a soft lockup (called from the timer interrupt) */
+void watchdog_tick(void)
+{
+    watchdog_cpu_t *wd = watchdog_this_cpu();
+    if (!wd || !wd->touch_ns) return;
+    wd->beats++;
+
+    if (__atomic_load_n(&watchdog_pending, __ATOMIC_RELAXED)) watchdog_report();
+
+    uint64_t stuck = nano_time() - wd->touch_ns;
+    if (stuck < WATCHDOG_SOFT_THRESH_MS * 1000000ULL || wd->soft_stalled) return;
+
+    wd->soft_stalled = 1;
+    plogk("watchdog: Soft lockup on CPU %u, stuck for %llu ms.\n", get_current_cpu_id(), stuck / 1000000);
+    dump_stack();
+}
+
+/* The current CPU reached a scheduling point (the idle loop) */
+void watchdog_touch(void)
+{
+    watchdog_cpu_t *wd = watchdog_this_cpu();
+    if (!wd) return;
+    wd->touch_ns     = nano_time();
+    wd->soft_stalled = 0;
+}
+
+/* Handle a watchdog NMI, rbp is the frame pointer of the interrupted context, returns 1 if the NMI came from the watchdog counter */
+int watchdog_nmi(interrupt_frame_t *frame, uint64_t rbp)
+{
+    watchdog_cpu_t *wd = watchdog_this_cpu();
+    if (!wd || !wd->nmi || !pmu_counter_overflowed(PMU_COUNTER_WATCHDOG)) return 0;
+    pmu_counter_reload(PMU_COUNTER_WATCHDOG, watchdog_period);
+
+    uint64_t now = nano_time();
+    if (wd->beats != wd->nmi_beats) {
+        wd->nmi_beats    = wd->beats;
+        wd->nmi_beat_ns  = now;
+        wd->hard_stalled = 0;
+        return 1;
+    }
+    if (wd->hard_stalled || now - wd->nmi_beat_ns < WATCHDOG_HARD_THRESH_MS * 1000000ULL) return 1;
+
+    /*
+     * Record once per stall, the CPU may still recover. Printing here could spin on a lock the stalled
+     * context holds, so the next CPU taking a timer interrupt prints the record instead.
+     */
+    wd->hard_stalled  = 1;
+    wd->hard_stuck_ns = now - wd->nmi_beat_ns;
+    wd->hard_depth    = stack_trace_at(frame->rip, rbp, wd->hard_trace, WATCHDOG_TRACE_DEPTH);
+    if (!__atomic_exchange_n(&wd->hard_pending, 1, __ATOMIC_RELEASE)) __atomic_fetch_add(&watchdog_pending, 1, __ATOMIC_RELAXED);
+    return 1;
+}
+
+/* Start the lockup detectors on the current CPU */
+static void watchdog_cpu_start(work_t *work)
+{
+    watchdog_cpu_t *wd  = (watchdog_cpu_t *)work->data;
+    uint64_t        now = nano_time();
+
+    wd->nmi_beats   = wd->beats;
+    wd->nmi_beat_ns = now;
+    wd->touch_ns    = now;
+    if (watchdog_period && !pmu_counter_start(PMU_COUNTER_WATCHDOG, PMU_EVENT_CYCLES, watchdog_period)) wd->nmi = 1;
+}
+
+/* Start the lockup detectors on every CPU, "nmi_watchdog=0" disables the hard lockup detector */
+void watchdog_init(void)
+{
+    uint32_t        count = get_cpu_count() ? get_cpu_count() : 1;
+    watchdog_cpu_t *cpus  = (watchdog_cpu_t *)malloc(sizeof(watchdog_cpu_t) * count);
+
+    if (!cpus) {
+        plogk("watchdog: Failed to allocate watchdog state.\n");
+        return;
+    }
+    memset(cpus, 0, sizeof(watchdog_cpu_t) * count);
+
+    if (cmdline_arg_is("nmi_watchdog", "0")) {
+        plogk("watchdog: Hard lockup detector disabled on the command line.\n");
+    } else if (!pmu_event_supported(PMU_EVENT_CYCLES)) {
+        plogk("watchdog: No cycle counter, hard lockup detector disabled.\n");
+    } else {
+        /* Unhalted cycles roughly follow the TSC, the period only sets how often the heartbeat is checked */
+        uint64_t khz    = tsc_get_khz() ? tsc_get_khz() : 1000000;
+        watchdog_period = khz * WATCHDOG_NMI_PERIOD_MS;
+        if (watchdog_period > pmu_max_period()) watchdog_period = pmu_max_period();
+    }
+    watchdog_cpu_count = count;
+    __asm__ volatile("" ::: "memory");
+    watchdog_cpus = cpus;
+
+    /* The counters and the LVT are per CPU, each CPU programs its own */
+    for (uint32_t i = 0; i < count; i++) {
+        work_setup(&cpus[i].setup, watchdog_cpu_start, &cpus[i]);
+        if (i == get_current_cpu_id())
+            watchdog_cpu_start(&cpus[i].setup);
+        else
+            work_queue_on(i, &cpus[i].setup);
+    }
+    plogk("watchdog: Hard lockup after %u ms, soft lockup after %u ms, NMI every %llu cycles.\n", WATCHDOG_HARD_THRESH_MS,
+          WATCHDOG_SOFT_THRESH_MS, watchdog_period);
+}
@@ -10,6 +10,8 @@
  */
 
 #include "gdt.h"
+#include "frame.h"
+#include "page.h"
 #include "printk.h"
 #include "stdint.h"
 
@@ -58,7 +60,9 @@ void tss_init(void)
 
     gdt0.entries[5] = (((low_base | mid_base) | limit) | access_byte);
     gdt0.entries[6] = high_base;
-    tss0.ist[0]     = ((uint64_t)&tss_stack) + sizeof(tss_stack_t);
+
+    /* Until the guarded stacks are mapped, every IST entry shares the boot stack */
+    for (int i = 0; i < IST_COUNT; i++) tss0.ist[i] = ((uint64_t)&tss_stack) + sizeof(tss_stack_t);
 
     plogk("tss: TSS descriptor configured (address = %p, limit = 0x%04x)\n", &tss0, sizeof(tss_t) - 1);
     plogk("tss: IST0 stack = %p\n", tss0.ist[0]);
@@ -66,6 +70,28 @@ void tss_init(void)
     plogk("tss: TR register loaded with selector 0x%04x\n", 0x28);
 }
 
+/* Map the guarded IST stacks of a CPU and point its TSS at them, returns 0 on success */
+int tss_init_ist(tss_t *tss, uint32_t cpu)
+{
+    uint64_t slot = IST_GUARD_SIZE + IST_STACK_SIZE;
+
+    for (int i = 0; i < IST_COUNT; i++) {
+        /* The guard page at the bottom of each slot stays unmapped, an overflow faults instead of corrupting memory */
+        uint64_t bottom = IST_STACK_BASE + ((uint64_t)cpu * IST_COUNT + i) * slot + IST_GUARD_SIZE;
+
+        for (uint64_t offset = 0; offset < IST_STACK_SIZE; offset += PAGE_SIZE) {
+            uint64_t frame = alloc_frames(1);
+            if (!frame) {
+                plogk("tss: Out of memory for the IST stacks of CPU %u.\n", cpu);
+                return -1;
+            }
+            page_map_to(get_kernel_pagedir(), bottom + offset, frame, KERNEL_PTE_FLAGS);
+        }
+        tss->ist[i] = bottom + IST_STACK_SIZE;
+    }
+    return 0;
+}
+
 /* Setting up the kernel stack */
 void set_kernel_stack(uint64_t rsp)
 {
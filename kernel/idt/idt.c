@@ -9,13 +9,34 @@
  *
  */
 
+#include "apic.h"
 #include "interrupt.h"
 #include "printk.h"
+#include "spin_lock.h"
 #include "stdint.h"
+#include "stdlib.h"
 
 idt_register_t idt_pointer;
 idt_entry_t    idt_entries[256];
 
+static uint64_t   vector_bitmap[4] = {0}; // Vectors in use, one bit each
+static spinlock_t vector_lock      = {0};
+
+/* Mark a vector as used in the vector bitmap */
+static void vector_mark(uint8_t vector, int used)
+{
+    if (used)
+        vector_bitmap[vector / 64] |= 1ULL << (vector % 64);
+    else
+        vector_bitmap[vector / 64] &= ~(1ULL << (vector % 64));
+}
+
+/* Check whether a vector is used */
+static int vector_used(uint8_t vector)
+{
+    return (vector_bitmap[vector / 64] >> (vector % 64)) & 1;
+}
+
 /* Initialize the interrupt descriptor table */
 void init_idt(void)
 {
@@ -28,6 +49,50 @@ void init_idt(void)
 
     for (int i = 0; i < 256; i++) register_interrupt_handler(i, (void *)empty_handle[i], 0, 0x8e);
     plogk("idt: Empty handler functions for interrupt vectors 0-255 registered.\n");
+
+    /* Exceptions, legacy IRQs, IPIs and the spurious vector are never handed out */
+    for (int i = 0; i < IDT_VECTOR_DYNAMIC_START; i++) vector_mark(i, 1);
+    for (int i = IPI_RESCHEDULE; i <= IPI_PANIC; i++) vector_mark(i, 1);
+    for (int i = IDT_VECTOR_DYNAMIC_END + 1; i < 256; i++) vector_mark(i, 1);
+}
+
+/* Allocate a block of free vectors aligned to its size, returns the first vector or -1 */
+int idt_alloc_vectors(uint32_t count)
+{
+    uint32_t align = 1;
+    while (align < count) align <<= 1;
+    if (!count || align > 32) return -1;
+
+    spin_lock(&vector_lock);
+    for (uint32_t base = ALIGN_UP(IDT_VECTOR_DYNAMIC_START, align); base + count - 1 <= IDT_VECTOR_DYNAMIC_END; base += align) {
+        uint32_t i = 0;
+        while (i < count && !vector_used(base + i)) i++;
+        if (i < count) continue;
+
+        for (i = 0; i < count; i++) vector_mark(base + i, 1);
+        spin_unlock(&vector_lock);
+        return (int)base;
+    }
+    spin_unlock(&vector_lock);
+    return -1;
+}
+
+/* Allocate a free vector, returns the vector or -1 */
+int idt_alloc_vector(void)
+{
+    return idt_alloc_vectors(1);
+}
+
+/* Return allocated vectors and restore their empty handlers */
+void idt_free_vectors(uint8_t vector, uint32_t count)
+{
+    spin_lock(&vector_lock);
+    for (uint32_t i = vector; i < (uint32_t)vector + count && i <= IDT_VECTOR_DYNAMIC_END; i++) {
+        if (i < IDT_VECTOR_DYNAMIC_START) continue;
+        register_interrupt_handler(i, (void *)empty_handle[i], 0, 0x8e);
+        vector_mark(i, 0);
+    }
+    spin_unlock(&vector_lock);
 }
 
 /* NOLINTBEGIN(bugprone-easily-swappable-parameters) */
@@ -10,12 +10,17 @@
  */
 
 #include "debug.h"
+#include "gdt.h"
 #include "interrupt.h"
 #include "printk.h"
+#include "profiler.h"
 #include "stdint.h"
+#include "watchdog.h"
 
 void page_fault_handle(interrupt_frame_t *frame, uint64_t error_code);
 
+extern uint8_t nmi_entry[]; // Entry stub of the NMI (nmi_entry.s)
+
 INTERRUPT_BEGIN static void ISR_0_handle(interrupt_frame_t *frame)
 {
     (void)frame;
@@ -30,12 +35,15 @@ INTERRUPT_BEGIN static void ISR_1_handle(interrupt_frame_t *frame)
 }
 INTERRUPT_END
 
-INTERRUPT_BEGIN static void ISR_2_handle(interrupt_frame_t *frame)
+/* Handle an NMI (called from nmi_entry with the vector registers saved) */
+void nmi_dispatch(interrupt_frame_t *frame, uint64_t rbp)
 {
-    (void)frame;
+    /* Both counters may have overflowed, give every source a chance */
+    int handled = watchdog_nmi(frame, rbp);
+    handled |= profiler_nmi(frame);
+    if (handled) return;
     panic("Kernel fatal error: NMI");
 }
-INTERRUPT_END
 
 INTERRUPT_BEGIN static void ISR_3_handle(interrupt_frame_t *frame)
 {
@@ -155,14 +163,14 @@ INTERRUPT_END
 void isr_registe_handle(void)
 {
     register_interrupt_handler(ISR_0, (void *)ISR_0_handle, 0, 0x8e);
-    register_interrupt_handler(ISR_1, (void *)ISR_1_handle, 0, 0x8e);
-    register_interrupt_handler(ISR_2, (void *)ISR_2_handle, 0, 0x8e);
+    register_interrupt_handler(ISR_1, (void *)ISR_1_handle, IST_DB, 0x8e);
+    register_interrupt_handler(ISR_2, nmi_entry, IST_NMI, 0x8e);
     register_interrupt_handler(ISR_3, (void *)ISR_3_handle, 0, 0x8e);
     register_interrupt_handler(ISR_4, (void *)ISR_4_handle, 0, 0x8e);
     register_interrupt_handler(ISR_5, (void *)ISR_5_handle, 0, 0x8e);
     register_interrupt_handler(ISR_6, (void *)ISR_6_handle, 0, 0x8e);
     register_interrupt_handler(ISR_7, (void *)ISR_7_handle, 0, 0x8e);
-    register_interrupt_handler(ISR_8, (void *)ISR_8_handle, 0, 0x8e);
+    register_interrupt_handler(ISR_8, (void *)ISR_8_handle, IST_DF, 0x8e);
     register_interrupt_handler(ISR_9, (void *)ISR_9_handle, 0, 0x8e);
     register_interrupt_handler(ISR_10, (void *)ISR_10_handle, 0, 0x8e);
     register_interrupt_handler(ISR_11, (void *)ISR_11_handle, 0, 0x8e);
@@ -174,7 +182,7 @@ void isr_registe_handle(void)
 
     register_interrupt_handler(ISR_16, (void *)ISR_16_handle, 0, 0x8e);
     register_interrupt_handler(ISR_17, (void *)ISR_17_handle, 0, 0x8e);
-    register_interrupt_handler(ISR_18, (void *)ISR_18_handle, 0, 0x8e);
+    register_interrupt_handler(ISR_18, (void *)ISR_18_handle, IST_MC, 0x8e);
     register_interrupt_handler(ISR_19, (void *)ISR_19_handle, 0, 0x8e);
 
     plogk("isr: All ISR handlers are registered.\n");
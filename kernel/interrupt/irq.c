@@ -0,0 +1,247 @@
+/*
+ *
+ *      irq.c
+ *      Generic interrupt dispatch
+ *
+ *      2026/10/18 By MicroFish
+ *      Based on GPL-3.0 open source agreement
+ *      Copyright © 2020 ViudiraTech, based on the GPLv3 agreement.
+ *
+ */
+
+#include "irq.h"
+#include "alloc.h"
+#include "apic.h"
+#include "common.h"
+#include "idt.h"
+#include "interrupt.h"
+#include "printk.h"
+#include "smp.h"
+#include "spin_lock.h"
+#include "stdint.h"
+#include "string.h"
+#include "trace.h"
+
+/* Per-CPU interrupt state */
+typedef struct {
+        volatile uint32_t pending;    // Pending softirqs
+        uint32_t          nesting;    // Interrupt nesting depth
+        uint8_t           in_softirq; // Softirqs are running
+        volatile uint16_t current;    // Vector being dispatched (0 if none)
+        uint64_t          spurious;   // Interrupts no handler claimed
+        irq_stat_t        stats[256];
+} irq_cpu_t;
+
+extern uint8_t irq_stub_table[]; // Entry stubs (irq_entry.s)
+
+static irq_action_t *volatile irq_actions[256];
+static spinlock_t             irq_lock = {0};
+
+static softirq_handler_t softirq_handlers[SOFTIRQ_COUNT];
+
+static irq_cpu_t  irq_boot_cpu; // Used until the per-CPU state is allocated
+static irq_cpu_t *irq_cpus      = 0;
+static uint32_t   irq_cpu_count = 0;
+
+/* Get the interrupt state of the current CPU */
+static irq_cpu_t *irq_this_cpu(void)
+{
+    if (!irq_cpus) return &irq_boot_cpu;
+    return &irq_cpus[get_current_cpu_id()];
+}
+
+/* Common interrupt dispatcher (called from the entry stubs) */
+void interrupt_dispatch(irq_regs_t *regs)
+{
+    uint8_t    vector  = regs->vector;
+    irq_cpu_t *cpu     = irq_this_cpu();
+    uint16_t   outer   = cpu->current;
+    int        handled = IRQ_NONE;
+    uint64_t   start   = rdtsc();
+
+    cpu->nesting++;
+    cpu->current = vector;
+    __atomic_thread_fence(__ATOMIC_SEQ_CST); // Published before the actions are read, pairs with irq_synchronize
+    trace_irq_entry(vector);
+
+    for (irq_action_t *action = irq_actions[vector]; action; action = action->next)
+        handled |= action->handler(vector, action->data);
+
+    /* Statistics */
+    uint64_t    cycles = rdtsc() - start;
+    uint32_t    bucket = 63 - __builtin_clzll(cycles | 1);
+    irq_stat_t *stat   = &cpu->stats[vector];
+    stat->count++;
+    stat->hist[bucket < IRQ_HIST_BUCKETS ? bucket : IRQ_HIST_BUCKETS - 1]++;
+    if (handled == IRQ_NONE) cpu->spurious++;
+    trace_irq_exit(vector, cycles);
+
+    send_eoi();
+    cpu->current = outer;
+    cpu->nesting--;
+
+    /* Bottom halves run on the outermost interrupt exit, with interrupts enabled */
+    if (!cpu->nesting && !cpu->in_softirq && cpu->pending) softirq_run();
+}
+
+/* Add a handler to a vector, vectors may be shared. Returns 0 on success */
+int irq_register(uint8_t vector, irq_handler_t handler, void *data, const char *name)
+{
+    if (vector < IRQ_VECTOR_BASE || !handler) return -1;
+
+    irq_action_t *action = (irq_action_t *)malloc(sizeof(irq_action_t));
+    if (!action) return -1;
+    action->handler = handler;
+    action->data    = data;
+    action->name    = name;
+    action->next    = 0;
+
+    spin_lock(&irq_lock);
+    irq_action_t *volatile *link = &irq_actions[vector];
+    while (*link) link = &(*link)->next;
+    *link = action; // Published last, the dispatcher may walk the list at any time
+
+    if (link == &irq_actions[vector])
+        register_interrupt_handler(vector, irq_stub_table + (vector - IRQ_VECTOR_BASE) * IRQ_STUB_SIZE, 0, 0x8e);
+    spin_unlock(&irq_lock);
+    return 0;
+}
+
+/* Wait until no CPU is dispatching a vector */
+static void irq_synchronize(uint8_t vector)
+{
+    /* The unlink must be visible before `current` is read, or a dispatcher may still walk the old action */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    for (uint32_t i = 0; i < irq_cpu_count; i++) {
+        if (&irq_cpus[i] == irq_this_cpu()) continue;
+        while (irq_cpus[i].current == vector) __asm__ volatile("pause");
+    }
+}
+
+/* Remove a handler from a vector, returns 0 on success */
+int irq_unregister(uint8_t vector, irq_handler_t handler, void *data)
+{
+    irq_action_t *action = 0;
+
+    spin_lock(&irq_lock);
+    for (irq_action_t *volatile *link = &irq_actions[vector]; *link; link = &(*link)->next) {
+        if ((*link)->handler == handler && (*link)->data == data) {
+            action = *link;
+            *link  = action->next;
+            break;
+        }
+    }
+    if (action && !irq_actions[vector]) register_interrupt_handler(vector, (void *)empty_handle[vector], 0, 0x8e);
+    spin_unlock(&irq_lock);
+
+    if (!action) return -1;
+    irq_synchronize(vector);
+    free(action);
+    return 0;
+}
+
+/* Remove every handler of a vector and give the vector back to the allocator */
+void irq_release_vector(uint8_t vector)
+{
+    spin_lock(&irq_lock);
+    irq_action_t *action = irq_actions[vector];
+    irq_actions[vector]  = 0;
+    spin_unlock(&irq_lock);
+
+    idt_free_vectors(vector, 1);
+    irq_synchronize(vector);
+    while (action) {
+        irq_action_t *next = action->next;
+        free(action);
+        action = next;
+    }
+}
+
+/* Register a softirq handler */
+void softirq_register(softirq_t nr, softirq_handler_t handler)
+{
+    if (nr < SOFTIRQ_COUNT) softirq_handlers[nr] = handler;
+}
+
+/* Mark a softirq pending on the current CPU */
+void softirq_raise(softirq_t nr)
+{
+    __atomic_fetch_or(&irq_this_cpu()->pending, 1U << nr, __ATOMIC_RELAXED);
+}
+
+/* Mark a softirq pending on the specified CPU, it runs on that CPU's next interrupt exit or idle loop */
+void softirq_raise_on(uint32_t cpu, softirq_t nr)
+{
+    irq_cpu_t *state = irq_cpus && cpu < irq_cpu_count ? &irq_cpus[cpu] : &irq_boot_cpu;
+    __atomic_fetch_or(&state->pending, 1U << nr, __ATOMIC_RELEASE);
+}
+
+/* Run the pending softirqs of the current CPU (called with interrupts disabled) */
+void softirq_run(void)
+{
+    irq_cpu_t *cpu = irq_this_cpu();
+    if (cpu->in_softirq) return;
+    cpu->in_softirq = 1;
+
+    /* Softirqs raised meanwhile are picked up again, up to a limit to keep latency bounded */
+    for (int restart = 0; restart < SOFTIRQ_MAX_RESTART && cpu->pending; restart++) {
+        uint32_t pending = __atomic_exchange_n(&cpu->pending, 0, __ATOMIC_ACQUIRE);
+        enable_intr();
+        while (pending) {
+            uint32_t nr = __builtin_ctz(pending);
+            pending &= pending - 1;
+            if (softirq_handlers[nr]) softirq_handlers[nr]();
+        }
+        disable_intr();
+    }
+    cpu->in_softirq = 0;
+}
+
+/* Get the statistics of a vector on a CPU */
+const irq_stat_t *irq_get_stat(uint32_t cpu, uint8_t vector)
+{
+    if (!irq_cpus) return cpu ? 0 : &irq_boot_cpu.stats[vector];
+    return cpu < irq_cpu_count ? &irq_cpus[cpu].stats[vector] : 0;
+}
+
+/* Print the interrupt statistics of all CPUs */
+void irq_print_stats(void)
+{
+    uint32_t count = irq_cpus ? irq_cpu_count : 1;
+
+    for (uint32_t vector = IRQ_VECTOR_BASE; vector < 256; vector++) {
+        for (uint32_t i = 0; i < count; i++) {
+            const irq_stat_t *stat = irq_get_stat(i, vector);
+            if (!stat || !stat->count) continue;
+
+            /* The median bucket gives the typical handler cost */
+            uint64_t seen   = 0;
+            uint32_t median = 0;
+            while (median < IRQ_HIST_BUCKETS - 1 && (seen += stat->hist[median]) * 2 < stat->count) median++;
+
+            const char *name = irq_actions[vector] ? irq_actions[vector]->name : "none";
+            plogk("irq: Vector %03u CPU %03u %-12s %10llu, ~%llu cycles\n", vector, i, name ? name : "unknown", stat->count,
+                  1ULL << median);
+        }
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        uint64_t spurious = irq_cpus ? irq_cpus[i].spurious : irq_boot_cpu.spurious;
+        if (spurious) plogk("irq: CPU %03u %llu unclaimed interrupts\n", i, spurious);
+    }
+}
+
+/* Allocate the per-CPU interrupt state (called before the APs start) */
+void irq_init_percpu(uint32_t cpu_count)
+{
+    irq_cpu_t *cpus = (irq_cpu_t *)malloc(sizeof(irq_cpu_t) * cpu_count);
+    if (!cpus) {
+        plogk("irq: Failed to allocate per-CPU interrupt state.\n");
+        return;
+    }
+    memset(cpus, 0, sizeof(irq_cpu_t) * cpu_count);
+    cpus[get_current_cpu_id()] = irq_boot_cpu;
+
+    irq_cpu_count = cpu_count;
+    __asm__ volatile("" ::: "memory");
+    irq_cpus = cpus;
+}
@@ -0,0 +1,75 @@
+/*
+ *
+ *      irq_entry.s
+ *      Common entry stubs of external interrupts
+ *
+ *      2026/10/18 By MicroFish
+ *      Based on GPL-3.0 open source agreement
+ *      Copyright © 2020 ViudiraTech, based on the GPLv3 agreement.
+ *
+ */
+
+    .section .text
+
+/* One 16-byte stub per vector from 32 to 255, each pushes its vector and joins irq_common */
+    .global irq_stub_table
+    .align 16
+irq_stub_table:
+    .set irq_vector, 32
+    .rept 224
+    .align 16
+    pushq $irq_vector
+    jmp irq_common
+    .set irq_vector, irq_vector + 1
+    .endr
+
+/* Save the interrupted context, call interrupt_dispatch(irq_regs_t *) and return */
+irq_common:
+    cld
+    pushq %rax
+    pushq %rbx
+    pushq %rcx
+    pushq %rdx
+    pushq %rsi
+    pushq %rdi
+    pushq %rbp
+    pushq %r8
+    pushq %r9
+    pushq %r10
+    pushq %r11
+    pushq %r12
+    pushq %r13
+    pushq %r14
+    pushq %r15
+
+    /* The handlers are ordinary C code and may use SSE registers */
+    movq %rsp, %rbx
+    subq $512, %rsp
+    andq $-16, %rsp
+    fxsave64 (%rsp)
+
+    movq %rbx, %rdi
+    call interrupt_dispatch
+
+    fxrstor64 (%rsp)
+    movq %rbx, %rsp
+
+    popq %r15
+    popq %r14
+    popq %r13
+    popq %r12
+    popq %r11
+    popq %r10
+    popq %r9
+    popq %r8
+    popq %rbp
+    popq %rdi
+    popq %rsi
+    popq %rdx
+    popq %rcx
+    popq %rbx
+    popq %rax
+    addq $8, %rsp /* Drop the vector */
+    iretq
+
+    .section .note.GNU-stack, "", @progbits
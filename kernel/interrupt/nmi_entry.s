@@ -0,0 +1,65 @@
+/*
+ *
+ *      nmi_entry.s
+ *      Entry stub of the non-maskable interrupt
+ *
+ *      2026/10/18 By MicroFish
+ *      Based on GPL-3.0 open source agreement
+ *      Copyright © 2020 ViudiraTech, based on the GPLv3 agreement.
+ *
+ */
+
+    .section .text
+
+/* Save the interrupted context, call nmi_dispatch(interrupt_frame_t *, rbp) and return */
+    .global nmi_entry
+    .align 16
+nmi_entry:
+    cld
+    pushq %rax
+    pushq %rbx
+    pushq %rcx
+    pushq %rdx
+    pushq %rsi
+    pushq %rdi
+    pushq %rbp
+    pushq %r8
+    pushq %r9
+    pushq %r10
+    pushq %r11
+    pushq %r12
+    pushq %r13
+    pushq %r14
+    pushq %r15
+
+    /* The NMI may land anywhere, even inside an interrupt handler using SSE registers */
+    movq %rsp, %rbx
+    subq $512, %rsp
+    andq $-16, %rsp
+    fxsave64 (%rsp)
+
+    leaq 120(%rbx), %rdi /* Frame pushed by the CPU, above the 15 saved registers */
+    movq %rbp, %rsi      /* Frame pointer of the interrupted context */
+    call nmi_dispatch
+
+    fxrstor64 (%rsp)
+    movq %rbx, %rsp
+
+    popq %r15
+    popq %r14
+    popq %r13
+    popq %r12
+    popq %r11
+    popq %r10
+    popq %r9
+    popq %r8
+    popq %rbp
+    popq %rdi
+    popq %rsi
+    popq %rdx
+    popq %rcx
+    popq %rbx
+    popq %rax
+    iretq
+
+    .section .note.GNU-stack, "", @progbits
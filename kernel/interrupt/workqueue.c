@@ -0,0 +1,129 @@
+/*
+ *
+ *      workqueue.c
+ *      Deferred work
+ *
+ *      2026/10/18 By MicroFish
+ *      Based on GPL-3.0 open source agreement
+ *      Copyright © 2020 ViudiraTech, based on the GPLv3 agreement.
+ *
+ */
+
+#include "workqueue.h"
+#include "alloc.h"
+#include "apic.h"
+#include "irq.h"
+#include "printk.h"
+#include "smp.h"
+#include "stdint.h"
+#include "string.h"
+
+/* Per-CPU work queue */
+typedef struct {
+        work_t *volatile head;    // Newest first, pushed lock-free from any context
+        work_t          *backlog; // Oldest first, taken from head but not run yet (softirq only)
+        uint64_t         count;   // Work items run
+} work_cpu_t;
+
+static work_cpu_t           work_boot_cpu; // Used until the per-CPU queues are allocated
+static work_cpu_t *volatile work_cpus      = 0;
+static uint32_t             work_cpu_count = 0;
+
+/* Get the work queue of a CPU */
+static work_cpu_t *work_cpu(uint32_t cpu)
+{
+    if (!work_cpus || cpu >= work_cpu_count) return &work_boot_cpu;
+    return &work_cpus[cpu];
+}
+
+/* Run a batch of the queued work of the current CPU (the work softirq) */
+static void work_softirq(void)
+{
+    work_cpu_t *queue = work_cpu(get_current_cpu_id());
+
+    /* Take everything queued so far in one exchange and restore the submission order */
+    if (!queue->backlog) {
+        work_t *list = __atomic_exchange_n(&queue->head, 0, __ATOMIC_ACQUIRE);
+        while (list) {
+            work_t *next   = list->next;
+            list->next     = queue->backlog;
+            queue->backlog = list;
+            list           = next;
+        }
+    }
+
+    for (int i = 0; i < WORK_BATCH && queue->backlog; i++) {
+        work_t *work   = queue->backlog;
+        queue->backlog = work->next;
+
+        /* Cleared first so that the work can queue itself again */
+        __atomic_store_n(&work->pending, 0, __ATOMIC_RELEASE);
+        work->func(work);
+        queue->count++;
+    }
+    if (queue->backlog || queue->head) softirq_raise(SOFTIRQ_WORK);
+}
+
+/* Prepare a work item for use */
+void work_setup(work_t *work, work_func_t func, void *data)
+{
+    work->next    = 0;
+    work->func    = func;
+    work->data    = data;
+    work->pending = 0;
+}
+
+/* Queue work on the specified CPU (safe from interrupt context), returns 0 if it was already queued */
+int work_queue_on(uint32_t cpu, work_t *work)
+{
+    if (__atomic_exchange_n(&work->pending, 1, __ATOMIC_ACQ_REL)) return 0;
+
+    work_cpu_t *queue = work_cpu(cpu);
+    work_t     *head  = queue->head;
+    do {
+        work->next = head;
+    } while (!__atomic_compare_exchange_n(&queue->head, &head, work, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+    if (cpu == get_current_cpu_id()) {
+        softirq_raise(SOFTIRQ_WORK);
+    } else {
+        /* The IPI gets the remote CPU out of hlt, the softirq runs on its way out */
+        softirq_raise_on(cpu, SOFTIRQ_WORK);
+        send_ipi_cpu(cpu, IPI_RESCHEDULE);
+    }
+    return 1;
+}
+
+/* Queue work on the current CPU (safe from interrupt context), returns 0 if it was already queued */
+int work_queue(work_t *work)
+{
+    return work_queue_on(get_current_cpu_id(), work);
+}
+
+/* Returns the number of work items run on a CPU */
+uint64_t work_get_count(uint32_t cpu)
+{
+    return work_cpu(cpu)->count;
+}
+
+/* Initialize the per-CPU work queues */
+void workqueue_init(void)
+{
+    uint32_t    count  = get_cpu_count() ? get_cpu_count() : 1;
+    work_cpu_t *queues = (work_cpu_t *)malloc(sizeof(work_cpu_t) * count);
+
+    if (!queues) {
+        plogk("workqueue: Failed to allocate work queues.\n");
+        return;
+    }
+    memset(queues, 0, sizeof(work_cpu_t) * count);
+
+    /* Work queued during early boot belongs to the BSP */
+    queues[get_current_cpu_id()] = work_boot_cpu;
+    work_cpu_count               = count;
+    __asm__ volatile("" ::: "memory");
+    work_cpus = queues;
+
+    softirq_register(SOFTIRQ_WORK, work_softirq);
+    plogk("workqueue: %u work queues, %u items per batch.\n", count, WORK_BATCH);
+}
@@ -14,6 +14,7 @@
 #include "limine.h"
 #include "page.h"
 #include "printk.h"
+#include "trace.h"
 #include "uinxed.h"
 
 log_buffer_t      frame_log;
@@ -86,6 +87,7 @@ uint64_t alloc_frames(size_t count)
     if (frame_index == (size_t)-1) return 0;
     bitmap_set_range(bitmap, frame_index, frame_index + count, 0);
     frame_allocator.usable_frames -= count;
+    trace_frame_alloc(frame_index * 4096, count);
     return frame_index * 4096;
 }
 
@@ -99,6 +101,7 @@ void free_frame(uint64_t addr)
     bitmap_t *bitmap = &frame_allocator.bitmap;
     bitmap_set(bitmap, frame_index, 1);
     frame_allocator.usable_frames++;
+    trace_frame_free(addr);
 }
 
 /* Print memory map */
@@ -12,6 +12,7 @@
 #include "page.h"
 #include "alloc.h"
 #include "common.h"
+#include "cpuid.h"
 #include "debug.h"
 #include "frame.h"
 #include "hhdm.h"
@@ -19,10 +20,13 @@
 #include "printk.h"
 #include "stdlib.h"
 #include "string.h"
+#include "trace.h"
 
 page_directory_t  kernel_page_dir;
 page_directory_t *current_directory = 0;
 
+static volatile uint64_t io_next = KERNEL_IO_START; // Next free address of the device memory area
+
 /* Page fault handling */
 INTERRUPT_BEGIN void page_fault_handle(interrupt_frame_t *frame, uint64_t error_code)
 {
@@ -208,6 +212,21 @@ void page_map_to(page_directory_t *directory, uint64_t addr, uint64_t frame, uin
 
     l1_table->entries[l1_index].value = (frame & 0x000fffffffff000) | flags;
     flush_tlb(addr);
+    trace_page_map(addr, frame, flags);
+}
+
+/* Check whether a virtual address is mapped, huge pages included */
+int page_is_mapped(page_directory_t *directory, uint64_t addr)
+{
+    page_table_t *table = directory->table;
+
+    for (int level = 3; level >= 0; level--) {
+        page_table_entry_t *entry = &table->entries[(addr >> (12 + level * 9)) & 0x1ff];
+        if (!(entry->value & PTE_PRESENT)) return 0;
+        if (level == 0 || (level < 3 && (entry->value & PTE_HUGE))) return 1;
+        table = (page_table_t *)phys_to_virt(entry->value & 0x000fffffffff000);
+    }
+    return 1;
 }
 
 /* Switch the page directory of the current process */
@@ -240,11 +259,64 @@ void page_map_range_to_random(page_directory_t *directory, uint64_t addr, uint64
     }
 }
 
+/* Map device memory (framebuffers, BARs) with a memory type, returns its virtual address or 0 */
+void *page_map_io(uint64_t phys, uint64_t length, uint64_t memtype)
+{
+    uint64_t offset = phys & (PAGE_SIZE - 1);
+    uint64_t size   = ALIGN_UP(offset + length, PAGE_SIZE);
+    uint64_t addr   = __atomic_fetch_add(&io_next, size, __ATOMIC_RELAXED);
+
+    if (addr + size > KERNEL_IO_START + KERNEL_IO_SIZE) {
+        plogk("page: Device memory area exhausted, %p not mapped.\n", phys);
+        return 0;
+    }
+
+    /* A fresh area of 4 KiB pages, the HHDM may use large pages that cannot carry the PAT bit this way */
+    page_map_range(get_kernel_pagedir(), addr, phys - offset, size, KERNEL_PTE_FLAGS | memtype);
+    return (void *)(addr + offset);
+}
+
+/* Program the PAT with PAT_KERNEL_LAYOUT, on every CPU */
+void pat_init(void)
+{
+    uint64_t rflags, cr0, cr3, cr4;
+
+    if (!cpu_support_pat()) return;
+
+    /* Intel SDM 11.12.4: caches off and flushed around the change */
+    __asm__ volatile("pushfq\n\t"
+                     "pop %0\n\t"
+                     "cli"
+                     : "=r"(rflags)::"memory");
+    __asm__ volatile("mov %%cr0, %0" : "=r"(cr0));
+    __asm__ volatile("mov %%cr4, %0" : "=r"(cr4));
+    __asm__ volatile("mov %0, %%cr0\n\t"
+                     "wbinvd" ::"r"((cr0 | (1UL << 30)) & ~(1UL << 29))
+                     : "memory");
+
+    wrmsr(MSR_IA32_PAT, PAT_KERNEL_LAYOUT);
+
+    /* Toggling CR4.PGE flushes the global entries as well */
+    __asm__ volatile("mov %%cr3, %0\n\t"
+                     "mov %0, %%cr3"
+                     : "=r"(cr3)::"memory");
+    __asm__ volatile("mov %0, %%cr4\n\t"
+                     "mov %1, %%cr4" ::"r"(cr4 & ~(1UL << 7)),
+                     "r"(cr4)
+                     : "memory");
+    __asm__ volatile("wbinvd\n\t"
+                     "mov %0, %%cr0" ::"r"(cr0)
+                     : "memory");
+    __asm__ volatile("push %0\n\t"
+                     "popfq" ::"r"(rflags)
+                     : "memory", "cc");
+}
+
 /* Get the PAT configuration */
 pat_config_t get_pat_config(void)
 {
     pat_config_t config       = {0};
-    const char  *pat_types[8] = {"WB ", "WC ", "UC-", "UC ", "WB ", "WP ", "UC-", "WT "};
+    const char  *pat_types[8] = {"UC ", "WC ", "?? ", "?? ", "WT ", "WP ", "WB ", "UC-"};
     uint64_t     pat_value    = rdmsr(MSR_IA32_PAT);
     int          pos          = 0;
 
@@ -267,4 +339,5 @@ void page_init(void)
     page_table_t *kernel_page_table = (page_table_t *)phys_to_virt(get_cr3());
     kernel_page_dir                 = (page_directory_t) {.table = kernel_page_table};
     current_directory               = &kernel_page_dir;
+    pat_init();
 }
@@ -0,0 +1,110 @@
+/*
+ *
+ *      clockevent.c
+ *      Kernel clock event device
+ *
+ *      2026/10/18 By MicroFish
+ *      Based on GPL-3.0 open source agreement
+ *      Copyright © 2020 ViudiraTech, based on the GPLv3 agreement.
+ *
+ */
+
+#include "clockevent.h"
+#include "acpi.h"
+#include "apic.h"
+#include "clocksource.h"
+#include "cmdline.h"
+#include "idt.h"
+#include "irq.h"
+#include "printk.h"
+#include "smp.h"
+#include "spin_lock.h"
+#include "stdint.h"
+#include "timer.h"
+
+static volatile clockevent_type_t clockevent = CLOCKEVENT_LAPIC;
+
+static spinlock_t clockevent_lock = {0};
+static uint32_t   clockevent_cpu  = 0; // CPU receiving the one-shot events
+static uint64_t   next_tick_ns    = 0; // Deadline of the next periodic tick
+static uint64_t   next_event_ns   = 0; // Extra deadline requested by clockevent_program (0 if none)
+
+/* Program the one-shot device for the nearest deadline (lock held) */
+static void clockevent_rearm(void)
+{
+    uint64_t now = nano_time();
+
+    /* Skip the ticks that were missed instead of firing them back to back */
+    if (next_tick_ns <= now) next_tick_ns = now - (now - next_tick_ns) % TIMER_TICK_NS + TIMER_TICK_NS;
+
+    uint64_t deadline = next_tick_ns;
+    if (next_event_ns && next_event_ns < deadline) deadline = next_event_ns;
+
+    uint64_t delta = deadline > now ? deadline - now : 0;
+    if (delta < CLOCKEVENT_MIN_DELTA_NS) delta = CLOCKEVENT_MIN_DELTA_NS;
+
+    /* The deadline slipped by while programming, try again a bit later */
+    while (hpet_set_next_event(delta) < 0) delta *= 2;
+}
+
+/* Returns the clock event device driving the boot CPU */
+clockevent_type_t clockevent_get(void)
+{
+    return clockevent;
+}
+
+/* Request an event interrupt at an absolute time, returns 0 on success */
+int clockevent_program(uint64_t deadline_ns)
+{
+    if (clockevent != CLOCKEVENT_HPET) return -1;
+
+    spin_lock(&clockevent_lock);
+    if (!next_event_ns || deadline_ns < next_event_ns) {
+        next_event_ns = deadline_ns;
+        clockevent_rearm();
+    }
+    spin_unlock(&clockevent_lock);
+    return 0;
+}
+
+/* Clock event interrupt (called from the timer interrupt) */
+void clockevent_handle(void)
+{
+    softirq_raise(SOFTIRQ_TIMER);
+    if (clockevent != CLOCKEVENT_HPET || get_current_cpu_id() != clockevent_cpu) return;
+
+    spin_lock(&clockevent_lock);
+    if (next_event_ns && next_event_ns <= nano_time()) next_event_ns = 0;
+    clockevent_rearm();
+    spin_unlock(&clockevent_lock);
+}
+
+/* Initialize the clock event device selected by "clockevent=" on the command line */
+void clockevent_init(void)
+{
+    const char *arg;
+
+    if (cmdline_get_arg("clockevent", &arg) < 0 || cmdline_arg_is("clockevent", "lapic")) {
+        plogk("clockevent: Using the local APIC timer, %u Hz.\n", TIMER_FREQUENCY);
+        return;
+    }
+    if (!cmdline_arg_is("clockevent", "hpet")) {
+        plogk("clockevent: Unknown clock event device, using the local APIC timer.\n");
+        return;
+    }
+    if (!nano_time() || hpet_clockevent_init(IRQ_0, lapic_id()) < 0) {
+        plogk("clockevent: HPET is not usable, using the local APIC timer.\n");
+        return;
+    }
+
+    /* The HPET now drives the tick of this CPU */
+    spin_lock(&clockevent_lock);
+    lapic_timer_stop();
+    clockevent_cpu = get_current_cpu_id();
+    next_tick_ns   = nano_time() + TIMER_TICK_NS;
+    clockevent     = CLOCKEVENT_HPET;
+    clockevent_rearm();
+    spin_unlock(&clockevent_lock);
+
+    plogk("clockevent: Using HPET one-shot events on CPU %u.\n", clockevent_cpu);
+}
@@ -0,0 +1,204 @@
+/*
+ *
+ *      clocksource.c
+ *      Kernel clock source
+ *
+ *      2026/10/18 By MicroFish
+ *      Based on GPL-3.0 open source agreement
+ *      Copyright © 2020 ViudiraTech, based on the GPLv3 agreement.
+ *
+ */
+
+#include "clocksource.h"
+#include "acpi.h"
+#include "common.h"
+#include "cpuid.h"
+#include "printk.h"
+#include "smp.h"
+#include "spin_lock.h"
+#include "stdint.h"
+
+/* States of the TSC synchronization handshake */
+typedef enum {
+    TSC_SYNC_IDLE    = 0, // No AP is synchronizing
+    TSC_SYNC_REQUEST = 1, // The AP asks for the TSC of the BSP
+    TSC_SYNC_REPLY   = 2, // The BSP stored its TSC
+    TSC_SYNC_DONE    = 3, // The AP finished, the result is ready to be reported
+} tsc_sync_state_t;
+
+static volatile clocksource_type_t clocksource = CLOCKSOURCE_NONE;
+
+static uint64_t tsc_base    = 0; // TSC value at the moment the TSC became the clock source
+static uint64_t tsc_base_ns = 0; // Nanoseconds at tsc_base
+static uint64_t tsc_mult    = 0; // Nanoseconds per cycle, scaled by 2^TSC_SHIFT
+static uint64_t tsc_khz     = 0; // Calibrated TSC frequency
+
+static spinlock_t                tsc_sync_lock   = {0};
+static volatile tsc_sync_state_t tsc_sync_state  = TSC_SYNC_IDLE;
+static volatile uint64_t         tsc_sync_master_tsc;
+static volatile uint32_t         tsc_sync_cpu;
+static volatile int64_t          tsc_sync_skew;
+static volatile int              tsc_sync_action; // 0 in sync, 1 adjusted, 2 unstable
+
+/* Returns the nanosecond value of the current time */
+uint64_t nano_time(void)
+{
+    if (clocksource == CLOCKSOURCE_TSC)
+        return tsc_base_ns + (uint64_t)(((unsigned __int128)(rdtsc() - tsc_base) * tsc_mult) >> TSC_SHIFT);
+    return hpet_nano_time();
+}
+
+/* Returns the current clock source */
+clocksource_type_t clocksource_get(void)
+{
+    return clocksource;
+}
+
+/* Returns the calibrated TSC frequency in kHz (0 if the TSC is not used) */
+uint64_t tsc_get_khz(void)
+{
+    return clocksource == CLOCKSOURCE_TSC ? tsc_khz : 0;
+}
+
+/* Read the TSC and the HPET counter as close together as possible */
+static void tsc_read_pair(uint64_t *tsc, uint64_t *counter)
+{
+    uint64_t best = (uint64_t)-1;
+
+    /* The HPET read is slow, keep the sample whose TSC window around it is the smallest */
+    for (int i = 0; i < 5; i++) {
+        uint64_t before = rdtsc();
+        uint64_t value  = hpet_read_counter();
+        uint64_t after  = rdtsc();
+
+        if (after - before < best) {
+            best     = after - before;
+            *tsc     = before + (after - before) / 2;
+            *counter = value;
+        }
+    }
+}
+
+/* Measure the TSC frequency against the HPET, returns cycles per second */
+static uint64_t tsc_calibrate(void)
+{
+    uint64_t period = hpet_get_period();
+    uint64_t tsc0 = 0, tsc1 = 0, counter0 = 0, counter1 = 0;
+
+    if (!period) return 0;
+    uint64_t window = (uint64_t)TSC_CALIBRATE_MS * 1000000000000ULL / period; // Counter ticks in the window
+
+    tsc_read_pair(&tsc0, &counter0);
+    while (hpet_read_counter() - counter0 < window) __asm__ volatile("pause");
+    tsc_read_pair(&tsc1, &counter1);
+
+    uint64_t elapsed_ns = (counter1 - counter0) * period / 1000000;
+    if (!elapsed_ns || tsc1 <= tsc0) return 0;
+    return (tsc1 - tsc0) * 1000000000 / elapsed_ns;
+}
+
+/* Service TSC synchronization requests of APs (called by the BSP while waiting) */
+void tsc_sync_master(void)
+{
+    if (tsc_sync_state == TSC_SYNC_REQUEST) {
+        tsc_sync_master_tsc = rdtsc();
+        __asm__ volatile("" ::: "memory");
+        tsc_sync_state = TSC_SYNC_REPLY;
+    } else if (tsc_sync_state == TSC_SYNC_DONE) {
+        if (tsc_sync_action == 1) {
+            plogk("clocksource: CPU %u TSC skew %lld cycles, corrected by IA32_TSC_ADJUST.\n", tsc_sync_cpu, tsc_sync_skew);
+        } else if (tsc_sync_action == 2) {
+            plogk("clocksource: CPU %u TSC skew %lld cycles, TSC unstable, falling back to HPET.\n", tsc_sync_cpu,
+                  tsc_sync_skew);
+        }
+        tsc_sync_state = TSC_SYNC_IDLE;
+    }
+}
+
+/* Measure the skew of the current TSC against the BSP, returns the best measurement error */
+static uint64_t tsc_sync_measure(int64_t *skew)
+{
+    uint64_t best_rtt = (uint64_t)-1;
+
+    for (int i = 0; i < TSC_SYNC_ROUNDS; i++) {
+        uint64_t start = rdtsc();
+        tsc_sync_state = TSC_SYNC_REQUEST;
+        while (tsc_sync_state != TSC_SYNC_REPLY) __asm__ volatile("pause");
+        uint64_t end = rdtsc();
+
+        /* The BSP read its TSC somewhere inside the round trip, assume the middle */
+        uint64_t rtt = end - start;
+        if (rtt < best_rtt) {
+            best_rtt = rtt;
+            *skew    = (int64_t)(start + rtt / 2 - tsc_sync_master_tsc);
+        }
+    }
+    return best_rtt / 2;
+}
+
+/* Synchronize the TSC of the current AP with the BSP */
+void tsc_sync_ap(void)
+{
+    if (clocksource != CLOCKSOURCE_TSC) return;
+
+    spin_lock(&tsc_sync_lock);
+    while (tsc_sync_state != TSC_SYNC_IDLE) __asm__ volatile("pause");
+
+    int64_t  skew   = 0;
+    uint64_t error  = tsc_sync_measure(&skew);
+    uint64_t limit  = error + TSC_SYNC_SLACK;
+    int      action = 0;
+
+    if ((uint64_t)(skew < 0 ? -skew : skew) > limit) {
+        if (cpu_support_tsc_adjust()) {
+            wrmsr(MSR_IA32_TSC_ADJUST, rdmsr(MSR_IA32_TSC_ADJUST) - (uint64_t)skew);
+            int64_t residual = 0;
+            tsc_sync_measure(&residual);
+            action = (uint64_t)(residual < 0 ? -residual : residual) > limit ? 2 : 1;
+        } else {
+            action = 2;
+        }
+    }
+    if (action == 2) clocksource = CLOCKSOURCE_HPET;
+
+    tsc_sync_cpu    = get_current_cpu_id();
+    tsc_sync_skew   = skew;
+    tsc_sync_action = action;
+    __asm__ volatile("" ::: "memory");
+    tsc_sync_state = TSC_SYNC_DONE;
+
+    while (tsc_sync_state != TSC_SYNC_IDLE) __asm__ volatile("pause");
+    spin_unlock(&tsc_sync_lock);
+}
+
+/* Initialize the clock source */
+void clocksource_init(void)
+{
+    if (!hpet_get_period()) {
+        plogk("clocksource: No HPET, the kernel has no clock source.\n");
+        return;
+    }
+    clocksource = CLOCKSOURCE_HPET;
+
+    if (!cpu_support_tsc() || !cpu_support_invariant_tsc()) {
+        plogk("clocksource: TSC is not invariant, using HPET.\n");
+        return;
+    }
+
+    uint64_t tsc_hz = tsc_calibrate();
+    if (!tsc_hz) {
+        plogk("clocksource: TSC calibration failed, using HPET.\n");
+        return;
+    }
+    tsc_khz  = tsc_hz / 1000;
+    tsc_mult = (1000000000ULL << TSC_SHIFT) / tsc_hz;
+
+    /* Continue from the current HPET time so that time never jumps */
+    tsc_base    = rdtsc();
+    tsc_base_ns = hpet_nano_time();
+    clocksource = CLOCKSOURCE_TSC;
+
+    plogk("clocksource: Using invariant TSC, %llu.%03llu MHz, mult = %llu, shift = %u.\n", tsc_khz / 1000, tsc_khz % 1000,
+          tsc_mult, TSC_SHIFT);
+    if (cpu_support_tsc_adjust()) plogk("clocksource: IA32_TSC_ADJUST is supported.\n");
+}
@@ -9,22 +9,45 @@
  *
  */
 
+#include "timer.h"
 #include "acpi.h"
+#include "alloc.h"
 #include "apic.h"
+#include "clockevent.h"
+#include "clocksource.h"
 #include "common.h"
-#include "interrupt.h"
+#include "intrusive_list.h"
+#include "irq.h"
 #include "printk.h"
+#include "smp.h"
+#include "spin_lock.h"
 #include "stdint.h"
+#include "string.h"
+#include "watchdog.h"
+
+#define TIMER_LEVEL_SHIFT(level)       (TIMER_ROOT_BITS + (level) * TIMER_LEVEL_BITS)
+#define TIMER_LEVEL_INDEX(tick, level) (((tick) >> TIMER_LEVEL_SHIFT(level)) & TIMER_LEVEL_MASK)
+
+/* Per-CPU hierarchical timing wheel */
+typedef struct {
+        spinlock_t   lock;                                   // Protects the wheel
+        uint64_t     tick;                                   // Next tick to be processed
+        size_t       count;                                  // Number of pending timers
+        ilist_node_t root[TIMER_ROOT_SIZE];                  // Timers expiring within the next 256 ticks
+        ilist_node_t levels[TIMER_LEVELS][TIMER_LEVEL_SIZE]; // Cascading levels for long timeouts
+} timer_base_t;
+
+static timer_base_t *volatile timer_bases = 0;
 
 /* Timer interrupt */
-INTERRUPT_BEGIN void timer_handle(interrupt_frame_t *frame)
+irq_return_t timer_handle(uint8_t vector, void *data)
 {
-    (void)frame;
-    disable_intr();
-    send_eoi();
-    enable_intr();
+    (void)vector;
+    (void)data;
+    watchdog_tick();
+    clockevent_handle();
+    return IRQ_HANDLED;
 }
-INTERRUPT_END
 
 /* Millisecond-based delay functions */
 void msleep(uint64_t ms)
@@ -64,3 +87,226 @@ void nsleep(uint64_t ns)
         if (after >= ns) return;
     }
 }
+
+/* Returns the current time in ticks */
+uint64_t timer_get_ticks(void)
+{
+    uint64_t ns = nano_time();
+    if (ns) return ns / TIMER_TICK_NS;
+
+    /* Without a clock source, time is counted by the ticks of the local wheel */
+    return timer_bases ? timer_bases[get_current_cpu_id()].tick : 0;
+}
+
+/* Convert milliseconds to ticks (rounded up) */
+uint64_t timer_ms_to_ticks(uint64_t ms)
+{
+    return (ms * TIMER_FREQUENCY + 999) / 1000;
+}
+
+/* Returns the tick the wheel should catch up to */
+static uint64_t timer_base_now(timer_base_t *base)
+{
+    uint64_t ns = nano_time();
+    return ns ? ns / TIMER_TICK_NS : base->tick;
+}
+
+/* Move all nodes of a slot to a local list head */
+static void timer_list_take(ilist_node_t *slot, ilist_node_t *list)
+{
+    ilist_init(list);
+    if (ilist_is_empty(slot)) return;
+
+    list->next       = slot->next;
+    list->prev       = slot->prev;
+    list->next->prev = list;
+    list->prev->next = list;
+    ilist_init(slot);
+}
+
+/* Hash a timer into the wheel slot matching its expiry */
+static void timer_enqueue(timer_base_t *base, timer_t *timer)
+{
+    uint64_t      expires = timer->expires;
+    uint64_t      delta   = expires - base->tick;
+    ilist_node_t *slot;
+
+    if ((int64_t)delta < 0) {
+        /* Already expired, run it on the next tick */
+        slot = &base->root[base->tick & TIMER_ROOT_MASK];
+    } else if (delta < TIMER_ROOT_SIZE) {
+        slot = &base->root[expires & TIMER_ROOT_MASK];
+    } else {
+        if (delta > TIMER_MAX_DELAY) {
+            delta          = TIMER_MAX_DELAY;
+            expires        = base->tick + TIMER_MAX_DELAY;
+            timer->expires = expires;
+        }
+
+        /* The level is chosen by the highest set bit of the delta */
+        int level = (63 - __builtin_clzll(delta) - TIMER_ROOT_BITS) / TIMER_LEVEL_BITS;
+        slot      = &base->levels[level][TIMER_LEVEL_INDEX(expires, level)];
+    }
+    ilist_insert_before(slot, &timer->node);
+    base->count++;
+}
+
+/* Re-hash the timers of a level slot into the lower levels */
+static uint32_t timer_cascade(timer_base_t *base, int level, uint32_t index)
+{
+    ilist_node_t list;
+    timer_list_take(&base->levels[level][index], &list);
+
+    while (!ilist_is_empty(&list)) {
+        timer_t *timer = ilist_entry(list.next, timer_t, node);
+        ilist_remove(&timer->node);
+        base->count--;
+        timer_enqueue(base, timer);
+    }
+    return index;
+}
+
+/* Run the expired timers of a wheel up to the specified tick */
+static void timer_run(timer_base_t *base, uint64_t now)
+{
+    while ((int64_t)(now - base->tick) >= 0) {
+        uint32_t index = base->tick & TIMER_ROOT_MASK;
+
+        /* The root wheel wrapped, pull the next slot of each level down */
+        if (!index) {
+            for (int level = 0; level < TIMER_LEVELS; level++)
+                if (timer_cascade(base, level, TIMER_LEVEL_INDEX(base->tick, level))) break;
+        }
+        base->tick++;
+
+        ilist_node_t expired;
+        timer_list_take(&base->root[index], &expired);
+
+        while (!ilist_is_empty(&expired)) {
+            timer_t *timer = ilist_entry(expired.next, timer_t, node);
+            ilist_remove(&timer->node);
+            base->count--;
+            timer->pending = 0;
+
+            /* The callback may re-arm the timer */
+            spin_unlock(&base->lock);
+            timer->callback(timer);
+            spin_lock(&base->lock);
+        }
+        if (!base->count) break;
+    }
+    if ((int64_t)(now - base->tick) >= 0) base->tick = now + 1;
+}
+
+/* Prepare a timer for use */
+void timer_setup(timer_t *timer, timer_callback_t callback, void *data)
+{
+    timer->node.prev = 0;
+    timer->node.next = 0;
+    timer->expires   = 0;
+    timer->callback  = callback;
+    timer->data      = data;
+    timer->cpu       = 0;
+    timer->pending   = 0;
+}
+
+/* Put a timer on the wheel of a CPU (re-arms it if it is pending) */
+static void timer_arm(uint32_t cpu, timer_t *timer, uint64_t expires)
+{
+    timer_cancel(timer);
+
+    timer_base_t *base = &timer_bases[cpu];
+    spin_lock(&base->lock);
+    timer->expires = expires;
+    timer->cpu     = cpu;
+    timer->pending = 1;
+    timer_enqueue(base, timer);
+    spin_unlock(&base->lock);
+}
+
+/* Arm a timer to expire at an absolute tick (re-arms it if it is pending) */
+void timer_add_at(timer_t *timer, uint64_t expires)
+{
+    if (!timer_bases) return;
+    timer_arm(get_current_cpu_id(), timer, expires);
+}
+
+/* Arm a timer to expire after the specified milliseconds */
+void timer_add(timer_t *timer, uint64_t ms)
+{
+    uint64_t ticks = timer_ms_to_ticks(ms);
+    timer_add_at(timer, timer_get_ticks() + (ticks ? ticks : 1));
+}
+
+/* Arm a timer on the wheel of another CPU, the callback runs there. Returns -1 if the CPU has no wheel */
+int timer_add_on(uint32_t cpu, timer_t *timer, uint64_t ms)
+{
+    uint32_t count = get_cpu_count() ? get_cpu_count() : 1;
+    if (!timer_bases || cpu >= count) return -1;
+
+    uint64_t ticks = timer_ms_to_ticks(ms);
+    timer_arm(cpu, timer, timer_get_ticks() + (ticks ? ticks : 1));
+    return 0;
+}
+
+/* Disarm a timer, returns 1 if it was pending */
+int timer_cancel(timer_t *timer)
+{
+    while (timer->pending) {
+        uint32_t      cpu  = timer->cpu;
+        timer_base_t *base = &timer_bases[cpu];
+
+        spin_lock(&base->lock);
+
+        /* The timer may have expired or been re-armed on another CPU meanwhile */
+        if (timer->pending && timer->cpu == cpu) {
+            ilist_remove(&timer->node);
+            base->count--;
+            timer->pending = 0;
+            spin_unlock(&base->lock);
+            return 1;
+        }
+        spin_unlock(&base->lock);
+    }
+    return 0;
+}
+
+/* Process expired timers of the current CPU (the timer softirq) */
+void timer_tick(void)
+{
+    if (!timer_bases) return;
+    timer_base_t *base = &timer_bases[get_current_cpu_id()];
+
+    spin_lock(&base->lock);
+    timer_run(base, timer_base_now(base));
+    spin_unlock(&base->lock);
+}
+
+/* Initialize the per-CPU timer wheels */
+void timer_init(void)
+{
+    uint32_t      count = get_cpu_count() ? get_cpu_count() : 1;
+    timer_base_t *bases = (timer_base_t *)malloc(sizeof(timer_base_t) * count);
+    uint64_t      now   = nano_time() / TIMER_TICK_NS;
+
+    if (!bases) {
+        plogk("timer: Failed to allocate timer wheels.\n");
+        return;
+    }
+    memset(bases, 0, sizeof(timer_base_t) * count);
+
+    for (uint32_t i = 0; i < count; i++) {
+        for (int j = 0; j < TIMER_ROOT_SIZE; j++) ilist_init(&bases[i].root[j]);
+        for (int level = 0; level < TIMER_LEVELS; level++)
+            for (int j = 0; j < TIMER_LEVEL_SIZE; j++) ilist_init(&bases[i].levels[level][j]);
+        bases[i].tick = now;
+    }
+    softirq_register(SOFTIRQ_TIMER, timer_tick);
+
+    /* Publish the wheels only after they are fully initialized */
+    __asm__ volatile("" ::: "memory");
+    timer_bases = bases;
+
+    plogk("timer: %u timer wheels, %u Hz tick, %u root slots + %u x %u level slots.\n", count, TIMER_FREQUENCY, TIMER_ROOT_SIZE,
+          TIMER_LEVELS, TIMER_LEVEL_SIZE);
+}
@@ -0,0 +1,287 @@
+/*
+ *
+ *      blit.c
+ *      2D blitter
+ *
+ *      2026/10/18 By MicroFish
+ *      Based on GPL-3.0 open source agreement
+ *      Copyright © 2020 ViudiraTech, based on the GPLv3 agreement.
+ *
+ */
+
+#include "blit.h"
+#include "cpuid.h"
+#include "stddef.h"
+#include "stdint.h"
+
+/* Row kernels, every operation is done one row at a time */
+typedef struct {
+        void (*fill)(uint32_t *dst, uint32_t color, size_t count, int stream);
+        void (*copy)(uint32_t *dst, const uint32_t *src, size_t count, int stream);
+        void (*masked)(uint32_t *dst, const uint32_t *src, size_t count, uint32_t key);
+        void (*blend)(uint32_t *dst, const uint32_t *src, size_t count);
+} blit_kernels_t;
+
+typedef uint32_t blit_v4_t __attribute__((vector_size(16)));
+typedef uint32_t blit_v4u_t __attribute__((vector_size(16), aligned(4)));
+typedef uint32_t blit_v8_t __attribute__((vector_size(32)));
+typedef uint32_t blit_v8u_t __attribute__((vector_size(32), aligned(4)));
+
+/* Blend a pixel over another by its alpha, 255 is mapped to 256 so that opaque pixels are copied exactly */
+static inline __attribute__((always_inline)) uint32_t blit_blend_pixel(uint32_t src, uint32_t dst)
+{
+    uint32_t alpha = src >> 24;
+    alpha += alpha >> 7;
+    uint32_t rb = ((src & 0x00ff00ff) * alpha + (dst & 0x00ff00ff) * (256 - alpha)) >> 8;
+    uint32_t g  = ((src & 0x0000ff00) * alpha + (dst & 0x0000ff00) * (256 - alpha)) >> 8;
+    return (rb & 0x00ff00ff) | (g & 0x0000ff00) | (dst & 0xff000000);
+}
+
+/* Fill a row with string stores */
+static void blit_generic_fill(uint32_t *dst, uint32_t color, size_t count, int stream)
+{
+    (void)stream;
+    __asm__ volatile("rep stosl" : "+D"(dst), "+c"(count) : "a"(color) : "memory");
+}
+
+/* Copy a row with string moves */
+static void blit_generic_copy(uint32_t *dst, const uint32_t *src, size_t count, int stream)
+{
+    (void)stream;
+    __asm__ volatile("rep movsl" : "+D"(dst), "+S"(src), "+c"(count)::"memory");
+}
+
+/* Copy a row except the color key pixel by pixel */
+static void blit_generic_masked(uint32_t *dst, const uint32_t *src, size_t count, uint32_t key)
+{
+    for (; count; count--, dst++, src++) {
+        if (*src != key) *dst = *src;
+    }
+}
+
+/* Blend a row pixel by pixel */
+static void blit_generic_blend(uint32_t *dst, const uint32_t *src, size_t count)
+{
+    for (; count; count--, dst++, src++) *dst = blit_blend_pixel(*src, *dst);
+}
+
+/*
+ * The vector kernels, instantiated once per register width. Streaming stores need an aligned destination,
+ * so the head of a streamed row is written pixel by pixel. The caller issues the sfence.
+ */
+#define BLIT_KERNELS(name, vec_t, vecu_t, attr, stream_insn)                                                        \
+    static __attribute__((attr)) void name##_fill(uint32_t *dst, uint32_t color, size_t count, int stream)          \
+    {                                                                                                               \
+        const size_t lanes = sizeof(vec_t) / sizeof(uint32_t);                                                      \
+        vec_t        value = (vec_t) {0} + color;                                                                   \
+        if (stream) {                                                                                               \
+            for (; count && ((uintptr_t)dst & (sizeof(vec_t) - 1)); count--) *dst++ = color;                        \
+            for (; count >= lanes; count -= lanes, dst += lanes)                                                    \
+                __asm__ volatile(stream_insn " %1, %0" : "=m"(*(vec_t *)dst) : "x"(value));                         \
+        }                                                                                                           \
+        for (; count >= lanes; count -= lanes, dst += lanes) *(vecu_t *)dst = value;                                \
+        for (; count; count--) *dst++ = color;                                                                      \
+    }                                                                                                               \
+                                                                                                                    \
+    static __attribute__((attr)) void name##_copy(uint32_t *dst, const uint32_t *src, size_t count, int stream)     \
+    {                                                                                                               \
+        const size_t lanes = sizeof(vec_t) / sizeof(uint32_t);                                                      \
+        if (stream) {                                                                                               \
+            for (; count && ((uintptr_t)dst & (sizeof(vec_t) - 1)); count--) *dst++ = *src++;                       \
+            for (; count >= lanes; count -= lanes, dst += lanes, src += lanes) {                                    \
+                vec_t value = *(const vecu_t *)src;                                                                 \
+                __asm__ volatile(stream_insn " %1, %0" : "=m"(*(vec_t *)dst) : "x"(value));                         \
+            }                                                                                                       \
+        }                                                                                                           \
+        for (; count >= lanes; count -= lanes, dst += lanes, src += lanes) *(vecu_t *)dst = *(const vecu_t *)src;   \
+        for (; count; count--) *dst++ = *src++;                                                                     \
+    }                                                                                                               \
+                                                                                                                    \
+    static __attribute__((attr)) void name##_masked(uint32_t *dst, const uint32_t *src, size_t count, uint32_t key) \
+    {                                                                                                               \
+        const size_t lanes = sizeof(vec_t) / sizeof(uint32_t);                                                      \
+        vec_t        keys  = (vec_t) {0} + key;                                                                     \
+        for (; count >= lanes; count -= lanes, dst += lanes, src += lanes) {                                        \
+            vec_t value = *(const vecu_t *)src;                                                                     \
+            vec_t skip  = (vec_t)(value == keys);                                                                   \
+            *(vecu_t *)dst = (*(vecu_t *)dst & skip) | (value & ~skip);                                             \
+        }                                                                                                           \
+        for (; count; count--, dst++, src++) {                                                                      \
+            if (*src != key) *dst = *src;                                                                           \
+        }                                                                                                           \
+    }                                                                                                               \
+                                                                                                                    \
+    static __attribute__((attr)) void name##_blend(uint32_t *dst, const uint32_t *src, size_t count)                \
+    {                                                                                                               \
+        const size_t lanes = sizeof(vec_t) / sizeof(uint32_t);                                                      \
+        for (; count >= lanes; count -= lanes, dst += lanes, src += lanes) {                                        \
+            vec_t value = *(const vecu_t *)src;                                                                     \
+            vec_t under = *(vecu_t *)dst;                                                                           \
+            vec_t alpha = value >> 24;                                                                              \
+            alpha += alpha >> 7;                                                                                    \
+            vec_t rb = ((value & 0x00ff00ff) * alpha + (under & 0x00ff00ff) * (256 - alpha)) >> 8;                  \
+            vec_t g  = ((value & 0x0000ff00) * alpha + (under & 0x0000ff00) * (256 - alpha)) >> 8;                  \
+            *(vecu_t *)dst = (rb & 0x00ff00ff) | (g & 0x0000ff00) | (under & 0xff000000);                           \
+        }                                                                                                           \
+        for (; count; count--, dst++, src++) *dst = blit_blend_pixel(*src, *dst);                                   \
+    }                                                                                                               \
+                                                                                                                    \
+    static const blit_kernels_t name = {name##_fill, name##_copy, name##_masked, name##_blend};
+
+#if CPU_FEATURE_SSE
+BLIT_KERNELS(blit_sse2, blit_v4_t, blit_v4u_t, target("sse2"), "movntdq")
+#    if CPU_FEATURE_AVX
+BLIT_KERNELS(blit_avx2, blit_v8_t, blit_v8u_t, target("avx2"), "vmovntdq")
+#    endif
+#endif
+
+static const blit_kernels_t blit_generic = {blit_generic_fill, blit_generic_copy, blit_generic_masked, blit_generic_blend};
+
+static const blit_kernels_t *blit_ops = &blit_generic; // Kernels of the widest usable registers
+
+/* Select the widest kernels the CPU supports */
+void blit_init(void)
+{
+    blit_ops = &blit_generic;
+#if CPU_FEATURE_SSE
+    if (cpu_support_sse2()) blit_ops = &blit_sse2;
+#    if CPU_FEATURE_AVX
+    /* init_avx() enables the YMM state only if AVX is there */
+    if (cpu_support_avx() && cpu_support_avx2()) blit_ops = &blit_avx2;
+#    endif
+#endif
+}
+
+/* Order the streaming stores of an operation before anything that follows */
+static void blit_stream_done(int stream)
+{
+    if (stream && blit_ops != &blit_generic) __asm__ volatile("sfence" ::: "memory");
+}
+
+/* Whether an operation writes enough to bypass the cache */
+static int blit_stream(uint64_t width, uint64_t height)
+{
+    return width * height * sizeof(uint32_t) >= BLIT_STREAM_BYTES;
+}
+
+/* Clip one axis of a transfer, the source and destination starts move together. Returns the length left */
+static int64_t blit_clip_axis(int64_t *src, int64_t *dst, int64_t length, int64_t src_size, int64_t dst_size)
+{
+    int64_t skip = -*src > -*dst ? -*src : -*dst;
+    if (skip > 0) {
+        *src += skip;
+        *dst += skip;
+        length -= skip;
+    }
+    if (*src + length > src_size) length = src_size - *src;
+    if (*dst + length > dst_size) length = dst_size - *dst;
+    return length;
+}
+
+/* Clip a transfer against both surfaces, returns 0 if nothing is left */
+static int blit_clip(const blit_surface_t *dst, int32_t *x, int32_t *y, const blit_surface_t *src, blit_rect_t *rect)
+{
+    int64_t src_x = rect->x, src_y = rect->y;
+    int64_t dst_x = *x, dst_y = *y;
+
+    int64_t w = blit_clip_axis(&src_x, &dst_x, rect->width, src->width, dst->width);
+    int64_t h = blit_clip_axis(&src_y, &dst_y, rect->height, src->height, dst->height);
+    if (w <= 0 || h <= 0) return 0;
+
+    *rect = (blit_rect_t) {(int32_t)src_x, (int32_t)src_y, (uint32_t)w, (uint32_t)h};
+    *x    = (int32_t)dst_x;
+    *y    = (int32_t)dst_y;
+    return 1;
+}
+
+/* Fill an area with a color */
+void blit_fill(blit_surface_t *dst, blit_rect_t rect, uint32_t color)
+{
+    int32_t x = rect.x;
+    int32_t y = rect.y;
+    if (!blit_clip(dst, &x, &y, dst, &rect)) return;
+
+    int       stream = blit_stream(rect.width, rect.height);
+    uint32_t *row    = dst->pixels + (size_t)y * dst->stride + x;
+
+    /* Rows without padding between them are filled in one run */
+    if (rect.width == dst->stride) {
+        blit_ops->fill(row, color, (size_t)rect.width * rect.height, stream);
+    } else {
+        for (uint32_t i = 0; i < rect.height; i++, row += dst->stride) blit_ops->fill(row, color, rect.width, stream);
+    }
+    blit_stream_done(stream);
+}
+
+/* Copy a row backwards, for a destination overlapping the source from the right */
+static void blit_copy_backward(uint32_t *dst, const uint32_t *src, size_t count)
+{
+    while (count--) dst[count] = src[count];
+}
+
+/* Copy an area of a surface to (x, y) of another one, the two may be the same surface */
+void blit_copy(blit_surface_t *dst, int32_t x, int32_t y, const blit_surface_t *src, blit_rect_t rect)
+{
+    if (!blit_clip(dst, &x, &y, src, &rect)) return;
+
+    int             stream    = blit_stream(rect.width, rect.height);
+    uint32_t       *to        = dst->pixels + (size_t)y * dst->stride + x;
+    const uint32_t *from      = src->pixels + (size_t)rect.y * src->stride + rect.x;
+    int64_t         to_step   = dst->stride;
+    int64_t         from_step = src->stride;
+
+    /*
+     * Overlapping areas are copied like memmove, walking away from the side being written. Only a row whose
+     * destination starts inside its own source needs the backward copy, the forward kernels handle the rest.
+     */
+    if (dst->pixels == src->pixels && to > from) {
+        to += (size_t)(rect.height - 1) * dst->stride;
+        from += (size_t)(rect.height - 1) * src->stride;
+        to_step   = -to_step;
+        from_step = -from_step;
+    }
+
+    for (uint32_t i = 0; i < rect.height; i++, to += to_step, from += from_step) {
+        if (to > from && to < from + rect.width)
+            blit_copy_backward(to, from, rect.width);
+        else
+            blit_ops->copy(to, from, rect.width, stream);
+    }
+    blit_stream_done(stream);
+}
+
+/* Copy an area except the pixels equal to the color key */
+void blit_masked(blit_surface_t *dst, int32_t x, int32_t y, const blit_surface_t *src, blit_rect_t rect, uint32_t key)
+{
+    if (!blit_clip(dst, &x, &y, src, &rect)) return;
+
+    uint32_t       *to   = dst->pixels + (size_t)y * dst->stride + x;
+    const uint32_t *from = src->pixels + (size_t)rect.y * src->stride + rect.x;
+    for (uint32_t i = 0; i < rect.height; i++, to += dst->stride, from += src->stride) blit_ops->masked(to, from, rect.width, key);
+}
+
+/* Blend an area over the destination by the alpha in the top byte of the source pixels */
+void blit_blend(blit_surface_t *dst, int32_t x, int32_t y, const blit_surface_t *src, blit_rect_t rect)
+{
+    if (!blit_clip(dst, &x, &y, src, &rect)) return;
+
+    uint32_t       *to   = dst->pixels + (size_t)y * dst->stride + x;
+    const uint32_t *from = src->pixels + (size_t)rect.y * src->stride + rect.x;
+    for (uint32_t i = 0; i < rect.height; i++, to += dst->stride, from += src->stride) blit_ops->blend(to, from, rect.width);
+}
+
+/* Transfer an area with a mode, the key is used by BLIT_MASKED only */
+void blit(blit_surface_t *dst, int32_t x, int32_t y, const blit_surface_t *src, blit_rect_t rect, blit_mode_t mode, uint32_t key)
+{
+    switch (mode) {
+        case BLIT_MASKED :
+            blit_masked(dst, x, y, src, rect, key);
+            break;
+        case BLIT_BLEND :
+            blit_blend(dst, x, y, src, rect);
+            break;
+        default :
+            blit_copy(dst, x, y, src, rect);
+            break;
+    }
+}
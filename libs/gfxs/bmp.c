@@ -10,30 +10,348 @@
  */
 
 #include "bmp.h"
+#include "alloc.h"
+#include "blit.h"
+#include "cpuid.h"
+#include "stddef.h"
 #include "video.h"
 
+/* How file pixels map to frame buffer pixels */
+typedef struct {
+        uint8_t  red_shift, green_shift, blue_shift; // Channel positions in the frame buffer
+        uint8_t  red_drop, green_drop, blue_drop;    // Low bits of 8-bit channels the frame buffer has no room for
+        uint32_t alpha_mask;                         // 0xff000000 if the alpha is kept for blending
+        int      bytewise;                           // Every channel is a whole byte, rows are converted by shuffles
+        uint8_t  shuffle24[16];                      // pshufb control turning 4 BGR pixels into frame buffer pixels
+        uint8_t  shuffle32[16];                      // pshufb control turning 4 BGRA pixels into frame buffer pixels
+        uint32_t palette[256];                       // Palette converted to frame buffer pixels
+} bmp_format_t;
+
+/* A channel of a 16 or 32-bit pixel */
+typedef struct {
+        uint32_t mask;
+        uint8_t  shift;
+        uint8_t  size;
+} bmp_channel_t;
+
+/* Rows converted but not blitted yet */
+typedef struct {
+        uint32_t   *pixels;    // BMP_STRIP_ROWS rows in screen order
+        uint32_t    width;     // Pixels per row
+        uint32_t    height;    // Rows of the image
+        int         bottom_up; // The file stores the bottom row first
+        int32_t     x, y;      // Screen position of the image
+        uint32_t    row;       // Rows of the file finished so far
+        uint32_t    count;     // Rows waiting in the strip
+        blit_mode_t mode;      // How the rows are put on the screen
+} bmp_strip_t;
+
 /* NOLINTBEGIN(bugprone-easily-swappable-parameters) */
 
-/* Parse bitmap images and draw them to the screen */
+/* Convert 8-bit channels to a frame buffer pixel */
+static inline uint32_t bmp_pixel(const bmp_format_t *format, uint32_t r, uint32_t g, uint32_t b, uint32_t a)
+{
+    return ((r >> format->red_drop) << format->red_shift) | ((g >> format->green_drop) << format->green_shift) |
+           ((b >> format->blue_drop) << format->blue_shift) | ((a << 24) & format->alpha_mask);
+}
+
+/* Set up the conversion to the frame buffer, returns whether the alpha can be kept */
+static int bmp_format_init(bmp_format_t *format, int keep_alpha)
+{
+    video_info_t info     = video_get_info();
+    uint8_t      size[3]  = {info.red_mask_size, info.green_mask_size, info.blue_mask_size};
+    uint8_t      shift[3] = {info.red_mask_shift, info.green_mask_shift, info.blue_mask_shift};
+
+    /* Wider channels get the 8 bits at their top */
+    for (int i = 0; i < 3; i++) {
+        if (size[i] > 8) shift[i] += size[i] - 8;
+    }
+    format->red_shift   = shift[0];
+    format->green_shift = shift[1];
+    format->blue_shift  = shift[2];
+    format->red_drop    = size[0] < 8 ? 8 - size[0] : 0;
+    format->green_drop  = size[1] < 8 ? 8 - size[1] : 0;
+    format->blue_drop   = size[2] < 8 ? 8 - size[2] : 0;
+
+    format->bytewise = 1;
+    for (int i = 0; i < 3; i++) {
+        if (size[i] != 8 || shift[i] % 8 || shift[i] > 24) format->bytewise = 0;
+    }
+    if (shift[0] == shift[1] || shift[1] == shift[2] || shift[0] == shift[2]) format->bytewise = 0;
+
+    /* The blitter blends the low three bytes by the top one */
+    uint8_t alpha      = format->bytewise ? 6 - (shift[0] + shift[1] + shift[2]) / 8 : 0;
+    format->alpha_mask = keep_alpha && format->bytewise && alpha == 3 ? 0xff000000 : 0;
+    if (!format->bytewise) return 0;
+
+    /* Each output byte takes the channel of its pixel that belongs there, 0x80 clears it */
+    for (int i = 0; i < 4; i++) {
+        uint8_t *out24 = format->shuffle24 + i * 4;
+        uint8_t *out32 = format->shuffle32 + i * 4;
+        out24[shift[2] / 8] = i * 3;
+        out24[shift[1] / 8] = i * 3 + 1;
+        out24[shift[0] / 8] = i * 3 + 2;
+        out24[alpha]        = 0x80;
+        out32[shift[2] / 8] = i * 4;
+        out32[shift[1] / 8] = i * 4 + 1;
+        out32[shift[0] / 8] = i * 4 + 2;
+        out32[alpha]        = format->alpha_mask ? i * 4 + 3 : 0x80;
+    }
+    return format->alpha_mask != 0;
+}
+
+#if CPU_FEATURE_SSE
+static int bmp_ssse3 = -1; // pshufb is usable, -1 until checked
+
+typedef char bmp_v16qi_t __attribute__((vector_size(16)));
+typedef char bmp_v16qiu_t __attribute__((vector_size(16), aligned(1)));
+
+/* Shuffle groups of 4 pixels into frame buffer pixels, returns the pixels converted */
+static __attribute__((target("ssse3"))) uint32_t bmp_shuffle_ssse3(uint32_t *dst, const uint8_t *src, uint32_t count, uint32_t step,
+                                                                     const uint8_t *control)
+{
+    bmp_v16qi_t mask = *(const bmp_v16qiu_t *)control;
+    uint32_t    need = step == 3 ? 6 : 4; // Pixels left that cover a whole 16-byte load
+    uint32_t    done = 0;
+
+    for (; count - done >= need; done += 4, src += 4 * step, dst += 4) {
+        bmp_v16qi_t pixels   = *(const bmp_v16qiu_t *)src;
+        *(bmp_v16qiu_t *)dst = __builtin_ia32_pshufb128(pixels, mask);
+    }
+    return done;
+}
+#endif
+
+/* Convert a row of BGR (step 3) or BGRA (step 4) pixels */
+static void bmp_row_bgr(const bmp_format_t *format, uint32_t *dst, const uint8_t *src, uint32_t count, uint32_t step)
+{
+    uint32_t done = 0;
+
+#if CPU_FEATURE_SSE
+    if (bmp_ssse3 < 0) bmp_ssse3 = cpu_support_ssse3();
+    if (format->bytewise && bmp_ssse3) done = bmp_shuffle_ssse3(dst, src, count, step, step == 3 ? format->shuffle24 : format->shuffle32);
+#endif
+    for (src += done * step; done < count; done++, src += step) dst[done] = bmp_pixel(format, src[2], src[1], src[0], step == 4 ? src[3] : 0);
+}
+
+/* Describe a channel by its mask */
+static bmp_channel_t bmp_channel_init(uint32_t mask)
+{
+    if (!mask) return (bmp_channel_t) {0, 0, 0};
+    uint8_t shift = __builtin_ctz(mask);
+    uint8_t size  = (mask >> shift) == 0xffffffff ? 32 : __builtin_ctz((mask >> shift) + 1);
+    return (bmp_channel_t) {mask, shift, size};
+}
+
+/* Scale a channel of a pixel to 8 bits */
+static uint32_t bmp_channel(const bmp_channel_t *channel, uint32_t value)
+{
+    if (!channel->mask) return 0;
+    uint32_t raw = (value & channel->mask) >> channel->shift;
+    if (channel->size >= 8) return raw >> (channel->size - 8);
+    return raw * 255 / ((1U << channel->size) - 1);
+}
+
+/* Convert a row of 16 or 32-bit pixels by channel masks */
+static void bmp_row_bitfields(const bmp_format_t *format, const bmp_channel_t *channels, uint32_t *dst, const uint8_t *src, uint32_t count,
+                              uint32_t step)
+{
+    for (uint32_t i = 0; i < count; i++, src += step) {
+        uint32_t value = src[0] | (src[1] << 8);
+        if (step == 4) value |= (src[2] << 16) | ((uint32_t)src[3] << 24);
+        dst[i] = bmp_pixel(format, bmp_channel(&channels[0], value), bmp_channel(&channels[1], value), bmp_channel(&channels[2], value),
+                           bmp_channel(&channels[3], value));
+    }
+}
+
+/* Convert a row of 1, 4 or 8-bit palette indices */
+static void bmp_row_indexed(const bmp_format_t *format, uint32_t *dst, const uint8_t *src, uint32_t count, uint32_t bpp)
+{
+    if (bpp == 8) {
+        for (uint32_t i = 0; i < count; i++) dst[i] = format->palette[src[i]];
+        return;
+    }
+    uint32_t per_byte = 8 / bpp;
+    uint32_t mask     = (1 << bpp) - 1;
+    for (uint32_t i = 0; i < count; i++) dst[i] = format->palette[(src[i / per_byte] >> (8 - bpp - (i % per_byte) * bpp)) & mask];
+}
+
+/* Convert the palette following the info header */
+static void bmp_palette_init(bmp_format_t *format, const bmp_t *bmp, const uint8_t *end)
+{
+    uint64_t       start  = (uint64_t)BMP_FILE_HEADER + bmp->bmp_info_size;
+    uint64_t       size   = (uint64_t)(end - (const uint8_t *)bmp);
+    const uint8_t *entry  = (const uint8_t *)bmp + start;
+    uint64_t       avail  = start < size ? (size - start) / 4 : 0; // Entries inside the file, the rest stay black
+    uint64_t       colors = bmp->used_color_count ? bmp->used_color_count : 1U << bmp->bits_per_pixel;
+
+    if (colors > 256) colors = 256;
+    if (colors > avail) colors = avail;
+    for (uint32_t i = 0; i < 256; i++) format->palette[i] = 0;
+    for (uint32_t i = 0; i < colors; i++, entry += 4) format->palette[i] = bmp_pixel(format, entry[2], entry[1], entry[0], 0);
+}
+
+/* Get the strip slot of the next row of the file */
+static uint32_t *bmp_strip_row(bmp_strip_t *strip)
+{
+    uint32_t slot = strip->bottom_up ? BMP_STRIP_ROWS - 1 - strip->count : strip->count;
+    return strip->pixels + (size_t)slot * strip->width;
+}
+
+/* Blit the rows waiting in the strip */
+static void bmp_strip_flush(bmp_strip_t *strip)
+{
+    if (!strip->count) return;
+
+    blit_surface_t surface = {strip->pixels, strip->width, BMP_STRIP_ROWS, strip->width};
+    if (strip->bottom_up) {
+        blit_rect_t rect = {0, (int32_t)(BMP_STRIP_ROWS - strip->count), strip->width, strip->count};
+        video_blit(strip->x, strip->y + (int32_t)(strip->height - strip->row), &surface, rect, strip->mode, 0);
+    } else {
+        blit_rect_t rect = {0, 0, strip->width, strip->count};
+        video_blit(strip->x, strip->y + (int32_t)(strip->row - strip->count), &surface, rect, strip->mode, 0);
+    }
+    strip->count = 0;
+}
+
+/* Finish the current row of the file */
+static void bmp_strip_push(bmp_strip_t *strip)
+{
+    strip->row++;
+    if (++strip->count == BMP_STRIP_ROWS) bmp_strip_flush(strip);
+}
+
+/* Start a blank row of an RLE image, returns 0 past the last row */
+static uint32_t *bmp_rle_blank(bmp_strip_t *strip)
+{
+    if (strip->row >= strip->height) return 0;
+    uint32_t *row = bmp_strip_row(strip);
+    for (uint32_t i = 0; i < strip->width; i++) row[i] = 0;
+    return row;
+}
+
+/* Decode RLE8 or RLE4 runs, pixels the runs leave out stay blank */
+static void bmp_decode_rle(bmp_strip_t *strip, const bmp_format_t *format, const uint8_t *data, const uint8_t *end, int rle4)
+{
+    uint32_t *row = bmp_rle_blank(strip);
+    uint32_t  x   = 0;
+
+    while (row && data + 2 <= end) {
+        uint32_t count = data[0];
+        uint32_t value = data[1];
+        data += 2;
+
+        if (count) {
+            /* Encoded run, RLE4 alternates the two nibbles */
+            for (uint32_t i = 0; i < count && x < strip->width; i++, x++)
+                row[x] = format->palette[rle4 ? (i & 1 ? value & 0xf : value >> 4) : value];
+        } else if (value == 0) {
+            /* End of line */
+            bmp_strip_push(strip);
+            row = bmp_rle_blank(strip);
+            x   = 0;
+        } else if (value == 1) {
+            /* End of bitmap */
+            break;
+        } else if (value == 2) {
+            /* Move right and down */
+            if (data + 2 > end) break;
+            x += data[0];
+            for (uint32_t i = 0; i < data[1] && row; i++) {
+                bmp_strip_push(strip);
+                row = bmp_rle_blank(strip);
+            }
+            data += 2;
+        } else {
+            /* Absolute run of `value` pixels, padded to 16 bits */
+            uint32_t bytes = rle4 ? (value + 1) / 2 : value;
+            if (data + bytes > end) break;
+            for (uint32_t i = 0; i < value && x < strip->width; i++, x++)
+                row[x] = format->palette[rle4 ? (i & 1 ? data[i / 2] & 0xf : data[i / 2] >> 4) : data[i]];
+            data += (bytes + 1) & ~1U;
+        }
+    }
+    if (row) bmp_strip_push(strip);
+}
+
+/* Parse bitmap images and draw them to the screen, with transparency black is skipped and images with alpha are blended */
 void bmp_analysis(bmp_t *bmp, uint32_t offset_x, uint32_t offset_y, int enable_transparency)
 {
-    if (bmp->magic != 0x4d42 || bmp->bits_per_pixel != 24) return;
+    if (bmp->magic != BMP_MAGIC || bmp->file_size < sizeof(bmp_t)) return;
+    if (!bmp->frame_width || bmp->frame_width > BMP_MAX_WIDTH || !bmp->frame_height) return;
+
+    const uint8_t     *end         = (const uint8_t *)bmp + bmp->file_size;
+    const uint8_t     *data        = (const uint8_t *)bmp + bmp->bmp_data_offset;
+    const bmp_masks_t *masks       = (const bmp_masks_t *)(bmp + 1);
+    int32_t            height      = (int32_t)bmp->frame_height;
+    uint32_t           bpp         = bmp->bits_per_pixel;
+    uint32_t           compression = bmp->compression_mode;
+    uint64_t           row_bytes   = (((uint64_t)bmp->frame_width * bpp + 31) / 32) * 4;
+
+    int rle     = (compression == BMP_RLE8 && bpp == 8) || (compression == BMP_RLE4 && bpp == 4);
+    int indexed = compression == BMP_RGB && (bpp == 1 || bpp == 4 || bpp == 8);
+    int direct  = (compression == BMP_RGB && (bpp == 16 || bpp == 24 || bpp == 32)) ||
+                 (compression == BMP_BITFIELDS && (bpp == 16 || bpp == 32) && bmp->bmp_info_size >= 40);
+    if (!rle && !indexed && !direct) return;
+    if (data >= end || height == (int32_t)0x80000000) return;
+
+    bmp_strip_t strip = {
+        .width     = bmp->frame_width,
+        .height    = height < 0 ? -height : height,
+        .bottom_up = height > 0,
+        .x         = offset_x,
+        .y         = offset_y,
+        .row       = 0,
+        .count     = 0,
+        .mode      = enable_transparency ? BLIT_MASKED : BLIT_COPY,
+    };
+    if (!rle && row_bytes * strip.height > (uint64_t)(end - data)) return;
+
+    /* The masks follow a 40-byte info header, the alpha mask is read only from a larger one */
+    uint32_t mask_bytes = bmp->bmp_info_size >= 56 ? sizeof(bmp_masks_t) : 3 * sizeof(uint32_t);
+    if (compression == BMP_BITFIELDS && (const uint8_t *)masks + mask_bytes > end) return;
+
+    /* Pixels without a palette are described by channel masks, 24 bits and plain 8-bit channels take the shuffles */
+    bmp_channel_t channels[4] = {bmp_channel_init(0x7c00), bmp_channel_init(0x03e0), bmp_channel_init(0x001f), bmp_channel_init(0)};
+    if (bpp == 32) {
+        channels[0] = bmp_channel_init(0x00ff0000);
+        channels[1] = bmp_channel_init(0x0000ff00);
+        channels[2] = bmp_channel_init(0x000000ff);
+    }
+    if (compression == BMP_BITFIELDS) {
+        channels[0] = bmp_channel_init(masks->red_mask);
+        channels[1] = bmp_channel_init(masks->green_mask);
+        channels[2] = bmp_channel_init(masks->blue_mask);
+        if (bmp->bmp_info_size >= 56) channels[3] = bmp_channel_init(masks->alpha_mask);
+    }
+    int bgra = bpp == 32 && channels[0].mask == 0x00ff0000 && channels[1].mask == 0x0000ff00 && channels[2].mask == 0x000000ff &&
+               (!channels[3].mask || channels[3].mask == 0xff000000);
 
-    uint8_t *data      = (uint8_t *)bmp + bmp->bmp_data_offset;
-    uint32_t row_bytes = (bmp->frame_width * 3 + 3) & ~3;
+    bmp_format_t format;
+    if (bmp_format_init(&format, enable_transparency && channels[3].mask) && direct) strip.mode = BLIT_BLEND;
+    if (rle || indexed) bmp_palette_init(&format, bmp, end);
 
-    for (uint32_t y_offset = 0; y_offset < bmp->frame_height; ++y_offset) {
-        for (uint32_t x_offset = 0; x_offset < bmp->frame_width; ++x_offset) {
-            uint32_t pixel_offset = y_offset * row_bytes + x_offset * 3;
-            uint8_t  b            = data[pixel_offset + 0];
-            uint8_t  g            = data[pixel_offset + 1];
-            uint8_t  r            = data[pixel_offset + 2];
-            uint32_t color        = (r << 16) | (g << 8) | b;
+    strip.pixels = (uint32_t *)malloc((size_t)strip.width * BMP_STRIP_ROWS * sizeof(uint32_t));
+    if (!strip.pixels) return;
 
-            if (enable_transparency && color == 0) continue;
-            video_draw_pixel(offset_x + x_offset, offset_y + bmp->frame_height - 1 - y_offset, color);
+    if (rle) {
+        bmp_decode_rle(&strip, &format, data, end, compression == BMP_RLE4);
+    } else {
+        /* Whole rows are converted straight into the strip */
+        for (uint32_t i = 0; i < strip.height; i++, data += row_bytes) {
+            uint32_t *row = bmp_strip_row(&strip);
+            if (indexed)
+                bmp_row_indexed(&format, row, data, strip.width, bpp);
+            else if (bpp == 24 || bgra)
+                bmp_row_bgr(&format, row, data, strip.width, bpp / 8);
+            else
+                bmp_row_bitfields(&format, channels, row, data, strip.width, bpp / 8);
+            bmp_strip_push(&strip);
         }
     }
+    bmp_strip_flush(&strip);
+    free(strip.pixels);
+    video_flush();
 }
 
 /* NOLINTEND(bugprone-easily-swappable-parameters) */
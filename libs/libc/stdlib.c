@@ -12,22 +12,170 @@
 #include "stdlib.h"
 #include "stdint.h"
 
+static const char upper_digits[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+static const char lower_digits[] = "0123456789abcdefghijklmnopqrstuvwxyz";
+
+/* "00" to "99", two decimal digits per division */
+static const char decimal_pairs[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+/* Powers of ten up to 10^19, for the decimal length */
+static const uint64_t decimal_powers[20] = {
+    1ULL,
+    10ULL,
+    100ULL,
+    1000ULL,
+    10000ULL,
+    100000ULL,
+    1000000ULL,
+    10000000ULL,
+    100000000ULL,
+    1000000000ULL,
+    10000000000ULL,
+    100000000000ULL,
+    1000000000000ULL,
+    10000000000000ULL,
+    100000000000000ULL,
+    1000000000000000ULL,
+    10000000000000000ULL,
+    100000000000000000ULL,
+    1000000000000000000ULL,
+    10000000000000000000ULL,
+};
+
+/* Number of digits of an unsigned integer in a base (2 to 36) */
+size_t num_digits(uint64_t num, size_t base)
+{
+    int bits = 64 - __builtin_clzll(num | 1); // Significant bits, at least 1
+
+    /* Powers of two take a whole number of bits per digit */
+    if (!(base & (base - 1))) {
+        int shift = __builtin_ctzll(base);
+        return (bits + shift - 1) / shift;
+    }
+
+    /* bits * log10(2) is off by at most one, a table lookup settles it */
+    if (base == 10) {
+        size_t digits = ((size_t)bits * 1233) >> 12;
+        return digits + (num >= decimal_powers[digits]) + !num;
+    }
+
+    size_t digits = 1;
+    while (num >= base) {
+        num /= base;
+        digits++;
+    }
+    return digits;
+}
+
+/* Write the `len` digits of an unsigned integer to `str`, `len` comes from num_digits() */
+static void num_write(char *str, uint64_t num, size_t base, size_t len, const char *digits)
+{
+    char *pos = str + len;
+
+    if (base == 10) {
+        while (num >= 100) {
+            uint64_t pair = num % 100;
+            num /= 100;
+            pos -= 2;
+            pos[0] = decimal_pairs[pair * 2];
+            pos[1] = decimal_pairs[pair * 2 + 1];
+        }
+        if (num >= 10) {
+            pos -= 2;
+            pos[0] = decimal_pairs[num * 2];
+            pos[1] = decimal_pairs[num * 2 + 1];
+        } else {
+            *--pos = (char)('0' + num);
+        }
+    } else if (!(base & (base - 1))) {
+        int      shift = __builtin_ctzll(base);
+        uint64_t mask  = base - 1;
+        while (pos > str) {
+            *--pos = digits[num & mask];
+            num >>= shift;
+        }
+    } else {
+        while (pos > str) {
+            *--pos = digits[num % base];
+            num /= base;
+        }
+    }
+}
+
+/* Convert an unsigned integer to a string in a base (2 to 36), returns its length without the '\0' */
+size_t utoa(uint64_t num, char *str, size_t base)
+{
+    if (base < 2 || base > 36) {
+        *str = '\0';
+        return 0;
+    }
+
+    size_t len = num_digits(num, base);
+    num_write(str, num, base, len, lower_digits);
+    str[len] = '\0';
+    return len;
+}
+
+/* Convert a signed integer to a string in a base (2 to 36), returns its length without the '\0' */
+size_t itoa(int64_t num, char *str, size_t base)
+{
+    if (num >= 0) return utoa((uint64_t)num, str, base);
+    *str = '-';
+    return utoa(-(uint64_t)num, str + 1, base) + 1;
+}
+
+/* Write a slice to a writer */
+size_t writer_write(writer *writer, const char *str, size_t len)
+{
+    if (writer->span) return writer->span(writer, str, len);
+
+    size_t written = 0;
+    while (written < len && writer->handler(writer, str[written])) written++;
+    return written;
+}
+
+/* Write a character repeatedly to a writer */
+size_t writer_fill(writer *writer, char c, size_t count)
+{
+    char   chunk[32];
+    size_t written = 0;
+
+    for (size_t i = 0; i < sizeof(chunk) && i < count; i++) chunk[i] = c;
+    while (written < count) {
+        size_t len  = count - written < sizeof(chunk) ? count - written : sizeof(chunk);
+        size_t done = writer_write(writer, chunk, len);
+        written += done;
+        if (done < len) break;
+    }
+    return written;
+}
+
 /* Write a formatted number to a writer */
 size_t wnumber(writer *writer, num_formatter_t fmter, num_fmt_type type) // NOLINT
 {
     char        c = 0;
-    char        tmp[65];
+    char        tmp[64];
+    char        prefix[3];
     int         sign      = 0;
-    const char *digits    = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ";
-    int         i         = 0; // index for tmp
+    const char *digits    = upper_digits;
+    int         i         = 0; // number of digits
+    int         n         = 0; // length of the prefix
     int64_t     size      = (int64_t)fmter.size;
     int64_t     precision = (int64_t)fmter.precision;
     size_t      base      = fmter.base;
+    size_t      result    = 0;
 
-    write_handler write  = writer->handler;
-    size_t        result = 0;
-
-    if (type.small) digits = "0123456789abcdefghijklmnopqrstuvwxyz";
+    if (type.small) digits = lower_digits;
     if (type.left) type.zeropad = 0;     // if left adjust, zero padding is not allowed
     if (base < 2 || base > 36) return 0; // Invalid base
 
@@ -44,63 +192,57 @@ size_t wnumber(writer *writer, num_formatter_t fmter, num_fmt_type type) // NOLI
     } else {
         sign = 0;
     }
-    if (sign) size--;
+    if (sign) prefix[n++] = (char)sign;
 
     /* Special like 0x, 0 */
     if (type.special) {
         if (base == 16) {
-            size -= 2;
+            prefix[n++] = '0';
+            prefix[n++] = digits[33]; // 33 is 'x' or 'X'
         } else if (base == 8) {
-            size--;
+            prefix[n++] = '0';
         }
     }
+    size -= n;
 
-    i = 0;
-
-    if (!(fmter.num)) {
-        tmp[i++] = '0';
-    } else {
-        while (fmter.num) {
-            tmp[i++]  = digits[(uint64_t)fmter.num % (uint64_t)base];
-            fmter.num = (uint64_t)fmter.num / (uint64_t)fmter.base;
-        }
-    }
+    /* The length is known up front, so the digits are converted once */
+    i = (int)num_digits(fmter.num, base);
+    num_write(tmp, fmter.num, base, i, digits);
     if (i > precision) precision = i; // precision = max(precision, i);
 
     size -= precision;
 
-    /* If type no include LEFT or ZEROPAD */
-    if (!(type.zeropad || type.left)) {
-        /* Fill in the space */
-        while (size-- > 0) write(writer, ' '), result++;
+    /* If type no include LEFT or ZEROPAD, fill in the space */
+    if (!(type.zeropad || type.left) && size > 0) {
+        writer_fill(writer, ' ', size);
+        result += size;
+        size = 0;
     }
 
-    /* Write the sign */
-    if (sign) write(writer, (char)sign), result++;
-
-    /* Write the prefix */
-    if (type.special) {
-        if (base == 8) {
-            write(writer, '0'), result++;
-        } else if (base == 16) {
-            write(writer, '0'), result++;
-            write(writer, digits[33]), result++; // 33 is 'x' or 'X'
-        }
-    }
+    /* Write the sign and the prefix */
+    writer_write(writer, prefix, n);
+    result += n;
 
-    if (!(type.left)) {
-        /* Write the padding */
-        while (size-- > 0) write(writer, c), result++;
+    /* Write the padding */
+    if (!(type.left) && size > 0) {
+        writer_fill(writer, c, size);
+        result += size;
+        size = 0;
     }
 
     /* Write the zero padding */
-    while (i < precision--) write(writer, '0'), result++;
+    writer_fill(writer, '0', precision - i);
+    result += precision - i;
 
     /* Write the number */
-    while (i-- > 0) write(writer, tmp[i]), result++;
+    writer_write(writer, tmp, i);
+    result += i;
 
     /* LEFT adjust */
-    while (size-- > 0) write(writer, ' '), result++;
+    if (size > 0) {
+        writer_fill(writer, ' ', size);
+        result += size;
+    }
     return result;
 }
 
@@ -132,14 +274,14 @@ int skip_atoi(const char **s)
 /* Formatting an integer as a string */
 char *number(char *str, size_t num, size_t base, size_t size, size_t precision, int type) // NOLINT
 {
-    char        c, tmp[65];
+    char        c;
     int         sign;
-    const char *digits = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+    const char *digits = upper_digits;
     int         i;
     int64_t     size_      = (int64_t)size;
     int64_t     precision_ = (int64_t)precision;
 
-    if (type & SMALL) digits = "0123456789abcdefghijklmnopqrstuvwxyz";
+    if (type & SMALL) digits = lower_digits;
     if (type & LEFT) type &= ~ZEROPAD;   // if left adjust, zero padding is not allowed
     if (base < 2 || base > 36) return 0; // Invalid base
 
@@ -163,15 +305,7 @@ char *number(char *str, size_t num, size_t base, size_t size, size_t precision,
         }
     }
 
-    i = 0;
-    if (num == 0) {
-        tmp[i++] = '0';
-    } else {
-        while (num != 0) {
-            tmp[i++] = digits[(uint64_t)num % (uint64_t)base];
-            num      = (uint64_t)num / (uint64_t)base;
-        }
-    }
+    i = (int)num_digits(num, base);
     if (i > precision_) precision_ = i;
     size_ -= precision_;
 
@@ -203,7 +337,8 @@ char *number(char *str, size_t num, size_t base, size_t size, size_t precision,
     while (i < precision_--) *str++ = '0';
 
     /* Write the number */
-    while (i-- > 0) *str++ = tmp[i];
+    num_write(str, num, base, i, digits);
+    str += i;
 
     /* LEFT adjust */
     while (size_-- > 0) *str++ = ' ';
@@ -217,19 +352,13 @@ uint64_t number_length(size_t num, size_t base, size_t size, size_t precision, i
     char     sign          = 0; // is there a sign (0: no sign, 1: sign)
     size_t   number_digits = 0;
     uint64_t res           = 0;
+    if (base < 2 || base > 36) return 0; // Invalid base
     if ((type & SIGN && (int64_t)num < 0)) {
         num  = -(int64_t)num;
         sign = 1;
     }
     if (type & PLUS || type & SPACE) sign = 1;
-    if (num == 0) {
-        number_digits = 1;
-    } else {
-        while (num != 0) {
-            number_digits++;
-            num = (uint64_t)num / (uint64_t)base;
-        }
-    }
+    number_digits = num_digits(num, base);
     if (type & SPECIAL) {
         if (base == 16) {
             res += 2;
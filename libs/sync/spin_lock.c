@@ -29,3 +29,9 @@ void spin_unlock(spinlock_t *lock)
     lock->lock = 0;
     __asm__ volatile("push %0; popfq" ::"r"(lock->rflags));
 }
+
+/* Force a spinlock free whoever holds it (only on panic, when the holder may never release it) */
+void spin_lock_reset(spinlock_t *lock)
+{
+    __atomic_store_n(&lock->lock, 0, __ATOMIC_RELEASE);
+}